@@ -0,0 +1,355 @@
+// the tracker against minimal http and udp (BEP 15) clients on localhost.
+// announce round trips on one keep-alive connection, with a new connection
+// per request and over udp, then how long stop and restart take until they are noticed.
+// junk datagrams check the udp tracker keeps answering.
+//
+// usage: ttt_bench_tracker [-n requests] [-f friends]
+
+#include "../src/tracker.hpp"
+#include "../src/tracker_util.hpp"
+#include "../src/latency_histogram.hpp"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+namespace {
+
+// tracker_set_http_port is not implemented, so always the default
+constexpr static uint16_t tracker_port = 8000;
+// for the tracker thread to listen, after start and restart
+constexpr static float listen_timeout = 5.f;
+
+struct Options {
+	size_t requests {5000};
+	uint32_t friends {20};
+};
+
+static bool parse_args(int argc, char** argv, Options& opts) {
+	for (int i = 1; i < argc; i++) {
+		const std::string arg {argv[i]};
+		if (i + 1 >= argc) {
+			return false;
+		}
+		const std::string value {argv[++i]};
+
+		if (arg == "-n") {
+			opts.requests = std::strtoul(value.c_str(), nullptr, 10);
+		} else if (arg == "-f") {
+			opts.friends = std::strtoul(value.c_str(), nullptr, 10);
+		} else {
+			return false;
+		}
+	}
+
+	return opts.requests > 0;
+}
+
+// blocking, -1 on failure
+static int tracker_connect(void) {
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+
+	// the requests are tiny, dont wait for more
+	const int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	sockaddr_in addr {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(tracker_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// sends request and reads one whole response (headers + Content-Length body).
+// false if the connection broke
+static bool tracker_request(const int fd, const std::string& request, std::string& response) {
+	if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != ssize_t(request.size())) {
+		return false;
+	}
+
+	response.clear();
+	size_t header_end = std::string::npos;
+	size_t content_length = 0;
+	while (true) {
+		char buff[4096];
+		const ssize_t got = recv(fd, buff, sizeof(buff), 0);
+		if (got <= 0) {
+			return false;
+		}
+		response.append(buff, got);
+
+		if (header_end == std::string::npos) {
+			header_end = response.find("\r\n\r\n");
+			if (header_end == std::string::npos) {
+				continue;
+			}
+			header_end += 4;
+
+			const size_t cl = response.find("Content-Length: ");
+			if (cl == std::string::npos || cl > header_end) {
+				return false; // mongoose always sends it
+			}
+			content_length = std::strtoul(response.c_str() + cl + 16, nullptr, 10);
+		}
+
+		if (response.size() >= header_end + content_length) {
+			return response.compare(0, 12, "HTTP/1.1 200") == 0;
+		}
+	}
+}
+
+static void append_be32(std::string& out, const uint32_t value) {
+	for (size_t i = 0; i < 4; i++) {
+		out += char(value >> (24 - i*8));
+	}
+}
+
+static void append_be64(std::string& out, const uint64_t value) {
+	append_be32(out, value >> 32);
+	append_be32(out, value);
+}
+
+// blocking and connected, so send()/recv() work. -1 on failure
+static int tracker_udp_socket(void) {
+	const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+
+	// a lost datagram should fail the run, not hang it
+	timeval timeout {1, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	sockaddr_in addr {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(tracker_port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// false on timeout or an error response (action 3)
+static bool tracker_udp_request(const int fd, const std::string& request, std::string& response) {
+	if (send(fd, request.data(), request.size(), 0) != ssize_t(request.size())) {
+		return false;
+	}
+
+	response.resize(2048);
+	const ssize_t got = recv(fd, response.data(), response.size(), 0);
+	if (got < 8) {
+		return false;
+	}
+	response.resize(got);
+
+	return response.compare(0, 4, request, 8, 4) == 0; // same action
+}
+
+// retries until the tracker answers, seconds it took or -1 on timeout
+static float wait_for_tracker(const std::string& request) {
+	const auto start = std::chrono::steady_clock::now();
+	std::string response;
+	while (std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() < listen_timeout) {
+		const int fd = tracker_connect();
+		if (fd >= 0) {
+			const bool ok = tracker_request(fd, request, response);
+			close(fd);
+			if (ok) {
+				return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+	return -1.f;
+}
+
+static void print_run(const char* name, const ttt::LatencyHistogram& lat, const size_t requests, const float seconds) {
+	std::printf("%-12s %10zu %10.1f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+		name, requests, requests / seconds,
+		lat.value_at_quantile(0.5), lat.value_at_quantile(0.9),
+		lat.value_at_quantile(0.99), lat.max()
+	);
+	std::fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	Options opts {};
+	if (!parse_args(argc, argv, opts)) {
+		std::cerr << "usage: " << argv[0] << " [-n requests] [-f friends]\n";
+		return 2;
+	}
+
+	TorrentDB torrent_db {};
+	std::mutex torrent_db_mutex;
+
+	// one torrent every friend has a tunnel for
+	Torrent t;
+	t.info_hash_v1 = InfoHashV1{"0102030405060708091011121314151617181920"};
+	for (uint32_t f = 0; f < opts.friends; f++) {
+		torrent_db.add_torrent_friend(t, f);
+		torrent_db.peers[f] = 20000 + f;
+	}
+
+	const std::string request {
+		"GET /announce?info_hash=%01%02%03%04%05%06%07%08%09%10%11%12%13%14%15%16%17%18%19%20"
+		"&peer_id=-qB4520-Ab1cD2eF3gH4&port=6881&uploaded=0&downloaded=0&left=0"
+		"&event=started&numwant=200&compact=1&no_peer_id=1 HTTP/1.1\r\n"
+		"Host: localhost:8000\r\n"
+		"\r\n"
+	};
+
+	ttt::tracker_start(torrent_db, torrent_db_mutex);
+	if (wait_for_tracker(request) < 0.f) {
+		std::cerr << "!!! tracker did not come up on port " << tracker_port << "\n";
+		return 1;
+	}
+
+	std::printf("%-12s %10s %10s %8s %8s %8s %8s\n",
+		"mode", "requests", "req/s", "p50_us", "p90_us", "p99_us", "max_us"
+	);
+
+	std::string response;
+	{ // keep-alive, what torrent clients do
+		ttt::LatencyHistogram lat {};
+		const int fd = tracker_connect();
+		if (fd < 0) {
+			std::cerr << "!!! failed to connect\n";
+			return 1;
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < opts.requests; i++) {
+			const uint64_t req_start = ttt::monotonic_us();
+			if (!tracker_request(fd, request, response)) {
+				std::cerr << "!!! request failed\n";
+				return 1;
+			}
+			lat.record(ttt::monotonic_us() - req_start);
+		}
+		print_run("keepalive", lat, opts.requests, std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count());
+		close(fd);
+	}
+
+	{ // BEP 15, one connect then announces with that connection id
+		ttt::LatencyHistogram lat {};
+		const int fd = tracker_udp_socket();
+		if (fd < 0) {
+			std::cerr << "!!! failed to create udp socket\n";
+			return 1;
+		}
+
+		std::string connect_request;
+		append_be64(connect_request, ttt::udp_tracker_protocol_id);
+		append_be32(connect_request, uint32_t(ttt::UDPTrackerRequest::Action::CONNECT));
+		append_be32(connect_request, 1); // transaction id
+		if (!tracker_udp_request(fd, connect_request, response) || response.size() < 16) {
+			std::cerr << "!!! udp connect failed\n";
+			return 1;
+		}
+
+		std::string announce_request {response.substr(8, 8)}; // connection id
+		append_be32(announce_request, uint32_t(ttt::UDPTrackerRequest::Action::ANNOUNCE));
+		append_be32(announce_request, 2); // transaction id
+		for (uint8_t i = 1; i <= 20; i++) { // same info_hash as the http request
+			announce_request += char((i / 10) << 4 | i % 10);
+		}
+		announce_request += "-qB4520-Ab1cD2eF3gH4";
+		append_be64(announce_request, 0); // downloaded
+		append_be64(announce_request, 0); // left
+		append_be64(announce_request, 0); // uploaded
+		append_be32(announce_request, 2); // started
+		append_be32(announce_request, 0); // ip
+		append_be32(announce_request, 0); // key
+		append_be32(announce_request, 200); // numwant
+		announce_request += "\x1a\xe1"; // port 6881
+
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < opts.requests; i++) {
+			const uint64_t req_start = ttt::monotonic_us();
+			if (!tracker_udp_request(fd, announce_request, response)) {
+				std::cerr << "!!! udp announce failed\n";
+				return 1;
+			}
+			lat.record(ttt::monotonic_us() - req_start);
+		}
+		print_run("udp", lat, opts.requests, std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count());
+
+		// junk must not take the udp tracker down, an empty datagram used to close it
+		const std::string junk[] {
+			std::string{},
+			std::string{"\x13" "BitTorrent protocol"},
+			std::string(16, '\xff'),
+		};
+		for (const auto& datagram : junk) {
+			send(fd, datagram.data(), datagram.size(), 0);
+			if (!tracker_udp_request(fd, connect_request, response)) {
+				std::cerr << "!!! udp tracker stopped answering after a " << datagram.size() << " byte junk datagram\n";
+				return 1;
+			}
+		}
+		std::printf("%-12s %10zu junk datagrams survived\n", "udp_junk", std::size(junk));
+
+		close(fd);
+	}
+
+	{ // connect + request + close
+		ttt::LatencyHistogram lat {};
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < opts.requests; i++) {
+			const uint64_t req_start = ttt::monotonic_us();
+			const int fd = tracker_connect();
+			if (fd < 0 || !tracker_request(fd, request, response)) {
+				std::cerr << "!!! request failed\n";
+				return 1;
+			}
+			close(fd);
+			lat.record(ttt::monotonic_us() - req_start);
+		}
+		print_run("connect", lat, opts.requests, std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	// until the old thread is gone and the new one answers
+	const auto restart_start = std::chrono::steady_clock::now();
+	ttt::tracker_restart();
+	const float restart_join = std::chrono::duration<float>(std::chrono::steady_clock::now() - restart_start).count();
+	const float restart_up = wait_for_tracker(request);
+	if (restart_up < 0.f) {
+		std::cerr << "!!! tracker did not come back after restart\n";
+		return 1;
+	}
+
+	const auto stop_start = std::chrono::steady_clock::now();
+	ttt::tracker_stop();
+	const float stop = std::chrono::duration<float>(std::chrono::steady_clock::now() - stop_start).count();
+
+	std::printf("restart_ms %.3f (joined after %.3f)\n", (restart_join + restart_up) * 1000.f, restart_join * 1000.f);
+	std::printf("stop_ms %.3f\n", stop * 1000.f);
+
+	return 0;
+}
+
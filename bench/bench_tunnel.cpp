@@ -0,0 +1,482 @@
+// two tox nodes in one process, befriended over localhost.
+// a fake torrent client sends datagrams into the tunnel of the first node,
+// they come out of the second one into another socket.
+// no bootstrap nodes needed, so it runs offline.
+// with -m the nodes skip tox and talk over a MemoryTransport instead,
+// which can lose (-l), delay (-D ms) and reorder (-j ms) packets.
+// fails if a tunnel still allocated packet buffers after the warmup.
+//
+// usage: ttt_bench_tunnel [-d seconds] [-r packets_per_second] [-s size,size,...]
+//        [-m [-l loss] [-D delay_ms] [-j jitter_ms] [-q sendq_max]]
+
+#include "../src/tox_client_private.hpp"
+#include "../src/udp_socket.hpp"
+#include "../src/latency_histogram.hpp"
+#include "../src/memory_transport.hpp"
+
+#include <zed_net.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cerrno>
+
+namespace {
+
+using ttt::ext::ToxExtTunnelUDP2;
+
+// how long the nodes get to find each other and open their tunnels
+constexpr static float setup_timeout = 60.f;
+// after sending, for whatever is still in flight
+constexpr static float drain_time = 1.f;
+// every size once before measuring, after that nothing should allocate
+constexpr static float warmup_duration = 1.f;
+
+// [run (4)] [seq (4)] [send time us (8)], rest is filler
+constexpr static size_t header_size = 16;
+
+struct Node {
+	TorrentDB torrent_db {};
+	std::mutex torrent_db_mutex {};
+	ttt::ext::MemoryTransport transport {}; // -m only
+	ttt::ToxClient tc {torrent_db, torrent_db_mutex};
+
+	uint32_t peer {0}; // friend number of the other node
+
+	ToxExtTunnelUDP2& tunnel(void) {
+		return *static_cast<ToxExtTunnelUDP2*>(tc.extensions.at(1).get());
+	}
+
+	// 0 until the tunnel to peer is open
+	uint16_t tunnel_port(void) {
+		const std::lock_guard lock{torrent_db_mutex};
+		const auto it = torrent_db.peers.find(peer);
+		return it == torrent_db.peers.end() ? 0 : it->second;
+	}
+};
+
+// tox callbacks, user_data is the Node
+
+static void friend_connection_status_cb(Tox*, uint32_t friend_number, TOX_CONNECTION connection_status, void* user_data) {
+	if (connection_status != TOX_CONNECTION_NONE) {
+		static_cast<Node*>(user_data)->tunnel().negotiate_connection(friend_number);
+	}
+}
+
+static void friend_lossy_packet_cb(Tox*, uint32_t friend_number, const uint8_t* data, size_t length, void* user_data) {
+	static_cast<Node*>(user_data)->tunnel().friend_lossy_pkg_cb(friend_number, data, length);
+}
+
+static void friend_lossless_packet_cb(Tox*, uint32_t friend_number, const uint8_t* data, size_t length, void* user_data) {
+	toxext_handle_lossless_custom_packet(static_cast<Node*>(user_data)->tc.tox_ext, friend_number, data, length);
+}
+
+static bool node_setup(Node& node) {
+	TOX_ERR_OPTIONS_NEW err_opt_new;
+	Tox_Options* options = tox_options_new(&err_opt_new);
+	if (err_opt_new != TOX_ERR_OPTIONS_NEW::TOX_ERR_OPTIONS_NEW_OK) {
+		std::cerr << "!!! tox_options_new failed " << err_opt_new << "\n";
+		return false;
+	}
+	tox_options_set_local_discovery_enabled(options, true);
+	tox_options_set_udp_enabled(options, true);
+	tox_options_set_ipv6_enabled(options, false); // 127.0.0.1 is all we need
+
+	TOX_ERR_NEW err_new;
+	node.tc.tox = tox_new(options, &err_new);
+	tox_options_free(options);
+	if (err_new != TOX_ERR_NEW::TOX_ERR_NEW_OK) {
+		std::cerr << "!!! tox_new failed " << err_new << "\n";
+		return false;
+	}
+
+	tox_callback_friend_connection_status(node.tc.tox, friend_connection_status_cb);
+	tox_callback_friend_lossy_packet(node.tc.tox, friend_lossy_packet_cb);
+	tox_callback_friend_lossless_packet(node.tc.tox, friend_lossless_packet_cb);
+
+	node.tc.tox_ext = toxext_init(node.tc.tox);
+
+	// only the udp tunnel, the others would want the global client
+	node.tc.tunnel_ports_filename = ""; // no state between runs
+	node.tunnel().ud.tc = &node.tc;
+	node.tunnel().register_ext(node.tc.tox_ext);
+
+	return true;
+}
+
+// no tox, so nothing to connect or negotiate
+static void nodes_setup_memory(Node& a, Node& b, const ttt::ext::MemoryTransport& conditions) {
+	ttt::ext::MemoryTransport::connect(a.transport, b.transport);
+
+	for (Node* node : {&a, &b}) {
+		auto& t = node->transport;
+		t.loss = conditions.loss;
+		t.delay = conditions.delay;
+		t.jitter = conditions.jitter;
+		t.sendq_max = conditions.sendq_max;
+
+		t.lossy_fn = [node](uint32_t friend_number, const uint8_t* data, size_t size) {
+			node->tunnel().friend_lossy_pkg_cb(friend_number, data, size);
+		};
+		t.segment_fn = [node](uint32_t friend_number, const uint8_t* data, size_t size) {
+			node->tunnel().friend_custom_pkg_cb(friend_number, data, size, true);
+		};
+
+		node->peer = t.friend_number;
+		node->tc.tunnel_ports_filename = "";
+		node->tunnel().register_transport(&node->tc, &t);
+		node->tunnel().friend_compatible[node->peer] = true;
+	}
+}
+
+static bool nodes_befriend(Node& a, Node& b) {
+	for (auto [self, other] : {std::pair{&a, &b}, std::pair{&b, &a}}) {
+		std::array<uint8_t, TOX_PUBLIC_KEY_SIZE> key {};
+
+		tox_self_get_public_key(other->tc.tox, key.data());
+		Tox_Err_Friend_Add e_fa = TOX_ERR_FRIEND_ADD::TOX_ERR_FRIEND_ADD_OK;
+		self->peer = tox_friend_add_norequest(self->tc.tox, key.data(), &e_fa);
+		if (e_fa != TOX_ERR_FRIEND_ADD::TOX_ERR_FRIEND_ADD_OK) {
+			std::cerr << "!!! error adding friend " << e_fa << "\n";
+			return false;
+		}
+
+		// the other node is our only dht node
+		tox_self_get_dht_id(other->tc.tox, key.data());
+		const uint16_t port = tox_self_get_udp_port(other->tc.tox, nullptr);
+		Tox_Err_Bootstrap e_b = TOX_ERR_BOOTSTRAP::TOX_ERR_BOOTSTRAP_OK;
+		if (!tox_bootstrap(self->tc.tox, "127.0.0.1", port, key.data(), &e_b)) {
+			std::cerr << "!!! bootstrap failed " << e_b << "\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// what the receiving torrent client saw of the current run
+struct RunStats {
+	std::atomic<uint32_t> id {0};
+	std::atomic<uint64_t> packets {0};
+	std::atomic<uint64_t> bytes {0};
+	ttt::LatencyHistogram latency {}; // only written by the receive thread
+};
+
+static void receive_cb(void* user_data, const zed_net_address_t&, uint32_t, uint8_t* data, size_t size) {
+	auto& run = *static_cast<RunStats*>(user_data);
+	const uint64_t now = ttt::monotonic_us();
+
+	if (size < header_size) {
+		return;
+	}
+
+	uint32_t id;
+	uint64_t sent_us;
+	std::memcpy(&id, data, sizeof(id));
+	std::memcpy(&sent_us, data + 8, sizeof(sent_us));
+
+	if (id != run.id.load(std::memory_order_relaxed)) {
+		return; // straggler from the last size
+	}
+
+	run.packets.fetch_add(1, std::memory_order_relaxed);
+	run.bytes.fetch_add(size, std::memory_order_relaxed);
+	run.latency.record(now >= sent_us ? now - sent_us : 0);
+}
+
+static uint16_t socket_port(const ttt::UDPSocket& s) {
+	sockaddr_in addr {};
+	socklen_t addr_len = sizeof(addr);
+	if (getsockname(s.handle(), reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+		return 0;
+	}
+	return ntohs(addr.sin_port);
+}
+
+struct Options {
+	float duration {5.f}; // seconds per size
+	float rate {2000.f}; // datagrams per second, offered
+	std::vector<size_t> sizes {64, 512, 1200, 2000};
+
+	bool memory {false};
+	ttt::ext::MemoryTransport conditions {}; // only the settings get used
+};
+
+static bool parse_args(int argc, char** argv, Options& opts) {
+	for (int i = 1; i < argc; i++) {
+		const std::string arg {argv[i]};
+		if (arg == "-m") {
+			opts.memory = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			return false;
+		}
+		const std::string value {argv[++i]};
+
+		if (arg == "-d") {
+			opts.duration = std::strtof(value.c_str(), nullptr);
+		} else if (arg == "-r") {
+			opts.rate = std::strtof(value.c_str(), nullptr);
+		} else if (arg == "-l") {
+			opts.conditions.loss = std::strtof(value.c_str(), nullptr);
+		} else if (arg == "-D") {
+			opts.conditions.delay = std::strtof(value.c_str(), nullptr) / 1000.f;
+		} else if (arg == "-j") {
+			opts.conditions.jitter = std::strtof(value.c_str(), nullptr) / 1000.f;
+		} else if (arg == "-q") {
+			opts.conditions.sendq_max = std::strtoul(value.c_str(), nullptr, 10);
+		} else if (arg == "-s") {
+			opts.sizes.clear();
+			size_t pos = 0;
+			while (pos < value.size()) {
+				size_t next = value.find(',', pos);
+				if (next == std::string::npos) {
+					next = value.size();
+				}
+				opts.sizes.push_back(std::strtoul(value.substr(pos, next - pos).c_str(), nullptr, 10));
+				pos = next + 1;
+			}
+		} else {
+			return false;
+		}
+	}
+
+	for (const size_t size : opts.sizes) {
+		if (size < header_size || size > ttt::UDPSocket::datagram_size_max) {
+			std::cerr << "!!! sizes need to be in [" << header_size << ", " << ttt::UDPSocket::datagram_size_max << "]\n";
+			return false;
+		}
+	}
+
+	return opts.duration > 0.f && opts.rate > 0.f && !opts.sizes.empty();
+}
+
+// paced, so the offered load is the same for every build
+static uint64_t send_run(ttt::UDPSocket& s, const zed_net_address_t& addr, uint32_t run_id, size_t size, const Options& opts) {
+	std::vector<uint8_t> buff(size, 0x42);
+	std::memcpy(buff.data(), &run_id, sizeof(run_id));
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(opts.duration));
+
+	uint32_t seq = 0;
+	while (true) {
+		const auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seq / double(opts.rate)));
+		if (due >= end) {
+			break;
+		}
+		std::this_thread::sleep_until(due);
+
+		const uint64_t now = ttt::monotonic_us();
+		std::memcpy(buff.data() + 4, &seq, sizeof(seq));
+		std::memcpy(buff.data() + 8, &now, sizeof(now));
+		s.send(addr, buff.data(), buff.size());
+		s.flush();
+
+		seq++;
+	}
+
+	return seq;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	Options opts {};
+	if (!parse_args(argc, argv, opts)) {
+		std::cerr << "usage: " << argv[0] << " [-d seconds] [-r packets_per_second] [-s size,size,...]"
+			" [-m [-l loss] [-D delay_ms] [-j jitter_ms] [-q sendq_max]]\n";
+		return 2;
+	}
+
+	zed_net_init();
+
+	int ret = 0;
+	{
+		std::array<Node, 2> nodes {};
+		Node& sender_node = nodes[0];
+		Node& receiver_node = nodes[1];
+
+		if (opts.memory) {
+			nodes_setup_memory(sender_node, receiver_node, opts.conditions);
+		} else if (!node_setup(sender_node) || !node_setup(receiver_node) || !nodes_befriend(sender_node, receiver_node)) {
+			return 1;
+		}
+
+		// the torrent clients
+		ttt::UDPSocket sender {};
+		ttt::UDPSocket receiver {};
+		if (!sender.open(0) || !receiver.open(0)) {
+			std::cerr << "!!! failed to open the client sockets\n";
+			return 1;
+		}
+		// set before anything gets tunneled, the tox loop reads it
+		zed_net_get_address(&receiver_node.tunnel().outbound_address, "127.0.0.1", socket_port(receiver));
+
+		RunStats run {};
+		std::atomic_bool receiver_stop {false};
+		std::thread receiver_thread {[&]() {
+			pollfd pfd {receiver.handle(), POLLIN, 0};
+			while (!receiver_stop) {
+				if (poll(&pfd, 1, 10) > 0) {
+					receiver.receive(receive_cb, &run, ttt::UDPSocket::batch_size_max);
+				}
+			}
+		}};
+
+		std::atomic_bool warm {false};
+		std::atomic_bool done {false};
+		std::thread driver_thread {[&]() {
+			const auto setup_start = std::chrono::steady_clock::now();
+			uint16_t tunnel_port = 0;
+			while ((tunnel_port = sender_node.tunnel_port()) == 0 || receiver_node.tunnel_port() == 0) {
+				if (std::chrono::steady_clock::now() - setup_start > std::chrono::duration<float>(setup_timeout)) {
+					std::cerr << "!!! nodes did not connect within " << setup_timeout << "s\n";
+					ret = 1;
+					done = true;
+					return;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			}
+			std::cerr << "III tunnel up after "
+				<< std::chrono::duration<float>(std::chrono::steady_clock::now() - setup_start).count() << "s\n";
+
+			zed_net_address_t tunnel_addr {};
+			zed_net_get_address(&tunnel_addr, "127.0.0.1", tunnel_port);
+
+			{ // run id 0 is never counted
+				Options warmup_opts = opts;
+				warmup_opts.duration = std::min(opts.duration, warmup_duration);
+				for (const size_t size : opts.sizes) {
+					send_run(sender, tunnel_addr, 0, size, warmup_opts);
+				}
+				std::this_thread::sleep_for(std::chrono::duration<float>(drain_time));
+				warm = true;
+			}
+
+			std::printf("%8s %10s %10s %8s %10s %8s %8s %8s %8s %8s %8s\n",
+				"size", "sent", "received", "loss", "pps", "MB/s",
+				"p50_us", "p90_us", "p99_us", "p999_us", "max_us"
+			);
+
+			for (size_t i = 0; i < opts.sizes.size(); i++) {
+				const size_t size = opts.sizes[i];
+
+				run.id = i + 1;
+				run.packets = 0;
+				run.bytes = 0;
+				run.latency.reset();
+
+				const uint64_t sent = send_run(sender, tunnel_addr, i + 1, size, opts);
+				std::this_thread::sleep_for(std::chrono::duration<float>(drain_time));
+
+				const uint64_t received = run.packets;
+				const auto& lat = run.latency;
+				std::printf("%8zu %10" PRIu64 " %10" PRIu64 " %8.4f %10.1f %8.3f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+					size, sent, received,
+					sent > 0 ? 1. - double(received) / sent : 0.,
+					received / opts.duration,
+					run.bytes / opts.duration / 1e6,
+					lat.value_at_quantile(0.5), lat.value_at_quantile(0.9),
+					lat.value_at_quantile(0.99), lat.value_at_quantile(0.999),
+					lat.max()
+				);
+				std::fflush(stdout);
+			}
+
+			done = true;
+		}};
+
+		// the pools are only touched by the tox thread, so read them there
+		std::array<uint64_t, 2> warm_allocations {};
+		bool warm_seen = false;
+
+		// stand in for the tox thread of each node (tox_client_thread_fn)
+		auto last_time = std::chrono::steady_clock::now();
+		while (!done) {
+			if (!warm_seen && warm) {
+				warm_seen = true;
+				for (size_t i = 0; i < nodes.size(); i++) {
+					warm_allocations[i] = nodes[i].tunnel().pool_allocations();
+				}
+			}
+
+			const auto new_time = std::chrono::steady_clock::now();
+			const float time_delta = std::chrono::duration<float>(new_time - last_time).count();
+			last_time = new_time;
+
+			// the tox sockets are not polled, so never sleep long
+			float sleep_time = 0.001f;
+			std::array<pollfd, 2> wakeup_fds {};
+			for (size_t i = 0; i < nodes.size(); i++) {
+				Node& node = nodes[i];
+				if (opts.memory) {
+					node.transport.pump(ttt::monotonic_us());
+				} else {
+					tox_iterate(node.tc.tox, &node);
+					toxext_iterate(node.tc.tox_ext);
+				}
+				node.tunnel().tick(time_delta);
+
+				if (opts.memory) {
+					if (const uint64_t due = node.transport.next_due_us(); due != 0) {
+						sleep_time = std::min(sleep_time, (int64_t(due) - int64_t(ttt::monotonic_us())) / 1e6f);
+					}
+				} else {
+					sleep_time = std::min(sleep_time, tox_iteration_interval(node.tc.tox) / 1000.f);
+				}
+				sleep_time = std::min(sleep_time, node.tunnel().next_tick_in());
+				wakeup_fds[i] = {node.tunnel().wakeup_fd(), POLLIN, 0};
+			}
+
+			sleep_time = std::max(sleep_time, 0.f);
+			timespec timeout {};
+			timeout.tv_nsec = static_cast<long>(sleep_time * 1'000'000'000.f);
+			if (ppoll(wakeup_fds.data(), wakeup_fds.size(), &timeout, nullptr) < 0 && errno != EINTR) {
+				std::cerr << "!!! ppoll failed " << errno << "\n";
+			}
+		}
+
+		driver_thread.join();
+		receiver_stop = true;
+		receiver_thread.join();
+
+		// the steady state path should only reuse buffers
+		for (size_t i = 0; warm_seen && i < nodes.size(); i++) {
+			const uint64_t allocations = nodes[i].tunnel().pool_allocations();
+			if (allocations != warm_allocations[i]) {
+				std::cerr << "!!! node " << i << " allocated after warmup, pool allocations "
+					<< warm_allocations[i] << " -> " << allocations << "\n";
+				ret = 1;
+			}
+		}
+
+		if (!opts.memory) {
+			for (auto& node : nodes) {
+				node.tunnel().deregister_ext(node.tc.tox_ext);
+			}
+		}
+	}
+
+	zed_net_shutdown();
+
+	return ret;
+}
+
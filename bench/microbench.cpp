@@ -0,0 +1,302 @@
+#include "./microbench.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <thread>
+
+namespace ttt::bench {
+
+void State::start(void) {
+	_real_seconds = 0.;
+	_cpu_seconds = 0.;
+	resume_timing();
+}
+
+void State::stop(void) {
+	pause_timing();
+}
+
+void State::pause_timing(void) {
+	_real_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - _real_start).count();
+	_cpu_seconds += double(std::clock() - _cpu_start) / CLOCKS_PER_SEC;
+}
+
+void State::resume_timing(void) {
+	_cpu_start = std::clock();
+	_real_start = std::chrono::steady_clock::now();
+}
+
+struct Benchmark {
+	std::string name;
+	benchmark_fn_t fn;
+};
+
+// function local, registration runs during static init of other files
+static std::vector<Benchmark>& benchmarks(void) {
+	static std::vector<Benchmark> list {};
+	return list;
+}
+
+int register_benchmark(const char* name, benchmark_fn_t fn) {
+	benchmarks().push_back({name, fn});
+	return 0;
+}
+
+struct Result {
+	std::string name;
+	uint64_t iterations {0};
+	double real_ns {0.}; // per iteration
+	double cpu_ns {0.};
+	double bytes_per_second {0.};
+	double items_per_second {0.};
+};
+
+class Runner {
+	public:
+		double min_time {0.5}; // seconds per benchmark
+
+		Result run(const Benchmark& b) const {
+			uint64_t iterations = 1;
+			while (true) {
+				State state {iterations};
+				b.fn(state);
+
+				const double seconds = state._real_seconds;
+				if (seconds >= min_time || iterations >= iterations_max) {
+					return result(b, state);
+				}
+
+				// like google benchmark, aim a bit over min_time, never more than 10x at once
+				double multiplier = min_time * 1.4 / std::max(seconds, 1e-9);
+				if (seconds / min_time <= 0.1) {
+					multiplier = std::min(multiplier, 10.);
+				}
+				iterations = std::min<uint64_t>(
+					iterations_max,
+					std::max<uint64_t>(iterations + 1, uint64_t(iterations * multiplier))
+				);
+			}
+		}
+
+	private:
+		constexpr static uint64_t iterations_max = 1'000'000'000;
+
+		static Result result(const Benchmark& b, const State& state) {
+			Result r {};
+			r.name = b.name;
+			r.iterations = state._max_iterations;
+			r.real_ns = state._real_seconds * 1e9 / r.iterations;
+			r.cpu_ns = state._cpu_seconds * 1e9 / r.iterations;
+			if (state._real_seconds > 0.) {
+				r.bytes_per_second = double(state._bytes) * r.iterations / state._real_seconds;
+				r.items_per_second = double(state._items) * r.iterations / state._real_seconds;
+			}
+			return r;
+		}
+};
+
+static std::string human_rate(double value) {
+	const char* units[] {"", "k", "M", "G", "T"};
+	size_t unit = 0;
+	while (value >= 1000. && unit + 1 < std::size(units)) {
+		value /= 1000.;
+		unit++;
+	}
+	char buff[32];
+	std::snprintf(buff, sizeof(buff), "%.4g%s/s", value, units[unit]);
+	return buff;
+}
+
+static void print_console_header(std::ostream& out) {
+	char buff[128];
+	std::snprintf(buff, sizeof(buff), "%-40s %15s %15s %12s %s", "Benchmark", "Time", "CPU", "Iterations", "UserCounters...");
+	out << buff << "\n" << std::string(100, '-') << "\n";
+}
+
+static void print_console(std::ostream& out, const Result& r) {
+	char buff[256];
+	std::snprintf(buff, sizeof(buff), "%-40s %12.2f ns %12.2f ns %12llu",
+		r.name.c_str(), r.real_ns, r.cpu_ns, static_cast<unsigned long long>(r.iterations)
+	);
+	out << buff;
+	if (r.bytes_per_second > 0.) {
+		out << " bytes_per_second=" << human_rate(r.bytes_per_second);
+	}
+	if (r.items_per_second > 0.) {
+		out << " items_per_second=" << human_rate(r.items_per_second);
+	}
+	out << "\n" << std::flush;
+}
+
+static std::string json_escape(const std::string& str) {
+	std::string ret;
+	for (const char c : str) {
+		if (c == '"' || c == '\\') {
+			ret += '\\';
+		}
+		ret += c;
+	}
+	return ret;
+}
+
+static void print_json(std::ostream& out, const std::vector<Result>& results, const char* executable) {
+	char date[64];
+	const std::time_t now = std::time(nullptr);
+	std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+
+	out << "{\n";
+	out << "  \"context\": {\n";
+	out << "    \"date\": \"" << date << "\",\n";
+	out << "    \"executable\": \"" << json_escape(executable) << "\",\n";
+	out << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+#ifdef NDEBUG
+	out << "    \"library_build_type\": \"release\"\n";
+#else
+	out << "    \"library_build_type\": \"debug\"\n";
+#endif
+	out << "  },\n";
+	out << "  \"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const auto& r = results[i];
+		char buff[512];
+		std::snprintf(buff, sizeof(buff),
+			"    {\n"
+			"      \"name\": \"%s\",\n"
+			"      \"run_name\": \"%s\",\n"
+			"      \"run_type\": \"iteration\",\n"
+			"      \"repetitions\": 1,\n"
+			"      \"repetition_index\": 0,\n"
+			"      \"threads\": 1,\n"
+			"      \"iterations\": %llu,\n"
+			"      \"real_time\": %.6e,\n"
+			"      \"cpu_time\": %.6e,\n"
+			"      \"time_unit\": \"ns\"",
+			json_escape(r.name).c_str(), json_escape(r.name).c_str(),
+			static_cast<unsigned long long>(r.iterations), r.real_ns, r.cpu_ns
+		);
+		out << buff;
+		if (r.bytes_per_second > 0.) {
+			std::snprintf(buff, sizeof(buff), ",\n      \"bytes_per_second\": %.6e", r.bytes_per_second);
+			out << buff;
+		}
+		if (r.items_per_second > 0.) {
+			std::snprintf(buff, sizeof(buff), ",\n      \"items_per_second\": %.6e", r.items_per_second);
+			out << buff;
+		}
+		out << "\n    }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n";
+	out << "}\n";
+}
+
+// --name=value, false if arg is something else
+static bool parse_flag(const char* arg, const char* name, std::string& value) {
+	const size_t name_len = std::strlen(name);
+	if (std::strncmp(arg, "--", 2) != 0 || std::strncmp(arg + 2, name, name_len) != 0 || arg[2 + name_len] != '=') {
+		return false;
+	}
+	value = arg + 2 + name_len + 1;
+	return true;
+}
+
+int run_benchmarks(int argc, char** argv) {
+	Runner runner {};
+	std::string filter {"."};
+	std::string format {"console"};
+	std::string out_path {};
+	bool list_only = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string value;
+		if (parse_flag(argv[i], "benchmark_filter", value)) {
+			filter = value;
+		} else if (parse_flag(argv[i], "benchmark_min_time", value)) {
+			runner.min_time = std::strtod(value.c_str(), nullptr); // "0.5s" works too
+		} else if (parse_flag(argv[i], "benchmark_format", value)) {
+			format = value;
+		} else if (parse_flag(argv[i], "benchmark_out", value)) {
+			out_path = value;
+		} else if (parse_flag(argv[i], "benchmark_out_format", value)) {
+			if (value != "json") {
+				std::cerr << "!!! only json is supported for --benchmark_out_format\n";
+				return 1;
+			}
+		} else if (std::strcmp(argv[i], "--benchmark_list_tests") == 0 || std::strcmp(argv[i], "--benchmark_list_tests=true") == 0) {
+			list_only = true;
+		} else {
+			std::cerr << "usage: " << argv[0]
+				<< " [--benchmark_filter=<regex>] [--benchmark_min_time=<seconds>]"
+				<< " [--benchmark_format=console|json] [--benchmark_out=<file>] [--benchmark_list_tests]\n";
+			return 1;
+		}
+	}
+
+	if (format != "console" && format != "json") {
+		std::cerr << "!!! unknown --benchmark_format " << format << "\n";
+		return 1;
+	}
+
+	std::regex filter_re;
+	try {
+		filter_re = std::regex(filter);
+	} catch (const std::regex_error&) {
+		std::cerr << "!!! invalid --benchmark_filter " << filter << "\n";
+		return 1;
+	}
+
+	std::vector<Benchmark> selected {};
+	for (const auto& b : benchmarks()) {
+		if (std::regex_search(b.name, filter_re)) {
+			selected.push_back(b);
+		}
+	}
+
+	if (list_only) {
+		for (const auto& b : selected) {
+			std::cout << b.name << "\n";
+		}
+		return 0;
+	}
+
+	const bool console = format == "console";
+	if (console) {
+#ifndef NDEBUG
+		std::cout << "***WARNING*** built as DEBUG, timings will be off\n";
+#endif
+		print_console_header(std::cout);
+	}
+
+	std::vector<Result> results {};
+	for (const auto& b : selected) {
+		results.push_back(runner.run(b));
+		if (console) {
+			print_console(std::cout, results.back());
+		}
+	}
+
+	if (!console) {
+		print_json(std::cout, results, argv[0]);
+	}
+
+	if (!out_path.empty()) {
+		std::ofstream ofile {out_path};
+		if (!ofile.is_open()) {
+			std::cerr << "!!! failed to open " << out_path << "\n";
+			return 1;
+		}
+		print_json(ofile, results, argv[0]);
+	}
+
+	return 0;
+}
+
+} // ttt::bench
+
+int main(int argc, char** argv) {
+	return ttt::bench::run_benchmarks(argc, argv);
+}
+
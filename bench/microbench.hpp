@@ -0,0 +1,102 @@
+#pragma once
+
+// tiny google benchmark look-alike, so there is nothing to fetch.
+//
+//   static void BM_thing(ttt::bench::State& state) {
+//       for (auto _ : state) {
+//           ttt::bench::do_not_optimize(thing());
+//       }
+//   }
+//   BENCHMARK(BM_thing);
+//
+// the json output (--benchmark_out=file --benchmark_format=json) uses the
+// google benchmark schema, so its tools/compare.py works on it
+
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ttt::bench {
+
+// keeps the compiler from throwing away a result
+template<typename T>
+inline void do_not_optimize(T const& value) {
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+inline void clobber_memory(void) {
+	asm volatile("" : : : "memory");
+}
+
+class State {
+	public:
+		explicit State(uint64_t max_iterations) : _max_iterations(max_iterations) {}
+
+		// for `auto _`, the attribute keeps the unused loop variable quiet
+		struct [[maybe_unused]] Value {};
+
+		struct Iterator {
+			State* state;
+			uint64_t remaining;
+
+			bool operator!=(const Iterator&) {
+				if (remaining != 0) {
+					return true;
+				}
+				state->stop();
+				return false;
+			}
+			void operator++(void) { remaining--; }
+			Value operator*(void) const { return {}; }
+		};
+
+		Iterator begin(void) {
+			start();
+			return {this, _max_iterations};
+		}
+		Iterator end(void) { return {this, 0}; }
+
+		// excluded from the timing, eg. for resetting inputs
+		void pause_timing(void);
+		void resume_timing(void);
+
+		// per iteration, turned into a rate
+		void set_bytes_processed(uint64_t bytes) { _bytes = bytes; }
+		void set_items_processed(uint64_t items) { _items = items; }
+
+		uint64_t iterations(void) const { return _max_iterations; }
+
+	private:
+		friend class Runner;
+
+		void start(void);
+		void stop(void);
+
+		uint64_t _max_iterations {0};
+
+		std::chrono::steady_clock::time_point _real_start {};
+		std::clock_t _cpu_start {};
+		double _real_seconds {0.};
+		double _cpu_seconds {0.};
+
+		uint64_t _bytes {0};
+		uint64_t _items {0};
+};
+
+using benchmark_fn_t = void(*)(State&);
+
+// returns something, so it can run at static init
+int register_benchmark(const char* name, benchmark_fn_t fn);
+
+// parses --benchmark_* flags, runs everything and prints, exit code
+int run_benchmarks(int argc, char** argv);
+
+} // ttt::bench
+
+#define TTT_BENCH_CONCAT_(a, b) a##b
+#define TTT_BENCH_CONCAT(a, b) TTT_BENCH_CONCAT_(a, b)
+#define BENCHMARK(fn) \
+	static const int TTT_BENCH_CONCAT(_bench_registered_, __LINE__) = ::ttt::bench::register_benchmark(#fn, fn)
+
@@ -0,0 +1,70 @@
+// AnnounceInfoHashPackage, the payload of every announce between friends
+
+#include "./microbench.hpp"
+
+#include "../src/ext_announce.hpp"
+
+#include <random>
+
+namespace {
+
+using ttt::bench::State;
+using ttt::bench::do_not_optimize;
+using ttt::ext::AnnounceInfoHashPackage;
+
+// mixes v1 and v2, like a db with hybrid torrents would
+static AnnounceInfoHashPackage make_aihp(size_t count) {
+	std::minstd_rand rng {1337};
+	AnnounceInfoHashPackage aihp {};
+	for (size_t i = 0; i < count; i++) {
+		if (i % 2 == 0) {
+			InfoHashV1 h {};
+			for (auto& b : h.data) {
+				b = rng() & 0xff;
+			}
+			aihp.info_hashes.push_back(h);
+		} else {
+			InfoHashV2 h {};
+			for (auto& b : h.data) {
+				b = rng() & 0xff;
+			}
+			aihp.info_hashes.push_back(h);
+		}
+	}
+	return aihp;
+}
+
+static void bm_aihp_to(State& state, size_t count) {
+	const auto aihp = make_aihp(count);
+	std::vector<uint8_t> buff {};
+
+	for (auto _ : state) {
+		buff.clear(); // keeps the capacity, like a reused send buffer would
+		aihp.to(buff);
+		do_not_optimize(buff.data());
+	}
+	state.set_bytes_processed(buff.size());
+}
+static void BM_aihp_to_1(State& state) { bm_aihp_to(state, 1); }
+static void BM_aihp_to_4(State& state) { bm_aihp_to(state, AnnounceInfoHashPackage::info_hashes_max_size); }
+BENCHMARK(BM_aihp_to_1);
+BENCHMARK(BM_aihp_to_4);
+
+static void bm_aihp_from(State& state, size_t count) {
+	std::vector<uint8_t> buff {};
+	make_aihp(count).to(buff);
+
+	for (auto _ : state) {
+		AnnounceInfoHashPackage aihp {};
+		aihp.from(buff.data(), buff.size());
+		do_not_optimize(aihp);
+	}
+	state.set_bytes_processed(buff.size());
+}
+static void BM_aihp_from_1(State& state) { bm_aihp_from(state, 1); }
+static void BM_aihp_from_4(State& state) { bm_aihp_from(state, AnnounceInfoHashPackage::info_hashes_max_size); }
+BENCHMARK(BM_aihp_from_1);
+BENCHMARK(BM_aihp_from_4);
+
+} // namespace
+
@@ -0,0 +1,135 @@
+// Hash hex parsing/printing and std::hash<Torrent>
+
+#include "./microbench.hpp"
+
+#include "../src/torrent.hpp"
+
+#include <random>
+#include <unordered_map>
+
+namespace {
+
+using ttt::bench::State;
+using ttt::bench::do_not_optimize;
+
+// enough distinct inputs to not measure a single cached one
+constexpr static size_t input_count = 1024;
+
+template<size_t bytes>
+static std::vector<Hash<bytes>> random_hashes(void) {
+	std::minstd_rand rng {1337};
+	std::vector<Hash<bytes>> ret(input_count);
+	for (auto& h : ret) {
+		for (auto& b : h.data) {
+			b = rng() & 0xff;
+		}
+	}
+	return ret;
+}
+
+template<size_t bytes>
+static void BM_hash_from_hex(State& state) {
+	std::vector<std::string> inputs {};
+	for (const auto& h : random_hashes<bytes>()) {
+		inputs.push_back(std::to_string(h));
+	}
+
+	size_t i = 0;
+	for (auto _ : state) {
+		Hash<bytes> h {inputs[i++ % input_count]};
+		do_not_optimize(h);
+	}
+	state.set_bytes_processed(bytes*2);
+}
+static void BM_hash_v1_from_hex(State& state) { BM_hash_from_hex<20>(state); }
+static void BM_hash_v2_from_hex(State& state) { BM_hash_from_hex<32>(state); }
+BENCHMARK(BM_hash_v1_from_hex);
+BENCHMARK(BM_hash_v2_from_hex);
+
+// magnet links and some clients use upper case
+static void BM_hash_v1_from_hex_upper(State& state) {
+	std::vector<std::string> inputs {};
+	for (const auto& h : random_hashes<20>()) {
+		auto str = std::to_string(h);
+		for (auto& c : str) {
+			c = std::toupper(static_cast<unsigned char>(c));
+		}
+		inputs.push_back(str);
+	}
+
+	size_t i = 0;
+	for (auto _ : state) {
+		InfoHashV1 h {inputs[i++ % input_count]};
+		do_not_optimize(h);
+	}
+	state.set_bytes_processed(40);
+}
+BENCHMARK(BM_hash_v1_from_hex_upper);
+
+template<size_t bytes>
+static void BM_hash_to_string(State& state) {
+	const auto inputs = random_hashes<bytes>();
+
+	size_t i = 0;
+	for (auto _ : state) {
+		auto str = std::to_string(inputs[i++ % input_count]);
+		do_not_optimize(str);
+	}
+	state.set_bytes_processed(bytes);
+}
+static void BM_hash_v1_to_string(State& state) { BM_hash_to_string<20>(state); }
+static void BM_hash_v2_to_string(State& state) { BM_hash_to_string<32>(state); }
+BENCHMARK(BM_hash_v1_to_string);
+BENCHMARK(BM_hash_v2_to_string);
+
+static std::vector<Torrent> random_torrents(bool v1, bool v2) {
+	const auto v1s = random_hashes<20>();
+	const auto v2s = random_hashes<32>();
+
+	std::vector<Torrent> ret(input_count);
+	for (size_t i = 0; i < input_count; i++) {
+		if (v1) {
+			ret[i].info_hash_v1 = v1s[i];
+		}
+		if (v2) {
+			ret[i].info_hash_v2 = v2s[i];
+		}
+	}
+	return ret;
+}
+
+static void bm_torrent_hash(State& state, bool v1, bool v2) {
+	const auto inputs = random_torrents(v1, v2);
+	const std::hash<Torrent> hasher {};
+
+	size_t i = 0;
+	for (auto _ : state) {
+		do_not_optimize(hasher(inputs[i++ % input_count]));
+	}
+	state.set_items_processed(1);
+}
+static void BM_torrent_hash_v1(State& state) { bm_torrent_hash(state, true, false); }
+static void BM_torrent_hash_v2(State& state) { bm_torrent_hash(state, false, true); }
+static void BM_torrent_hash_hybrid(State& state) { bm_torrent_hash(state, true, true); }
+BENCHMARK(BM_torrent_hash_v1);
+BENCHMARK(BM_torrent_hash_v2);
+BENCHMARK(BM_torrent_hash_hybrid);
+
+// what TorrentDB does on every announce
+static void BM_torrent_db_lookup(State& state) {
+	const auto inputs = random_torrents(true, false);
+	std::unordered_map<Torrent, int> map {};
+	for (const auto& t : inputs) {
+		map[t] = 1;
+	}
+
+	size_t i = 0;
+	for (auto _ : state) {
+		do_not_optimize(map.find(inputs[i++ % input_count]));
+	}
+	state.set_items_processed(1);
+}
+BENCHMARK(BM_torrent_db_lookup);
+
+} // namespace
+
@@ -0,0 +1,116 @@
+// string helpers behind every http announce
+
+#include "./microbench.hpp"
+
+#include "../src/tracker_util.hpp"
+
+namespace {
+
+using ttt::bench::State;
+using ttt::bench::do_not_optimize;
+
+// what qbittorrent sends, the info_hash is percent encoded binary
+constexpr static std::string_view announce_query {
+	"info_hash=%8a%19%a7%e3%b5M%bf%14%86%a7%9b%f5%f0%19%c2%9d%b4%e1%bb%d1"
+	"&peer_id=-qB4520-Ab1cD2eF3gH4"
+	"&port=6881&uploaded=0&downloaded=0&left=1073741824&corrupt=0"
+	"&key=1A2B3C4D&event=started&numwant=200&compact=1&no_peer_id=1"
+	"&supportcrypto=1&redundant=0"
+};
+constexpr static std::string_view info_hash_encoded {
+	"%8a%19%a7%e3%b5M%bf%14%86%a7%9b%f5%f0%19%c2%9d%b4%e1%bb%d1"
+};
+
+static void BM_tracker_split_query(State& state) {
+	for (auto _ : state) {
+		auto parts = ttt::split(announce_query, "&");
+		do_not_optimize(parts.data());
+	}
+	state.set_bytes_processed(announce_query.size());
+}
+BENCHMARK(BM_tracker_split_query);
+
+// the whole query taken apart with allocations, what the tracker did before parse_announce_query
+static void BM_tracker_split_query_kv(State& state) {
+	for (auto _ : state) {
+		for (const auto& e_v : ttt::split(announce_query, "&")) {
+			auto kv = ttt::split(e_v, "=");
+			do_not_optimize(kv.data());
+		}
+	}
+	state.set_bytes_processed(announce_query.size());
+}
+BENCHMARK(BM_tracker_split_query_kv);
+
+// what http_handle_announce does with the query
+static void BM_tracker_parse_announce_query(State& state) {
+	for (auto _ : state) {
+		ttt::AnnounceQuery query {};
+		const bool ok = ttt::parse_announce_query(announce_query, query);
+		do_not_optimize(ok);
+		do_not_optimize(query);
+	}
+	state.set_bytes_processed(announce_query.size());
+}
+BENCHMARK(BM_tracker_parse_announce_query);
+
+// the same announce as a BEP 15 packet
+static void BM_tracker_parse_udp_announce(State& state) {
+	std::string packet(ttt::udp_tracker_announce_size, '\0');
+	packet[11] = 1; // action announce
+	packet[95] = 50; // numwant
+	for (auto _ : state) {
+		ttt::UDPTrackerRequest request {};
+		ttt::AnnounceQuery query {};
+		const bool ok = ttt::parse_udp_tracker_request(packet, request) && ttt::parse_udp_tracker_announce(packet, query);
+		do_not_optimize(ok);
+		do_not_optimize(query);
+	}
+	state.set_bytes_processed(packet.size());
+}
+BENCHMARK(BM_tracker_parse_udp_announce);
+
+static void BM_tracker_url_decode_info_hash(State& state) {
+	for (auto _ : state) {
+		auto bin = ttt::url_decode(info_hash_encoded);
+		do_not_optimize(bin.data());
+	}
+	state.set_bytes_processed(info_hash_encoded.size());
+}
+BENCHMARK(BM_tracker_url_decode_info_hash);
+
+static void BM_tracker_to_bencode_string(State& state) {
+	const std::string value {"127.0.0.1"};
+	for (auto _ : state) {
+		auto str = ttt::to_bencode(value);
+		do_not_optimize(str);
+	}
+}
+BENCHMARK(BM_tracker_to_bencode_string);
+
+static void BM_tracker_to_bencode_int(State& state) {
+	const int64_t value {51413};
+	for (auto _ : state) {
+		auto str = ttt::to_bencode(value);
+		do_not_optimize(str);
+	}
+}
+BENCHMARK(BM_tracker_to_bencode_int);
+
+// one entry of the non compact peer list
+static void BM_tracker_bencode_peer(State& state) {
+	const std::string ip {"127.0.0.1"};
+	const int64_t port {51413};
+	for (auto _ : state) {
+		auto str = "d" +
+			ttt::to_bencode("ip") + ttt::to_bencode(ip) +
+			ttt::to_bencode("port") + ttt::to_bencode(port) +
+		"e";
+		do_not_optimize(str);
+	}
+	state.set_items_processed(1);
+}
+BENCHMARK(BM_tracker_bencode_peer);
+
+} // namespace
+
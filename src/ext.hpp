@@ -19,7 +19,14 @@ class ToxClientExtension {
 		virtual void deregister_ext(ToxExt* toxext) = 0;
 		void negotiate_connection(uint32_t friend_number);
 
-		virtual void tick(void) {};
+		// time_delta in seconds since the last tick
+		virtual void tick(float) {};
+
+		// seconds until this extension needs the next tick, the tox thread sleeps at most that long
+		virtual float next_tick_in(void) { return 1.f; }
+
+		// readable fd that should wake the tox thread early (eg. sockets), -1 for none
+		virtual int wakeup_fd(void) { return -1; }
 };
 
 } // ttt::ext
@@ -1,6 +1,7 @@
 #include "./ext_announce.hpp"
 
 #include "./tox_client_private.hpp"
+#include "./tox_transport.hpp"
 
 #include <variant>
 #include <vector>
@@ -111,46 +112,49 @@ void ToxExtAnnounce::register_ext(ToxExt* toxext) {
 	);
 	assert(_tee);
 
+	_tox_transport = std::make_unique<ToxTransport>(ud.tc->tox, toxext, _tee);
+	_transport = _tox_transport.get();
+
 	std::cout << "III register_ext announce\n";
 }
 
+void ToxExtAnnounce::register_transport(ToxClient* tc, Transport* transport) {
+	ud.tc = tc;
+	ud.tea = this;
+	_transport = transport;
+}
+
 void ToxExtAnnounce::deregister_ext(ToxExt* toxext) {
 	toxext_deregister(_tee);
 }
 
-bool ToxExtAnnounce::announce_send(ToxExt* tox_ext, uint32_t friend_number, const AnnounceInfoHashPackage& aihp) {
+bool ToxExtAnnounce::announce_send(uint32_t friend_number, const AnnounceInfoHashPackage& aihp) {
 	std::vector<uint8_t> buff{};
 	if (!aihp.to(buff)) {
 		std::cerr << "!!! error creating buffer from aihp\n";
 		return false;
 	}
 
-	auto* pkg_list = toxext_packet_list_create(tox_ext, friend_number);
-	assert(pkg_list);
-
-	toxext_segment_append(pkg_list, _tee, buff.data(), buff.size());
-
-	auto r = toxext_send(pkg_list);
-	return r == TOXEXT_SUCCESS;
+	return _transport->send_segment(friend_number, buff.data(), buff.size());
 }
 
-void ToxExtAnnounce::tick(void) {
+void ToxExtAnnounce::tick(float time_delta) {
 	for (const auto& [friend_id, compatible] : friend_compatible) {
 		if (!compatible) {
 			continue;
 		}
 
-		if (tox_friend_get_connection_status(_tox_client->tox, friend_id, nullptr) == TOX_CONNECTION_NONE) {
+		if (!_transport->friend_connected(friend_id)) {
 			continue; // TODO: better handle offline friends
 		}
 
 		auto& friend_timer = friend_announce_timer[friend_id];
-		friend_timer.timer += 0.001f;
+		friend_timer.timer += time_delta;
 		if (friend_timer.timer >= announce_interval) {
 			friend_timer.timer = 0.f;
 
-			const std::lock_guard dblock(_tox_client->torrent_db_mutex);
-			if (_tox_client->torrent_db.torrents.empty()) {
+			const std::lock_guard dblock(ud.tc->torrent_db_mutex);
+			if (ud.tc->torrent_db.torrents.empty()) {
 				continue; // nothing to announce
 			}
 
@@ -162,7 +166,7 @@ void ToxExtAnnounce::tick(void) {
 			size_t self_count = 0;
 
 			// update client specific torrent timers
-			for (const auto& [_torrent, t_i] : _tox_client->torrent_db.torrents) {
+			for (const auto& [_torrent, t_i] : ud.tc->torrent_db.torrents) {
 				if (t_i.self) { // no relay, so no gossip
 					self_count++;
 					const auto& torrent = _torrent; // why the f*** do i need this?????
@@ -207,30 +211,35 @@ void ToxExtAnnounce::tick(void) {
 				time = 0.f;
 			}
 
-			if (!_tox_client->announce_send(friend_id, aihp)) {
+			if (!announce_send(friend_id, aihp)) {
 				std::cerr << "!!! failed to announce " << friend_id << "\n";
 			}
 		}
 	}
 }
 
-static void announce_recv_callback(
-	ToxExtExtension*,
-	uint32_t friend_id, const void* data,
-	size_t size, void* userdata,
-	struct ToxExtPacketList* response_packet_list
-) {
-	std::cout << "III announce_recv_callback\n";
-	auto* ud = static_cast<ToxExtAnnounce::UserData*>(userdata);
+float ToxExtAnnounce::next_tick_in(void) {
+	float next = announce_interval;
+	for (const auto& [friend_id, compatible] : friend_compatible) {
+		if (!compatible || !friend_announce_timer.count(friend_id)) {
+			continue;
+		}
+
+		next = std::min(next, announce_interval - friend_announce_timer.at(friend_id).timer);
+	}
+
+	return std::max(next, 0.f);
+}
 
+void ToxExtAnnounce::friend_announce_cb(uint32_t friend_number, const uint8_t* data, size_t size) {
 	AnnounceInfoHashPackage aihp{};
-	if (!aihp.from(static_cast<const uint8_t*>(data), size)) {
+	if (!aihp.from(data, size)) {
 		std::cerr << "!!! error, parsed guarbage----\n";
 		return;
 	}
 
-	const std::lock_guard lock(ud->tc->torrent_db_mutex);
-	auto& torrent_db = ud->tc->torrent_db;
+	const std::lock_guard lock(ud.tc->torrent_db_mutex);
+	auto& torrent_db = ud.tc->torrent_db;
 	for (const auto& info_hash_var : aihp.info_hashes) {
 		Torrent t;
 		if (info_hash_var.index() == 0) {
@@ -239,13 +248,23 @@ static void announce_recv_callback(
 			t.info_hash_v2 = std::get<1>(info_hash_var);
 		}
 
-		std::cout << "got " << t << " from " << friend_id << "\n";
+		std::cout << "got " << t << " from " << friend_number << "\n";
 
-		auto& tdb_ref = torrent_db.torrents[t]; // wtf why does self get set to true????
-		tdb_ref.torrent_tox_info.friends.emplace(friend_id);
+		torrent_db.add_torrent_friend(t, friend_number);
 	}
 }
 
+static void announce_recv_callback(
+	ToxExtExtension*,
+	uint32_t friend_id, const void* data,
+	size_t size, void* userdata,
+	struct ToxExtPacketList* response_packet_list
+) {
+	std::cout << "III announce_recv_callback\n";
+	auto* ud = static_cast<ToxExtAnnounce::UserData*>(userdata);
+	ud->tea->friend_announce_cb(friend_id, static_cast<const uint8_t*>(data), size);
+}
+
 static void announce_negotiate_connection_callback(
 	ToxExtExtension*,
 	uint32_t friend_id, bool compatible,
@@ -2,10 +2,12 @@
 
 #include "./torrent.hpp"
 #include "./ext.hpp"
+#include "./transport.hpp"
 
 #include <vector>
 #include <variant>
 #include <map>
+#include <memory>
 
 namespace ttt {
 	struct ToxClient;
@@ -28,8 +30,14 @@ class ToxExtAnnounce : public ToxClientExtension {
 
 		void register_ext(ToxExt* toxext) override;
 		void deregister_ext(ToxExt* toxext) override;
+		// instead of register_ext, runs on transport instead of tox (eg. MemoryTransport).
+		// nothing gets negotiated, set friend_compatible. transport has to outlive this
+		void register_transport(ToxClient* tc, Transport* transport);
 
-		bool announce_send(ToxExt* tox_ext, uint32_t friend_number, const AnnounceInfoHashPackage& aihp);
+		bool announce_send(uint32_t friend_number, const AnnounceInfoHashPackage& aihp);
+
+		// a received segment, adds the torrents to the db
+		void friend_announce_cb(uint32_t friend_number, const uint8_t* data, size_t size);
 
 	public: // tox_client "interface"
 		// ext support
@@ -43,13 +51,19 @@ class ToxExtAnnounce : public ToxClientExtension {
 		};
 		std::map<uint32_t, FriendTimers> friend_announce_timer {};
 
-		void tick(void) override;
+		void tick(float time_delta) override;
+		float next_tick_in(void) override;
 
 	public: // internal for callbacks
 		struct UserData {
 			ttt::ToxClient* tc;
 			ToxExtAnnounce* tea;
 		} ud{};
+
+	private:
+		// tox, or whatever was passed to register_transport
+		Transport* _transport {nullptr};
+		std::unique_ptr<Transport> _tox_transport {};
 };
 
 } // ttt::ext
@@ -0,0 +1,710 @@
+#include "./ext_tunnel_tcp.hpp"
+
+#include "./tox_client_private.hpp"
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace ttt::ext {
+
+// fist 12 bytes are the same for all ttt
+// last byte denotes version for the extention
+constexpr static uint8_t tunnel_tcp_uuid[16] {
+	0x11, 0x13, 0xf4, 0xf7,
+	0x93, 0x19, 0x66, 0x5a,
+	0x22, 0xc2, 0xb5, 0xee,
+
+	0x11, 0x13, 0x33, 0x01,
+};
+
+static void tunnel_tcp_recv_callback(
+	ToxExtExtension* extension,
+	uint32_t friend_id,
+	void const* data, size_t size,
+	void* userdata,
+	ToxExtPacketList* response_packet_list
+);
+
+static void tunnel_tcp_negotiate_connection_callback(
+	ToxExtExtension* extension,
+	uint32_t friend_id, bool compatible,
+	void* userdata,
+	ToxExtPacketList* response_packet_list
+);
+
+// how often listeners get matched against the udp tunnels
+constexpr static float listener_interval = 1.f;
+
+// streams we did not open, from our view
+constexpr static uint16_t stream_id_remote_bit = 0x8000;
+
+// a WINDOW goes out once this much got written to the socket
+constexpr static uint32_t window_update_threshold = ToxExtTunnelTCP::stream_window / 4;
+
+// data payload per segment
+constexpr static size_t data_size_max = TOXEXT_MAX_SEGMENT_SIZE - ToxExtTunnelTCP::segment_header_size;
+
+#ifdef __linux__
+static uint64_t event_data(uint32_t friend_number, uint16_t stream_id) {
+	return (uint64_t(friend_number) << 32) | stream_id;
+}
+#endif
+
+ToxExtTunnelTCP::~ToxExtTunnelTCP(void) {
+	_friends.clear(); // closes the sockets
+
+#ifdef __linux__
+	if (_epoll_fd >= 0) {
+		close(_epoll_fd);
+		_epoll_fd = -1;
+	}
+#endif
+}
+
+void ToxExtTunnelTCP::register_ext(ToxExt* toxext) {
+	ud.tc = _tox_client.get();
+	ud.tett = this;
+
+	_tee = toxext_register(
+		toxext, tunnel_tcp_uuid, &ud,
+		tunnel_tcp_recv_callback,
+		tunnel_tcp_negotiate_connection_callback
+	);
+	assert(_tee);
+	std::cout << "III register_ext tunnel_tcp\n";
+
+	// default
+	// TODO: load from config
+	zed_net_get_address(&outbound_address, "localhost", 51413);
+
+#ifdef __linux__
+	_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (_epoll_fd < 0) {
+		std::cerr << "!!! epoll_create1 failed " << errno << "\n";
+	}
+#endif
+}
+
+void ToxExtTunnelTCP::deregister_ext(ToxExt*) {
+	toxext_deregister(_tee);
+}
+
+void ToxExtTunnelTCP::tick(float time_delta) {
+	_listener_timer += time_delta;
+	if (_listener_timer >= listener_interval) {
+		_listener_timer = 0.f;
+		open_listeners();
+	}
+
+	// whatever tox did not take last time goes first
+	for (auto& [f_id, f] : _friends) {
+		if (!f.queue.empty() && flush_queue(f_id, f)) {
+			for (auto& [s_id, stream] : f.streams) {
+				update_interest(f_id, f, s_id, stream);
+			}
+		}
+	}
+
+#ifdef __linux__
+	epoll_event events[64];
+	const int event_count = epoll_wait(_epoll_fd, events, 64, 0);
+	for (int i = 0; i < event_count; i++) {
+		const uint32_t f_id = events[i].data.u64 >> 32;
+		const uint16_t s_id = events[i].data.u64 & 0xffff;
+
+		auto f_it = _friends.find(f_id);
+		if (f_it == _friends.end()) {
+			continue;
+		}
+		auto& f = f_it->second;
+
+		if (s_id == 0) {
+			handle_accept(f_id, f);
+			continue;
+		}
+
+		// might be gone already, by an earlier event of this batch
+		auto s_it = f.streams.find(s_id);
+		if (s_it == f.streams.end()) {
+			continue;
+		}
+		auto& stream = s_it->second;
+
+		if (events[i].events & EPOLLERR) {
+			// a refused connect to the torrent client, connect_finish() logs and counts it
+			if (stream.connecting) {
+				handle_writable(f_id, f, s_id, stream);
+			}
+			if (f.streams.count(s_id)) {
+				stream_reset(f_id, f, s_id, true);
+			}
+			continue;
+		}
+
+		if ((events[i].events & EPOLLHUP) && !(stream.events & EPOLLIN)) {
+			// would fire until we read again, wait for credit instead
+			epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, stream.s.handle(), nullptr);
+			stream.parked = true;
+			stream.events = 0;
+		}
+
+		if (events[i].events & EPOLLOUT) {
+			handle_writable(f_id, f, s_id, stream);
+			if (!f.streams.count(s_id)) {
+				continue;
+			}
+		}
+
+		if (events[i].events & (EPOLLIN | EPOLLHUP)) {
+			handle_readable(f_id, f, s_id, stream);
+		}
+	}
+#else
+	// no readiness, just try everything
+	for (auto& [f_id, f] : _friends) {
+		handle_accept(f_id, f);
+
+		std::vector<uint16_t> stream_ids {};
+		for (const auto& [s_id, stream] : f.streams) {
+			stream_ids.push_back(s_id);
+		}
+
+		for (const uint16_t s_id : stream_ids) {
+			if (auto s_it = f.streams.find(s_id); s_it != f.streams.end() && stream_wants_write(s_it->second)) {
+				handle_writable(f_id, f, s_id, s_it->second);
+			}
+			if (auto s_it = f.streams.find(s_id); s_it != f.streams.end() && stream_wants_read(f, s_it->second)) {
+				handle_readable(f_id, f, s_id, s_it->second);
+			}
+		}
+	}
+#endif
+}
+
+float ToxExtTunnelTCP::next_tick_in(void) {
+	for (const auto& [f_id, f] : _friends) {
+		if (!f.queue.empty()) {
+			return 0.01f; // retry tox soon
+		}
+	}
+
+#ifdef __linux__
+	return std::max(listener_interval - _listener_timer, 0.f);
+#else
+	return 0.001f;
+#endif
+}
+
+int ToxExtTunnelTCP::wakeup_fd(void) {
+#ifdef __linux__
+	return _epoll_fd;
+#else
+	return -1;
+#endif
+}
+
+size_t ToxExtTunnelTCP::stream_count(void) const {
+	size_t count = 0;
+	for (const auto& [f_id, f] : _friends) {
+		count += f.streams.size();
+	}
+	return count;
+}
+
+void ToxExtTunnelTCP::open_listeners(void) {
+	{ // friends that went away
+		std::vector<uint32_t> to_destroy {};
+		for (const auto& [f_id, comp] : friend_compatible) {
+			if (!comp || tox_friend_get_connection_status(ud.tc->tox, f_id, nullptr) == TOX_CONNECTION_NONE) {
+				to_destroy.push_back(f_id);
+			}
+		}
+
+		for (const auto f_id : to_destroy) {
+			close_friend(f_id);
+			friend_compatible.erase(f_id);
+		}
+	}
+
+	for (const auto& [f_id, comp] : friend_compatible) {
+		// the udp tunnel decides port and host, so both can be advertised as one peer
+		uint16_t udp_port = 0;
+		std::string host_str {};
+		{
+			const std::lock_guard mutex_lock{ud.tc->torrent_db_mutex};
+			if (auto it = ud.tc->torrent_db.peers.find(f_id); it != ud.tc->torrent_db.peers.end()) {
+				udp_port = it->second;
+			}
+			if (auto it = ud.tc->torrent_db.peer_hosts.find(f_id); it != ud.tc->torrent_db.peer_hosts.end()) {
+				host_str = it->second;
+			}
+		}
+
+		uint32_t host = 0;
+		if (!host_str.empty()) {
+			zed_net_address_t addr {};
+			if (zed_net_get_address(&addr, host_str.c_str(), 0) == 0) {
+				host = addr.host;
+			}
+		}
+
+		auto& f = _friends[f_id];
+		if (f.udp_port == udp_port && f.host == host) {
+			continue; // nothing changed (or it failed before, and would again)
+		}
+
+		if (f.listener.is_open()) {
+#ifdef __linux__
+			epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, f.listener.handle(), nullptr);
+#endif
+			f.listener.close();
+			std::cout << "III closed tcp listener " << f_id << " " << f.port << "\n";
+
+			const std::lock_guard mutex_lock{ud.tc->torrent_db_mutex};
+			ud.tc->torrent_db.tcp_peers.erase(f_id);
+			ud.tc->torrent_db.friend_peers_changed(f_id);
+		}
+
+		f.udp_port = udp_port;
+		f.host = host;
+		f.port = 0;
+
+		if (udp_port == 0) {
+			continue; // no udp tunnel (yet), streams from the friend still work
+		}
+
+		// same port as utp if possible, any otherwise (gets advertised separately)
+		if (!f.listener.listen(host, udp_port) && !f.listener.listen(host, 0)) {
+			std::cerr << "!!! failed to open tcp listener " << f_id << "\n";
+			continue;
+		}
+		f.port = f.listener.local_port();
+
+#ifdef __linux__
+		epoll_event ev {};
+		ev.events = EPOLLIN;
+		ev.data.u64 = event_data(f_id, 0);
+		if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, f.listener.handle(), &ev) != 0) {
+			std::cerr << "!!! failed to add tcp listener to epoll " << errno << "\n";
+		}
+#endif
+
+		std::cout << "III opened tcp listener " << f_id << " " << (host_str.empty() ? "*" : host_str) << ":" << f.port << "\n";
+
+		const std::lock_guard mutex_lock{ud.tc->torrent_db_mutex};
+		ud.tc->torrent_db.tcp_peers[f_id] = f.port;
+		ud.tc->torrent_db.friend_peers_changed(f_id);
+	}
+}
+
+void ToxExtTunnelTCP::close_friend(uint32_t friend_number) {
+	auto f_it = _friends.find(friend_number);
+	if (f_it == _friends.end()) {
+		return;
+	}
+
+	if (f_it->second.listener.is_open()) {
+		const std::lock_guard mutex_lock{ud.tc->torrent_db_mutex};
+		ud.tc->torrent_db.tcp_peers.erase(friend_number);
+		ud.tc->torrent_db.friend_peers_changed(friend_number);
+	}
+
+	std::cout << "III closing tcp tunnel " << friend_number << " with " << f_it->second.streams.size() << " streams\n";
+
+	// closing removes them from epoll
+	_friends.erase(f_it);
+}
+
+void ToxExtTunnelTCP::send_segment(uint32_t friend_number, Friend& f, const uint8_t* data, size_t size) {
+	if (f.queue.empty() && try_send(friend_number, data, size)) {
+		return;
+	}
+
+	stats.sendq_full++;
+	f.queue.emplace_back(data, data + size);
+}
+
+void ToxExtTunnelTCP::send_control(uint32_t friend_number, Friend& f, SegmentType type, uint16_t stream_id, uint32_t value) {
+	const uint16_t wire_id = stream_id ^ stream_id_remote_bit;
+	uint8_t buff[segment_header_size + 4] {
+		uint8_t(type),
+		uint8_t(wire_id & 0xff),
+		uint8_t((wire_id >> 8) & 0xff),
+		uint8_t(value & 0xff),
+		uint8_t((value >> 8) & 0xff),
+		uint8_t((value >> 16) & 0xff),
+		uint8_t((value >> 24) & 0xff),
+	};
+
+	send_segment(friend_number, f, buff, type == SegmentType::WINDOW ? sizeof(buff) : segment_header_size);
+}
+
+bool ToxExtTunnelTCP::try_send(uint32_t friend_number, const uint8_t* data, size_t size) {
+	// one segment per list, so a failed send did not send anything
+	// TODO: getting tox_ext that way is bad
+	auto* pkg_list = toxext_packet_list_create(ud.tc->tox_ext, friend_number);
+	if (pkg_list == nullptr) {
+		return false; // gets queued
+	}
+	toxext_segment_append(pkg_list, _tee, data, size);
+
+	return toxext_send(pkg_list) == TOXEXT_SUCCESS;
+}
+
+bool ToxExtTunnelTCP::flush_queue(uint32_t friend_number, Friend& f) {
+	while (!f.queue.empty()) {
+		const auto& segment = f.queue.front();
+		if (!try_send(friend_number, segment.data(), segment.size())) {
+			return false;
+		}
+		f.queue.pop_front();
+	}
+
+	return true;
+}
+
+void ToxExtTunnelTCP::handle_accept(uint32_t friend_number, Friend& f) {
+	TCPSocket new_socket;
+	while (f.listener.accept(new_socket)) {
+		if (f.streams.size() >= streams_per_friend_max) {
+			stats.streams_refused++;
+			std::cerr << "WWW too many tcp streams for " << friend_number << ", refusing\n";
+			new_socket.close();
+			continue;
+		}
+
+		// find a free id, streams we open never have the remote bit
+		uint16_t s_id = f.next_stream_id;
+		while (f.streams.count(s_id)) {
+			s_id = (s_id % (stream_id_remote_bit - 1)) + 1;
+		}
+		f.next_stream_id = (s_id % (stream_id_remote_bit - 1)) + 1;
+
+		auto& stream = f.streams[s_id];
+		stream.s = std::move(new_socket);
+		stats.streams_opened++;
+
+		send_control(friend_number, f, SegmentType::OPEN, s_id);
+
+		std::cout << "III new tcp stream " << friend_number << ":" << s_id << "\n";
+		update_interest(friend_number, f, s_id, stream);
+	}
+}
+
+void ToxExtTunnelTCP::handle_readable(uint32_t friend_number, Friend& f, uint16_t stream_id, Stream& stream) {
+	const uint16_t wire_id = stream_id ^ stream_id_remote_bit;
+
+	uint8_t buff[TOXEXT_MAX_SEGMENT_SIZE];
+	for (size_t i = 0; i < stream_burst_max && stream_wants_read(f, stream); i++) {
+		const size_t read_size_max = std::min<size_t>(data_size_max, stream.send_credit);
+		const int ret = stream.s.read(buff + segment_header_size, read_size_max);
+
+		if (ret == TCPSocket::would_block) {
+			break;
+		} else if (ret == TCPSocket::closed) {
+			stream.read_closed = true;
+			send_control(friend_number, f, SegmentType::CLOSE, stream_id);
+			update_interest(friend_number, f, stream_id, stream);
+			stream_maybe_done(f, stream_id);
+			return;
+		} else if (ret < 0) {
+			stream_reset(friend_number, f, stream_id, true);
+			return;
+		}
+
+		buff[0] = uint8_t(SegmentType::DATA);
+		buff[1] = wire_id & 0xff;
+		buff[2] = (wire_id >> 8) & 0xff;
+		send_segment(friend_number, f, buff, segment_header_size + ret);
+
+		stream.send_credit -= ret;
+		stats.bytes_to_friends += ret;
+	}
+
+	update_interest(friend_number, f, stream_id, stream);
+}
+
+void ToxExtTunnelTCP::handle_writable(uint32_t friend_number, Friend& f, uint16_t stream_id, Stream& stream) {
+	if (stream.connecting) {
+		if (!stream.s.connect_finish()) {
+			std::cerr << "!!! tcp stream " << friend_number << ":" << stream_id << " failed to connect to the torrent client\n";
+			stats.streams_refused++;
+			stream_reset(friend_number, f, stream_id, true);
+			return;
+		}
+
+		stream.connecting = false;
+	}
+
+	while (stream.to_socket_offset < stream.to_socket.size()) {
+		const int ret = stream.s.write(
+			stream.to_socket.data() + stream.to_socket_offset,
+			stream.to_socket.size() - stream.to_socket_offset
+		);
+
+		if (ret == TCPSocket::would_block) {
+			break;
+		} else if (ret < 0) {
+			stream_reset(friend_number, f, stream_id, true);
+			return;
+		}
+
+		stream.to_socket_offset += ret;
+		stream.recv_consumed += ret;
+	}
+
+	if (stream.to_socket_offset == stream.to_socket.size()) {
+		stream.to_socket.clear();
+		stream.to_socket_offset = 0;
+	} else if (stream.to_socket_offset >= stream.to_socket.size() / 2) {
+		// dont let the written part pile up
+		stream.to_socket.erase(stream.to_socket.begin(), stream.to_socket.begin() + stream.to_socket_offset);
+		stream.to_socket_offset = 0;
+	}
+
+	// the friend may send more
+	if (stream.recv_consumed >= window_update_threshold) {
+		send_control(friend_number, f, SegmentType::WINDOW, stream_id, stream.recv_consumed);
+		stream.recv_consumed = 0;
+	}
+
+	if (stream.friend_closed && !stream.write_closed && stream.to_socket.empty()) {
+		stream.s.shutdown_write();
+		stream.write_closed = true;
+	}
+
+	update_interest(friend_number, f, stream_id, stream);
+	stream_maybe_done(f, stream_id);
+}
+
+void ToxExtTunnelTCP::stream_maybe_done(Friend& f, uint16_t stream_id) {
+	auto s_it = f.streams.find(stream_id);
+	if (s_it == f.streams.end()) {
+		return;
+	}
+
+	if (s_it->second.read_closed && s_it->second.write_closed) {
+		stream_erase(f, stream_id);
+	}
+}
+
+void ToxExtTunnelTCP::stream_reset(uint32_t friend_number, Friend& f, uint16_t stream_id, bool notify) {
+	if (notify) {
+		send_control(friend_number, f, SegmentType::RESET, stream_id);
+	}
+
+	stream_erase(f, stream_id);
+}
+
+void ToxExtTunnelTCP::stream_erase(Friend& f, uint16_t stream_id) {
+	auto s_it = f.streams.find(stream_id);
+	if (s_it == f.streams.end()) {
+		return;
+	}
+
+#ifdef __linux__
+	if (s_it->second.events != 0) {
+		epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, s_it->second.s.handle(), nullptr);
+	}
+#endif
+
+	f.streams.erase(s_it);
+}
+
+bool ToxExtTunnelTCP::stream_wants_read(const Friend& f, const Stream& stream) const {
+	return !stream.connecting && !stream.read_closed && stream.send_credit > 0 && f.queue.empty();
+}
+
+bool ToxExtTunnelTCP::stream_wants_write(const Stream& stream) const {
+	return stream.connecting || stream.to_socket_offset < stream.to_socket.size();
+}
+
+#ifdef __linux__
+void ToxExtTunnelTCP::update_interest(uint32_t friend_number, const Friend& f, uint16_t stream_id, Stream& stream) {
+	uint32_t events = 0;
+	if (stream_wants_read(f, stream)) {
+		events |= EPOLLIN;
+	}
+	if (!stream.parked && stream_wants_write(stream)) {
+		events |= EPOLLOUT;
+	}
+
+	if (stream.parked) {
+		if (!(events & EPOLLIN)) {
+			return; // stays out, until there is something to read for
+		}
+		stream.parked = false;
+		if (stream_wants_write(stream)) {
+			events |= EPOLLOUT;
+		}
+	}
+
+	if (events == stream.events) {
+		return;
+	}
+
+	epoll_event ev {};
+	ev.events = events;
+	ev.data.u64 = event_data(friend_number, stream_id);
+
+	int op = EPOLL_CTL_MOD;
+	if (stream.events == 0) {
+		op = EPOLL_CTL_ADD;
+	} else if (events == 0) {
+		op = EPOLL_CTL_DEL;
+	}
+
+	if (epoll_ctl(_epoll_fd, op, stream.s.handle(), &ev) != 0) {
+		std::cerr << "!!! epoll_ctl failed for tcp stream " << friend_number << ":" << stream_id << " " << errno << "\n";
+	}
+	stream.events = events;
+}
+#else
+void ToxExtTunnelTCP::update_interest(uint32_t, const Friend&, uint16_t, Stream&) {
+	// polled every tick
+}
+#endif
+
+void ToxExtTunnelTCP::friend_segment_cb(uint32_t friend_number, const uint8_t* data, size_t size) {
+	if (size < segment_header_size) {
+		std::cerr << "!!! tcp segment too small\n";
+		return;
+	}
+
+	if (!friend_compatible.count(friend_number) || !friend_compatible.at(friend_number)) {
+		std::cerr << "WWW tcp segment from incompatible friend " << friend_number << "\n";
+		return;
+	}
+
+	const uint8_t type_raw = data[0];
+	// already flipped by the sender
+	const uint16_t s_id = data[1] | (uint16_t(data[2]) << 8);
+	data += segment_header_size;
+	size -= segment_header_size;
+
+	if (s_id == 0 || s_id == stream_id_remote_bit) {
+		std::cerr << "!!! tcp segment with invalid stream id " << friend_number << "\n";
+		return;
+	}
+
+	auto& f = _friends[friend_number];
+	auto s_it = f.streams.find(s_id);
+
+	switch (SegmentType(type_raw)) {
+		case SegmentType::OPEN: {
+			if (!(s_id & stream_id_remote_bit) || s_it != f.streams.end()) {
+				std::cerr << "!!! tcp OPEN for a bad stream id " << friend_number << ":" << s_id << "\n";
+				return;
+			}
+
+			if (f.streams.size() >= streams_per_friend_max) {
+				stats.streams_refused++;
+				send_control(friend_number, f, SegmentType::RESET, s_id);
+				return;
+			}
+
+			auto& stream = f.streams[s_id];
+			stream.connecting = true;
+			if (!stream.s.connect(outbound_address)) {
+				stats.streams_refused++;
+				stream_reset(friend_number, f, s_id, true);
+				return;
+			}
+			stats.streams_opened++;
+
+			std::cout << "III new tcp stream from " << friend_number << ":" << s_id << "\n";
+			update_interest(friend_number, f, s_id, stream);
+			break;
+		}
+		case SegmentType::DATA: {
+			if (s_it == f.streams.end()) {
+				// probably already reset, make sure the other side knows
+				send_control(friend_number, f, SegmentType::RESET, s_id);
+				return;
+			}
+
+			auto& stream = s_it->second;
+			if (stream.friend_closed || stream.to_socket.size() - stream.to_socket_offset + size > stream_window) {
+				std::cerr << "!!! tcp stream " << friend_number << ":" << s_id << " ignored flow control\n";
+				stream_reset(friend_number, f, s_id, true);
+				return;
+			}
+
+			stream.to_socket.insert(stream.to_socket.end(), data, data + size);
+			stats.bytes_from_friends += size;
+
+			if (!stream.connecting) {
+				handle_writable(friend_number, f, s_id, stream);
+			}
+			break;
+		}
+		case SegmentType::WINDOW: {
+			if (s_it == f.streams.end() || size != 4) {
+				return;
+			}
+
+			auto& stream = s_it->second;
+			const uint32_t credit = data[0] | (data[1] << 8) | (data[2] << 16) | (uint32_t(data[3]) << 24);
+			if (credit > stream_window - stream.send_credit) {
+				std::cerr << "!!! tcp stream " << friend_number << ":" << s_id << " got too much credit\n";
+				stream_reset(friend_number, f, s_id, true);
+				return;
+			}
+
+			stream.send_credit += credit;
+			update_interest(friend_number, f, s_id, stream);
+			break;
+		}
+		case SegmentType::CLOSE: {
+			if (s_it == f.streams.end()) {
+				return;
+			}
+
+			auto& stream = s_it->second;
+			stream.friend_closed = true;
+			if (!stream.connecting) {
+				// shuts down right away if nothing is left to write
+				handle_writable(friend_number, f, s_id, stream);
+			}
+			break;
+		}
+		case SegmentType::RESET:
+			stream_reset(friend_number, f, s_id, false);
+			break;
+		default:
+			std::cerr << "!!! unknown tcp segment type " << int(type_raw) << "\n";
+	}
+}
+
+static void tunnel_tcp_recv_callback(
+	ToxExtExtension*,
+	uint32_t friend_id, const void* data,
+	size_t size, void* userdata,
+	struct ToxExtPacketList*
+) {
+	auto* ud = static_cast<ToxExtTunnelTCP::UserData*>(userdata);
+	ud->tett->friend_segment_cb(friend_id, reinterpret_cast<const uint8_t*>(data), size);
+}
+
+static void tunnel_tcp_negotiate_connection_callback(
+	ToxExtExtension*,
+	uint32_t friend_id, bool compatible,
+	void* userdata,
+	ToxExtPacketList*
+) {
+	std::cout << "III tunnel_tcp_negotiate_connection_callback " << friend_id << " " << compatible << "\n";
+	auto* ud = static_cast<ToxExtTunnelTCP::UserData*>(userdata);
+	ud->tett->friend_compatible[friend_id] = compatible;
+}
+
+} // ttt::ext
+
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "./ext.hpp"
+#include "./tcp_socket.hpp"
+
+#include <zed_net.h>
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <cstdint>
+
+namespace ttt {
+	struct ToxClient;
+} // ttt
+
+namespace ttt::ext {
+
+// tunnels tcp peer connections (bittorrent peer wire) over toxext (lossless).
+// listens on the same local port as the udp tunnel of a friend, so the one
+// port the tracker hands out works for utp and tcp. every accepted connection
+// becomes a stream, which the friend connects to its own torrent client.
+//
+// segments are [type (1)] [stream id (2, le)] [...]
+// stream ids are from the receivers view, the highest bit is set for streams
+// the receiver did not open. so senders always flip it.
+//
+// flow control is credit based: a stream may have at most stream_window bytes
+// in flight, the receiver hands out more once it wrote the data to its socket.
+// no credit, or tox not taking more, means the local socket is not read,
+// which pushes back on the torrent client through tcp itself.
+class ToxExtTunnelTCP : public ToxClientExtension {
+	public:
+		enum class SegmentType : uint8_t {
+			OPEN = 0, // [type] [stream]
+			DATA = 1, // [type] [stream] [data]
+			WINDOW = 2, // [type] [stream] [credit (4, le)]
+			CLOSE = 3, // [type] [stream], no more data from this side
+			RESET = 4, // [type] [stream], stream is gone
+		};
+
+		constexpr static size_t segment_header_size = 3;
+
+		// initial credit of every stream, both sides assume it
+		constexpr static uint32_t stream_window = 256*1024;
+
+	public:
+		ToxExtTunnelTCP(void) = default;
+		~ToxExtTunnelTCP(void);
+
+		void register_ext(ToxExt* toxext) override;
+		void deregister_ext(ToxExt* toxext) override;
+
+		// opens/closes listeners, moves data between sockets and tox
+		void tick(float time_delta) override;
+		float next_tick_in(void) override;
+		int wakeup_fd(void) override;
+
+		// a toxext segment
+		void friend_segment_cb(uint32_t friend_number, const uint8_t* data, size_t size);
+
+	public: // tox_client "interface"
+		// ext support
+		// if an entry exists, negotiantion has been done at least once
+		std::map<uint32_t, bool> friend_compatible {};
+
+		// local torrent client, streams from friends get connected here
+		zed_net_address_t outbound_address {};
+
+		size_t streams_per_friend_max {64};
+		// segments read from a single stream per tick, so one stream can not starve the others
+		size_t stream_burst_max {16};
+
+		struct Stats {
+			uint64_t streams_opened {0};
+			uint64_t streams_refused {0}; // limit or connect failed
+			uint64_t bytes_to_friends {0};
+			uint64_t bytes_from_friends {0};
+			uint64_t sendq_full {0}; // times tox did not take a segment
+		} stats {};
+
+		size_t stream_count(void) const;
+
+	public: // internal for callbacks
+		struct UserData {
+			ttt::ToxClient* tc;
+			ToxExtTunnelTCP* tett;
+		} ud{};
+
+	private:
+		struct Stream {
+			TCPSocket s;
+			bool connecting {false}; // streams opened by the friend, until the local connect is done
+			bool read_closed {false}; // local socket hit eof, CLOSE sent
+			bool friend_closed {false}; // CLOSE received
+			bool write_closed {false}; // friend_closed and everything written, fin sent
+
+			uint32_t send_credit {stream_window}; // bytes we may still send to the friend
+			uint32_t recv_consumed {0}; // written to the socket since the last WINDOW
+
+			// from the friend, not yet taken by the socket. bounded by the window
+			std::vector<uint8_t> to_socket {};
+			size_t to_socket_offset {0};
+
+#ifdef __linux__
+			uint32_t events {0}; // current epoll interest
+			bool parked {false}; // hung up while we did not want to read, out of epoll until we do
+#endif
+		};
+
+		struct Friend {
+			TCPSocket listener;
+			uint16_t port {0};
+			uint32_t host {0}; // network order, 0 for any
+			uint16_t udp_port {0}; // what the listener was opened for
+			uint16_t next_stream_id {1};
+
+			// keyed by the local stream id (see class comment)
+			std::map<uint16_t, Stream> streams {};
+
+			// segments tox did not take yet, sent in order before anything else
+			std::deque<std::vector<uint8_t>> queue {};
+		};
+
+		std::map<uint32_t, Friend> _friends {};
+
+		void open_listeners(void);
+		void close_friend(uint32_t friend_number);
+
+		// queues if tox is busy, so nothing gets lost or reordered
+		void send_segment(uint32_t friend_number, Friend& f, const uint8_t* data, size_t size);
+		void send_control(uint32_t friend_number, Friend& f, SegmentType type, uint16_t stream_id, uint32_t value = 0);
+		bool try_send(uint32_t friend_number, const uint8_t* data, size_t size);
+		// returns true if the queue became empty
+		bool flush_queue(uint32_t friend_number, Friend& f);
+
+		void handle_accept(uint32_t friend_number, Friend& f);
+		void handle_readable(uint32_t friend_number, Friend& f, uint16_t stream_id, Stream& stream);
+		void handle_writable(uint32_t friend_number, Friend& f, uint16_t stream_id, Stream& stream);
+		// when both directions are done
+		void stream_maybe_done(Friend& f, uint16_t stream_id);
+		void stream_reset(uint32_t friend_number, Friend& f, uint16_t stream_id, bool notify);
+
+		bool stream_wants_read(const Friend& f, const Stream& stream) const;
+		bool stream_wants_write(const Stream& stream) const;
+		void update_interest(uint32_t friend_number, const Friend& f, uint16_t stream_id, Stream& stream);
+		void stream_erase(Friend& f, uint16_t stream_id);
+
+		float _listener_timer {0.f};
+
+#ifdef __linux__
+		// readiness over all listeners and streams, doubles as the wakeup fd.
+		// event data is (friend << 32) | stream id, 0 is the listener
+		int _epoll_fd {-1};
+#endif
+};
+
+} // ttt::ext
+
@@ -54,47 +54,48 @@ void ToxExtTunnelUDP::deregister_ext(ToxExt* toxext) {
 	toxext_deregister(_tee);
 }
 
-void ToxExtTunnelUDP::tick(void) {
+void ToxExtTunnelUDP::tick(float) {
 	{ // iterate every tunnel
 		for (auto& [f_id, tun] : _tunnels) {
-			zed_net_address_t addr{};
-
-			const size_t buff_size_max = TOX_MAX_CUSTOM_PACKET_SIZE+1;
-			uint8_t buff[buff_size_max];
-			buff[0] = packet_id; // TODO: tox_lossy_pkg_id
-
-			int ret = zed_net_udp_socket_receive(&(tun.s), &addr, buff+1, buff_size_max-1);
+			struct RecvCtx {
+				ToxExtTunnelUDP* self;
+				uint32_t friend_number;
+				uint16_t port;
+			} ctx {this, f_id, tun.port};
+
+			const int ret = tun.s.receive(
+				[](void* user_data, const zed_net_address_t&, uint32_t, uint8_t* data, size_t size) {
+					auto* c = static_cast<RecvCtx*>(user_data);
+#ifndef EXT_TUNNEL_UDP_NO_LOG
+					std::cout << "III got udp " << c->port << "  " << size << "\n";
+#endif
+					if (size >= TOX_MAX_CUSTOM_PACKET_SIZE-1) {
+						std::cerr << "WWW got over max sized udp packet, dropping\n";
+						return;
+					}
+
+					// TODO: check addr maches torrent client setting, otherwise ignore
+
+					// socket headroom, so we can prepend in place
+					uint8_t* buff = data-1;
+					buff[0] = packet_id; // TODO: tox_lossy_pkg_id
+
+					// TODO: error checking
+					if (!tox_friend_send_lossy_packet(c->self->ud.tc->tox, c->friend_number, buff, size+1, nullptr)) {
+						std::cerr << "!!! error sending lossy " << c->friend_number << "  " << size+1 << "\n";
+					}
+				},
+				&ctx,
+				UDPSocket::batch_size_max
+			);
 
 			if (ret < 0) {
 				std::cerr << "!!! error receiving on socket\n";
 				continue;
-			} else if (ret == 0) {
-				continue; // no data
-			}
-
-#ifndef EXT_TUNNEL_UDP_NO_LOG
-			std::cout << "III got udp " << tun.port << "  " << ret << "\n";
-#endif
-			if (size_t(ret) >= buff_size_max-2) {
-				std::cerr << "WWW got over max sized udp packet, dropping\n";
-				continue;
 			}
 
-			// TODO: check addr maches torrent client setting, otherwise ignore
-
-			// debug !!!
-#if 0
-			std::cout << ">>> got udp " << std::hex;
-			for (size_t i = 0; i < (size_t)ret; i++) {
-				std::cout << (int)buff[i+1] << " ";
-			}
-			std::cout << std::dec << "\n";
-#endif
-
-			// TODO: error checking
-			if (!tox_friend_send_lossy_packet(ud.tc->tox, f_id, buff, ret+1, nullptr)) {
-				std::cerr << "!!! error sending lossy " << f_id << "  " << ret+1 << "\n";
-			}
+			// send everything friend_custom_pkg_cb queued up
+			tun.s.flush();
 		}
 	}
 
@@ -111,8 +112,9 @@ void ToxExtTunnelUDP::tick(void) {
 			{ // first stop advertising
 				const std::lock_guard mutex_lock{ud.tc->torrent_db_mutex};
 				ud.tc->torrent_db.peers.erase(f_id);
+				ud.tc->torrent_db.friend_peers_changed(f_id);
 			}
-			zed_net_socket_close(&_tunnels[f_id].s);
+			_tunnels[f_id].s.close();
 			std::cout << "III closed tunnel " << f_id << " " << _tunnels[f_id].port << "\n";
 			_tunnels.erase(f_id);
 			friend_compatible.erase(f_id); // also erase from compatible list
@@ -142,7 +144,7 @@ void ToxExtTunnelUDP::tick(void) {
 			// THIS IS HARDCORE
 			// we try every port in range
 			for (uint16_t port = 20000; port < 60000; port++) {
-				if (zed_net_udp_socket_open(&new_tunnel.s, port, 1) == 0) {
+				if (new_tunnel.s.open(port)) {
 					new_tunnel.port = port;
 					std::cout << "III opened socket " << f_id << " " << port << "\n";
 					break;
@@ -158,6 +160,7 @@ void ToxExtTunnelUDP::tick(void) {
 			// notify torrent_db of peer
 			const std::lock_guard mutex_lock{ud.tc->torrent_db_mutex};
 			ud.tc->torrent_db.peers[f_id] = new_tunnel.port;
+			ud.tc->torrent_db.friend_peers_changed(f_id);
 		}
 
 		// clean up
@@ -167,6 +170,15 @@ void ToxExtTunnelUDP::tick(void) {
 	}
 }
 
+float ToxExtTunnelUDP::next_tick_in(void) {
+	// no readiness set, so keep polling
+	return 0.001f;
+}
+
+int ToxExtTunnelUDP::wakeup_fd(void) {
+	return -1;
+}
+
 void ToxExtTunnelUDP::friend_custom_pkg_cb(uint32_t friend_number, const uint8_t* data, size_t size) {
 #ifndef EXT_TUNNEL_UDP_NO_LOG
 	std::cout << "<<< friend_custom_pkg_cb " << friend_number << " " << size << "\n";
@@ -192,8 +204,10 @@ void ToxExtTunnelUDP::friend_custom_pkg_cb(uint32_t friend_number, const uint8_t
 	}
 
 	auto& tunnel = _tunnels.at(friend_number);
-	// TODO: error check
-	zed_net_udp_socket_send(&(tunnel.s), outbound_address, data+1, size-1);
+	// batched, goes out on the next tick
+	if (!tunnel.s.send(outbound_address, data+1, size-1)) {
+		std::cerr << "!!! error sending " << friend_number << "\n";
+	}
 }
 
 static void tunnel_udp_recv_callback(
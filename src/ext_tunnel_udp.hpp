@@ -1,6 +1,7 @@
 #pragma once
 
 #include "./ext.hpp"
+#include "./udp_socket.hpp"
 
 #include <zed_net.h>
 
@@ -24,7 +25,9 @@ class ToxExtTunnelUDP : public ToxClientExtension {
 		void deregister_ext(ToxExt* toxext) override;
 
 		// creates and destroys tunnels
-		void tick(void) override;
+		void tick(float time_delta) override;
+		float next_tick_in(void) override;
+		int wakeup_fd(void) override;
 
 		void friend_custom_pkg_cb(uint32_t friend_number, const uint8_t* data, size_t size);
 
@@ -45,7 +48,7 @@ class ToxExtTunnelUDP : public ToxClientExtension {
 
 	private: // tunnel data
 		struct Tunnel {
-			zed_net_socket_t s;
+			UDPSocket s;
 			uint16_t port {}; // in host
 		};
 
@@ -1,8 +1,22 @@
 #include "./ext_tunnel_udp2.hpp"
 
 #include "./tox_client_private.hpp"
+#include "./tox_transport.hpp"
 
 #include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
 
 //#define EXT_TUNNEL_UDP_NO_LOG 1
 
@@ -15,7 +29,7 @@ constexpr static uint8_t announce_uuid[16] {
 	0x93, 0x19, 0x66, 0x5a,
 	0x22, 0xc2, 0xb5, 0xee,
 
-	0x11, 0x13, 0x32, 0x00,
+	0x11, 0x13, 0x32, 0x04,
 };
 
 static void tunnel_udp_recv_callback(
@@ -33,8 +47,77 @@ static void tunnel_udp_negotiate_connection_callback(
 	ToxExtPacketList* response_packet_list
 );
 
+// how often tunnels are checked for due probes
+constexpr static float probe_pass_interval = 0.1f;
+
+// lossy fragment payload, after packet id and fragment header
+constexpr static size_t lossy_frag_size_max = TOX_MAX_CUSTOM_PACKET_SIZE - 1 - FragmentHeader::size;
+static_assert(PacketBuffer::headroom >= 1 + FragmentHeader::size);
+
+// same for fec fragments
+constexpr static size_t fec_frag_size_max = TOX_MAX_CUSTOM_PACKET_SIZE - 1 - FecHeader::size;
+static_assert(PacketBuffer::headroom >= 1 + FecHeader::size);
+
+// most a sendq has to keep: a coalesced packet, flushed right before every
+// fragment of one datagram (more do not get sent while something is kept)
+constexpr static size_t sendq_capacity = 1 + std::max({
+	(PacketBuffer::capacity + TOXEXT_MAX_SEGMENT_SIZE - FragmentHeader::size - 1) / (TOXEXT_MAX_SEGMENT_SIZE - FragmentHeader::size),
+	(PacketBuffer::capacity + lossy_frag_size_max - 1) / lossy_frag_size_max,
+	2 * ((PacketBuffer::capacity + fec_frag_size_max - 1) / fec_frag_size_max), // r <= k
+});
+
+#ifdef __linux__
+// epoll event data for the io wakeup eventfd, friend numbers never get that high
+constexpr static uint32_t io_wakeup_event_id = UINT32_MAX;
+constexpr static uint32_t io_shared_socket_event_id = UINT32_MAX-1;
+#endif
+
+// keeps the shared hosts inside 127/8 with the default base
+constexpr static uint32_t shared_hosts_max = 0x10000;
+
+// network order ipv4 + n, without pulling in platform socket headers
+static uint32_t host_add(uint32_t host, uint32_t n) {
+	uint8_t b[4];
+	std::memcpy(b, &host, 4);
+	uint32_t h = (uint32_t(b[0]) << 24) | (uint32_t(b[1]) << 16) | (uint32_t(b[2]) << 8) | b[3];
+	h += n;
+	b[0] = h >> 24; b[1] = h >> 16; b[2] = h >> 8; b[3] = h;
+	std::memcpy(&host, b, 4);
+	return host;
+}
+
+// network order ipv4 to dotted string, zed_net_host_to_str is not thread safe
+static std::string host_to_string(uint32_t host) {
+	const uint8_t* b = reinterpret_cast<const uint8_t*>(&host);
+	return
+		std::to_string(b[0]) + "." +
+		std::to_string(b[1]) + "." +
+		std::to_string(b[2]) + "." +
+		std::to_string(b[3])
+	;
+}
+
+ToxExtTunnelUDP2::~ToxExtTunnelUDP2(void) {
+	if (_io_thread.joinable()) {
+		_io_thread_stop = true;
+		io_signal();
+		_io_thread.join();
+	}
+
+#ifdef __linux__
+	for (int* fd : {&_epoll_fd, &_io_wakeup_fd, &_tox_wakeup_fd}) {
+		if (*fd >= 0) {
+			close(*fd);
+			*fd = -1;
+		}
+	}
+#endif
+}
+
 void ToxExtTunnelUDP2::register_ext(ToxExt* toxext) {
-	ud.tc = _tox_client.get();
+	if (ud.tc == nullptr) { // can be set before, for clients other than the global one (bench)
+		ud.tc = _tox_client.get();
+	}
 	ud.tetu = this;
 
 	_tee = toxext_register(
@@ -45,107 +128,153 @@ void ToxExtTunnelUDP2::register_ext(ToxExt* toxext) {
 	assert(_tee);
 	std::cout << "III register_ext tunnel_udp2\n";
 
-	// default
-	// TODO: load from config
-	zed_net_get_address(&outbound_address, "localhost", 51413);
+	_tox_transport = std::make_unique<ToxTransport>(ud.tc->tox, toxext, _tee);
+	_transport = _tox_transport.get();
+
+	setup();
 }
 
-void ToxExtTunnelUDP2::deregister_ext(ToxExt* toxext) {
-	toxext_deregister(_tee);
+void ToxExtTunnelUDP2::register_transport(ToxClient* tc, Transport* transport) {
+	ud.tc = tc;
+	ud.tetu = this;
+	_transport = transport;
+
+	setup();
 }
 
-void ToxExtTunnelUDP2::tick(void) {
-	{ // iterate every tunnel
-		for (auto& [f_id, tun] : _tunnels) {
-			zed_net_address_t addr{};
+void ToxExtTunnelUDP2::setup(void) {
+	// default
+	// TODO: load from config
+	zed_net_get_address(&outbound_address, "localhost", 51413);
 
-			const size_t buff_size_max = 2048;
-			const size_t single_pkg_size_max = TOX_MAX_CUSTOM_PACKET_SIZE-1;
-			uint8_t buff[buff_size_max];
+	tunnel_ports_load(ud.tc->tunnel_ports_filename);
 
-			int socket_bytes_read = zed_net_udp_socket_receive(&(tun.s), &addr, buff+1, buff_size_max-1);
+	_reassembler.fail_fn = reassembly_fail_cb;
+	_reassembler.fail_user_data = this;
+	_fec_decoder.fail_fn = reassembly_fail_cb;
+	_fec_decoder.fail_user_data = this;
 
-			if (socket_bytes_read < 0) {
-				std::cerr << "!!! error receiving on socket\n";
-				continue;
-			} else if (socket_bytes_read == 0) {
-				continue; // no data
-			}
+#ifdef __linux__
+	_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (_epoll_fd < 0) {
+		std::cerr << "!!! epoll_create1 failed " << errno << "\n";
+	}
 
+	_io_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	_tox_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_io_wakeup_fd < 0 || _tox_wakeup_fd < 0) {
+		std::cerr << "!!! eventfd failed " << errno << "\n";
+	}
 
-#ifndef EXT_TUNNEL_UDP_NO_LOG
-			std::cout << "III got udp " << tun.port << "  " << socket_bytes_read << "\n";
+	epoll_event ev {};
+	ev.events = EPOLLIN;
+	ev.data.u32 = io_wakeup_event_id;
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _io_wakeup_fd, &ev) != 0) {
+		std::cerr << "!!! failed to add wakeup fd to epoll " << errno << "\n";
+	}
 #endif
-			if (size_t(socket_bytes_read) == buff_size_max-1) {
-				std::cerr << "WWW got over max sized udp packet, dropping\n";
-				continue;
-			}
 
-			if (size_t(socket_bytes_read) <= single_pkg_size_max) {
-				buff[0] = packet_id; // TODO: tox_lossy_pkg_id
+	_io_thread_stop = false;
+	_io_thread = std::thread(&ToxExtTunnelUDP2::io_thread_fn, this);
+}
 
-				// TODO: check addr maches torrent client setting, otherwise ignore
+void ToxExtTunnelUDP2::deregister_ext(ToxExt* toxext) {
+	toxext_deregister(_tee);
 
-				// debug !!!
-#if 0
-				std::cout << ">>> got udp " << std::hex;
-				for (size_t i = 0; i < (size_t)ret; i++) {
-					std::cout << (int)buff[i+1] << " ";
-				}
-				std::cout << std::dec << "\n";
+	if (_io_thread.joinable()) {
+		_io_thread_stop = true;
+		io_signal();
+		_io_thread.join();
+	}
+}
+
+void ToxExtTunnelUDP2::tick(float time_delta) {
+#ifdef __linux__
+	{ // clear before draining, so nothing pushed after this gets lost
+		uint64_t tmp;
+		[[maybe_unused]] auto _ = read(_tox_wakeup_fd, &tmp, sizeof(tmp));
+	}
 #endif
 
-				// TODO: propper error checking
-				if (!tox_friend_send_lossy_packet(ud.tc->tox, f_id, buff, socket_bytes_read+1, nullptr)) {
-					std::cerr << "!!! error sending lossy " << f_id << "  " << socket_bytes_read+1 << "\n";
-				}
-			} else { // large pkg
-				// TODO: getting tox_ext that way is bad
-				auto* pkg_list = toxext_packet_list_create(ud.tc->tox_ext, f_id);
+	_tick_now = std::chrono::steady_clock::now();
+	_rate_limit_global.refill(_tick_now);
 
-				for (size_t i = 1; i < size_t(socket_bytes_read+1); i += TOXEXT_MAX_SEGMENT_SIZE-1) {
-					const size_t frag_buff_size = std::min<int64_t>(TOXEXT_MAX_SEGMENT_SIZE-1, socket_bytes_read-(i-1));
+	// forward everything the io thread read, or queue it if limits apply
+	while (Packet* pkg = _from_udp.front()) {
+		if (auto tun_it = _tunnels.find(pkg->friend_number); tun_it != _tunnels.end()) {
+			enqueue_datagram(pkg->friend_number, tun_it->second, pkg->buff);
+		}
+		_from_udp.pop();
+	}
 
-					const uint8_t* frag_buff = buff + i;
-					const uint8_t* frag_buff_end = frag_buff + frag_buff_size; // end points to the element past the last one
+	// whatever tox did not take last time goes first
+	if (_sendq_pending > 0) {
+		for (auto& [f_id, tunnel] : _tunnels) {
+			if (!tunnel.sendq.empty()) {
+				sendq_flush(f_id, tunnel);
+			}
+		}
+	}
 
-					uint8_t is_last_frag = frag_buff_size < TOXEXT_MAX_SEGMENT_SIZE-1;
+	if (!_drr_active.empty()) {
+		schedule();
+	}
 
-					std::vector<uint8_t> tmp_buff{};
-					tmp_buff.push_back(is_last_frag);
+	if (_coalesce_pending > 0) {
+		const auto now = std::chrono::steady_clock::now();
+		for (auto& [f_id, tunnel] : _tunnels) {
+			if (tunnel.coalesce_count > 0 && now >= tunnel.coalesce_deadline) {
+				coalesce_flush(f_id, tunnel);
+			}
+		}
+	}
 
-					tmp_buff.insert(tmp_buff.end(), frag_buff, frag_buff_end);
+	// drop incomplete datagrams that are too old
+	_reassembler.tick(time_delta);
+	_fec_decoder.tick(time_delta);
 
-					toxext_segment_append(pkg_list, _tee, tmp_buff.data(), tmp_buff.size());
-				}
+	_probe_timer += time_delta;
+	if (_probe_timer >= probe_pass_interval) {
+		_probe_timer = 0.f;
+		probe_tunnels();
+	}
 
-				auto ret = toxext_send(pkg_list);
-				if (ret != TOXEXT_SUCCESS) {
-					std::cerr << "!!! error sending toxext pkg list " << f_id << "\n";
-				}
-			}
-		}
+	_traffic_timer += time_delta;
+	if (_traffic_timer >= traffic_interval) {
+		update_traffic(_traffic_timer);
+		_traffic_timer = 0.f;
+	}
+
+	if (_io_results_pushed) {
+		handle_io_results();
+	}
+
+	// friend_custom_pkg_cb ran during tox_iterate, so hand it over now
+	if (_to_udp_pushed) {
+		_to_udp_pushed = false;
+		io_signal();
 	}
 
+	bool io_commands_pushed = false;
+
 	// TODO: dont do every tick !!!
 	{ // destroy tunnels to offline friends
 		std::vector<uint32_t> to_destroy {};
 		for (const auto& [f_id, tun] : _tunnels) {
-			if (tox_friend_get_connection_status(ud.tc->tox, f_id, nullptr) == TOX_CONNECTION_NONE) {
+			if (!_transport->friend_connected(f_id)) {
 				to_destroy.push_back(f_id);
 			}
 		}
 
 		for (const auto& f_id : to_destroy) {
-			{ // first stop advertising
-				const std::lock_guard mutex_lock{ud.tc->torrent_db_mutex};
-				ud.tc->torrent_db.peers.erase(f_id);
+			{ // io thread stops advertising and closes the socket
+				const std::lock_guard lock{_io_commands_mutex};
+				_io_commands.push_back({IOCommand::Type::CLOSE, f_id});
+				io_commands_pushed = true;
 			}
-			zed_net_socket_close(&_tunnels[f_id].s);
-			std::cout << "III closed tunnel " << f_id << " " << _tunnels[f_id].port << "\n";
-			_tunnels.erase(f_id);
+			std::cout << "III closing tunnel " << f_id << "\n";
+			tunnel_remove(f_id);
 			friend_compatible.erase(f_id); // also erase from compatible list
-
 		}
 	}
 
@@ -161,32 +290,32 @@ void ToxExtTunnelUDP2::tick(void) {
 				continue;
 			}
 
-			if (tox_friend_get_connection_status(ud.tc->tox, f_id, nullptr) == TOX_CONNECTION_NONE) {
+			if (!_transport->friend_connected(f_id)) {
 				to_destroy.push_back(f_id);
 				continue;
 			}
 
-			auto& new_tunnel = _tunnels[f_id];
-			new_tunnel.port = 0;
-			// THIS IS HARDCORE
-			// we try every port in range
-			for (uint16_t port = 20000; port < 60000; port++) {
-				if (zed_net_udp_socket_open(&new_tunnel.s, port, 1) == 0) {
-					new_tunnel.port = port;
-					std::cout << "III opened socket " << f_id << " " << port << "\n";
-					break;
-				}
-			}
-
-			if (new_tunnel.port == 0) {
-				_tunnels.erase(f_id);
-				std::cerr << "!!! failed to open socket " << f_id << "\n";
-				continue;
+			uint16_t port_preferred = 0;
+			if (auto port_it = _tunnel_ports.find(friend_public_key_hex(f_id)); port_it != _tunnel_ports.end()) {
+				port_preferred = port_it->second;
 			}
 
-			// notify torrent_db of peer
-			const std::lock_guard mutex_lock{ud.tc->torrent_db_mutex};
-			ud.tc->torrent_db.peers[f_id] = new_tunnel.port;
+			// io thread opens the socket and notifies torrent_db
+			auto& tunnel = _tunnels[f_id];
+			// the only allocations for the queues, nothing grows while tunneling
+			tunnel.queue.reserve(queue_packets_max);
+			tunnel.sendq.reserve(sendq_capacity);
+			_drr_active.reserve(_tunnels.size());
+			tunnel.bucket.set_rate(friend_rate_limit_for(f_id));
+			tunnel.fec_redundancy = fec_redundancy_for(f_id);
+			const std::lock_guard lock{_io_commands_mutex};
+			_io_commands.push_back({
+				IOCommand::Type::OPEN, f_id,
+				shared_socket, shared_host_base,
+				port_preferred, port_range_first, port_range_last,
+				tunnel.traffic
+			});
+			io_commands_pushed = true;
 		}
 
 		// clean up
@@ -194,49 +323,1425 @@ void ToxExtTunnelUDP2::tick(void) {
 			friend_compatible.erase(f_id);
 		}
 	}
+
+	if (io_commands_pushed) {
+		io_signal();
+	}
 }
 
-void ToxExtTunnelUDP2::friend_custom_pkg_cb(uint32_t friend_number, const uint8_t* data, size_t size, bool lossless) {
-#ifndef EXT_TUNNEL_UDP_NO_LOG
-	std::cout << "<<< friend_custom_pkg_cb " << friend_number << " " << lossless << " " << size << "\n";
-#endif
-	if (size < 1 + (lossless ? 1 : 0)) {
-		std::cerr << "!!! packet too small\n";
+void ToxExtTunnelUDP2::rate_limit_set(float bytes_per_second) {
+	_rate_limit_global.set_rate(bytes_per_second);
+}
+
+void ToxExtTunnelUDP2::friend_rate_limit_set(float bytes_per_second) {
+	_friend_rate_limit_default = bytes_per_second;
+	for (auto& [f_id, tunnel] : _tunnels) {
+		tunnel.bucket.set_rate(friend_rate_limit_for(f_id));
+	}
+}
+
+void ToxExtTunnelUDP2::friend_rate_limit_set(const std::string& public_key_hex, float bytes_per_second) {
+	if (bytes_per_second < 0.f) {
+		_friend_rate_limits.erase(public_key_hex);
+	} else {
+		_friend_rate_limits[public_key_hex] = bytes_per_second;
+	}
+
+	for (auto& [f_id, tunnel] : _tunnels) {
+		if (friend_public_key_hex(f_id) == public_key_hex) {
+			tunnel.bucket.set_rate(friend_rate_limit_for(f_id));
+		}
+	}
+}
+
+float ToxExtTunnelUDP2::friend_rate_limit_get(const std::string& public_key_hex) const {
+	if (auto it = _friend_rate_limits.find(public_key_hex); it != _friend_rate_limits.end()) {
+		return it->second;
+	}
+	return _friend_rate_limit_default;
+}
+
+float ToxExtTunnelUDP2::friend_rate_limit_for(uint32_t friend_number) const {
+	if (_friend_rate_limits.empty()) {
+		return _friend_rate_limit_default;
+	}
+	return friend_rate_limit_get(friend_public_key_hex(friend_number));
+}
+
+void ToxExtTunnelUDP2::fec_redundancy_set(float redundancy) {
+	if (!std::isfinite(redundancy)) {
 		return;
 	}
+	_fec_redundancy_default = std::clamp(redundancy, 0.f, 1.f);
+	for (auto& [f_id, tunnel] : _tunnels) {
+		tunnel.fec_redundancy = fec_redundancy_for(f_id);
+	}
+}
 
-	if (!friend_compatible.count(friend_number) || !friend_compatible.at(friend_number)) {
-		std::cerr << "WWW packet from incompatible friend " << friend_number << "\n";
+void ToxExtTunnelUDP2::fec_redundancy_set(const std::string& public_key_hex, float redundancy) {
+	if (!std::isfinite(redundancy)) {
 		return;
 	}
 
-	if (!_tunnels.count(friend_number)) {
-		std::cerr << "!!! packet, but no tunnel yet " << friend_number << "\n";
+	if (redundancy < 0.f) {
+		_fec_redundancies.erase(public_key_hex);
+	} else {
+		_fec_redundancies[public_key_hex] = std::min(redundancy, 1.f);
+	}
+
+	for (auto& [f_id, tunnel] : _tunnels) {
+		if (friend_public_key_hex(f_id) == public_key_hex) {
+			tunnel.fec_redundancy = fec_redundancy_for(f_id);
+		}
+	}
+}
+
+float ToxExtTunnelUDP2::fec_redundancy_get(const std::string& public_key_hex) const {
+	if (auto it = _fec_redundancies.find(public_key_hex); it != _fec_redundancies.end()) {
+		return it->second;
+	}
+	return _fec_redundancy_default;
+}
+
+float ToxExtTunnelUDP2::fec_redundancy_for(uint32_t friend_number) const {
+	if (_fec_redundancies.empty()) {
+		return _fec_redundancy_default;
+	}
+	return fec_redundancy_get(friend_public_key_hex(friend_number));
+}
+
+void ToxExtTunnelUDP2::enqueue_datagram(uint32_t friend_number, Tunnel& tunnel, PacketBuffer& pkg) {
+	tunnel.bucket.refill(_tick_now);
+
+	// nothing waiting, so nobody gets skipped by sending right away
+	if (
+		tunnel.queue.empty() &&
+		tunnel.sendq.empty() &&
+		(_drr_active.empty() || _rate_limit_global.unlimited()) &&
+		_rate_limit_global.can_consume(pkg.size) &&
+		tunnel.bucket.can_consume(pkg.size)
+	) {
+		_rate_limit_global.consume(pkg.size);
+		tunnel.bucket.consume(pkg.size);
+		forward_datagram(friend_number, pkg);
 		return;
 	}
 
+	// full() if queue_packets_max got raised after opening
+	if (tunnel.queue.size() >= queue_packets_max || tunnel.queue.full()) {
+		queue_drops++;
+		TrafficCounters::inc(tunnel.traffic->to_friend.drops);
+		return;
+	}
+
+	PacketBuffer* buff = _pool.acquire();
+	buff->size = pkg.size;
+	buff->timestamp_us = pkg.timestamp_us;
+	std::memcpy(buff->data(), pkg.data(), pkg.size);
+	tunnel.queue.push_back(buff);
+
+	if (!tunnel.active) {
+		tunnel.active = true;
+		_drr_active.push_back(friend_number);
+	}
+
+	// the other half is for what the io thread already read
+	if (!tunnel.paused && tunnel.queue.size() >= queue_packets_max/2) {
+		tunnel_pause(friend_number, tunnel, true);
+	}
+}
+
+void ToxExtTunnelUDP2::schedule(void) {
+	// stop after a full round of everyone waiting for tokens
+	size_t blocked_count = 0;
+	while (!_drr_active.empty() && blocked_count < _drr_active.size()) {
+		const uint32_t f_id = _drr_active.front();
+		_drr_active.pop_front();
+
+		auto& tunnel = _tunnels.at(f_id);
+		tunnel.bucket.refill(_tick_now);
+		tunnel.deficit += drr_quantum;
+
+		// tox is still busy with this one
+		bool blocked = !tunnel.sendq.empty();
+		bool global_blocked = false;
+		while (!blocked && !tunnel.queue.empty()) {
+			PacketBuffer* buff = tunnel.queue.front();
+			if (buff->size > tunnel.deficit) {
+				break; // next round
+			}
+			if (!_rate_limit_global.can_consume(buff->size)) {
+				global_blocked = true;
+				break;
+			}
+			if (!tunnel.bucket.can_consume(buff->size)) {
+				blocked = true;
+				break;
+			}
+
+			_rate_limit_global.consume(buff->size);
+			tunnel.bucket.consume(buff->size);
+			tunnel.deficit -= buff->size;
+
+			forward_datagram(f_id, *buff);
+
+			tunnel.queue.pop_front();
+			_pool.release(buff);
+
+			if (!tunnel.sendq.empty()) {
+				blocked = true;
+				break;
+			}
+		}
+
+		if (tunnel.paused && tunnel.queue.size() <= queue_packets_max/4) {
+			tunnel_pause(f_id, tunnel, false);
+		}
+
+		if (tunnel.queue.empty()) {
+			tunnel.deficit = 0;
+			tunnel.active = false;
+		} else {
+			// waiting for tokens should not build up credit
+			tunnel.deficit = std::min(tunnel.deficit, drr_quantum + PacketBuffer::capacity);
+
+			if (global_blocked) {
+				// keeps its turn for when there are tokens again
+				_drr_active.push_front(f_id);
+				break;
+			}
+			_drr_active.push_back(f_id);
+		}
+
+		blocked_count = blocked ? blocked_count + 1 : 0;
+	}
+}
+
+void ToxExtTunnelUDP2::tunnel_queue_clear(Tunnel& tunnel) {
+	for (size_t i = 0; i < tunnel.queue.size(); i++) {
+		_pool.release(tunnel.queue[i]);
+	}
+	tunnel.queue.clear();
+	tunnel.deficit = 0;
+	tunnel.active = false;
+
+	if (!tunnel.sendq.empty()) {
+		for (size_t i = 0; i < tunnel.sendq.size(); i++) {
+			_pool.release(tunnel.sendq[i].buff);
+		}
+		tunnel.sendq.clear();
+		_sendq_pending--;
+	}
+}
+
+void ToxExtTunnelUDP2::tunnel_pause(uint32_t friend_number, Tunnel& tunnel, bool pause) {
+	tunnel.paused = pause;
+	if (pause) {
+		pauses++;
+	}
+
+	{
+		const std::lock_guard lock{_io_commands_mutex};
+		_io_commands.push_back({pause ? IOCommand::Type::PAUSE : IOCommand::Type::RESUME, friend_number});
+	}
+	io_signal();
+}
+
+std::vector<ToxExtTunnelUDP2::QueueStats> ToxExtTunnelUDP2::queue_stats(void) const {
+	std::vector<QueueStats> stats {};
+	stats.reserve(_tunnels.size());
+	for (const auto& [f_id, tunnel] : _tunnels) {
+		auto& it = stats.emplace_back();
+		it.friend_number = f_id;
+		it.queued = tunnel.queue.size();
+		it.unsent = tunnel.sendq.size();
+		it.paused = tunnel.paused;
+	}
+	return stats;
+}
+
+std::vector<ToxExtTunnelUDP2::TrafficStats> ToxExtTunnelUDP2::traffic_stats(void) const {
+	const std::lock_guard lock{_traffic_mutex};
+	return _traffic_snapshot;
+}
+
+ToxExtTunnelUDP2::TrafficStats ToxExtTunnelUDP2::traffic_total(void) const {
+	const std::lock_guard lock{_traffic_mutex};
+	return _traffic_total_snapshot;
+}
+
+void ToxExtTunnelUDP2::update_traffic(float time_delta) {
+	std::vector<TrafficStats> snapshot {};
+	snapshot.reserve(_tunnels.size());
+	TrafficStats total = _traffic_closed;
+
+	for (auto& [f_id, tunnel] : _tunnels) {
+		auto& it = snapshot.emplace_back();
+		it.friend_number = f_id;
+
+		const auto fill = [time_delta](TrafficStats::Direction& dir, const TrafficCounters& counters, RateEstimate& packets_rate, RateEstimate& bytes_rate) {
+			dir.packets = TrafficCounters::get(counters.packets);
+			dir.bytes = TrafficCounters::get(counters.bytes);
+			dir.fragments = TrafficCounters::get(counters.fragments);
+			dir.drops = TrafficCounters::get(counters.drops);
+			dir.reassembly_failures = TrafficCounters::get(counters.reassembly_failures);
+
+			packets_rate.update(dir.packets, time_delta);
+			bytes_rate.update(dir.bytes, time_delta);
+			dir.packets_rate = packets_rate.rate;
+			dir.bytes_rate = bytes_rate.rate;
+		};
+		fill(it.to_friend, tunnel.traffic->to_friend, tunnel.to_friend_packets_rate, tunnel.to_friend_bytes_rate);
+		fill(it.from_friend, tunnel.traffic->from_friend, tunnel.from_friend_packets_rate, tunnel.from_friend_bytes_rate);
+
+		for (auto [sum, dir] : {std::pair{&total.to_friend, &it.to_friend}, std::pair{&total.from_friend, &it.from_friend}}) {
+			sum->packets += dir->packets;
+			sum->bytes += dir->bytes;
+			sum->fragments += dir->fragments;
+			sum->drops += dir->drops;
+			sum->reassembly_failures += dir->reassembly_failures;
+			sum->packets_rate += dir->packets_rate;
+			sum->bytes_rate += dir->bytes_rate;
+		}
+	}
+
+	const std::lock_guard lock{_traffic_mutex};
+	_traffic_snapshot.swap(snapshot);
+	_traffic_total_snapshot = total;
+}
+
+void ToxExtTunnelUDP2::reassembly_fail_cb(void* user_data, uint32_t friend_number) {
+	auto* self = static_cast<ToxExtTunnelUDP2*>(user_data);
+	if (auto tun_it = self->_tunnels.find(friend_number); tun_it != self->_tunnels.end()) {
+		TrafficCounters::inc(tun_it->second.traffic->from_friend.reassembly_failures);
+	}
+}
+
+void ToxExtTunnelUDP2::tunnel_remove(uint32_t friend_number) {
 	auto& tunnel = _tunnels.at(friend_number);
+	if (tunnel.coalesce_count > 0) {
+		_coalesce_pending--;
+	}
+	if (tunnel.active) {
+		_drr_active.erase(friend_number);
+	}
+	tunnel_queue_clear(tunnel);
+	{ // keep it in the totals
+		const auto& t = *tunnel.traffic;
+		for (auto [dir, counters] : {
+			std::pair{&_traffic_closed.to_friend, &t.to_friend},
+			std::pair{&_traffic_closed.from_friend, &t.from_friend},
+		}) {
+			dir->packets += TrafficCounters::get(counters->packets);
+			dir->bytes += TrafficCounters::get(counters->bytes);
+			dir->fragments += TrafficCounters::get(counters->fragments);
+			dir->drops += TrafficCounters::get(counters->drops);
+			dir->reassembly_failures += TrafficCounters::get(counters->reassembly_failures);
+		}
+	}
+	_reassembler.remove_friend(friend_number);
+	_fec_decoder.remove_friend(friend_number);
+	_tunnels.erase(friend_number);
+}
 
-	if (lossless) {
-		// reassemble
-		bool is_last_frag = data[0] != 0;
+void ToxExtTunnelUDP2::handle_io_results(void) {
+	std::vector<IOResult> results {};
+	{
+		const std::lock_guard lock{_io_commands_mutex};
+		results.swap(_io_results);
+		_io_results_pushed = false;
+	}
+
+	bool io_commands_pushed = false;
+	for (const auto& res : results) {
+		if (res.port == 0) {
+			// no socket, so forget the tunnel and let the next tick open it again
+			if (_tunnels.count(res.friend_number)) {
+				tunnel_remove(res.friend_number);
+			}
+			// in case a newer OPEN made it meanwhile, so both sides agree again
+			const std::lock_guard lock{_io_commands_mutex};
+			_io_commands.push_back({IOCommand::Type::CLOSE, res.friend_number});
+			io_commands_pushed = true;
+			continue;
+		}
+
+		const auto key = friend_public_key_hex(res.friend_number);
+		if (key.empty()) {
+			continue;
+		}
+
+		auto& port = _tunnel_ports[key];
+		if (port != res.port) {
+			port = res.port;
+			ud.tc->state_dirty_save_soon = true;
+		}
+	}
+
+	if (io_commands_pushed) {
+		io_signal();
+	}
+}
+
+std::string ToxExtTunnelUDP2::friend_public_key_hex(uint32_t friend_number) const {
+	const auto public_key = _transport->friend_public_key(friend_number);
+	if (public_key.empty()) {
+		return {};
+	}
+
+	return bin2hex(public_key);
+}
+
+bool ToxExtTunnelUDP2::tunnel_ports_load(const std::string& path) {
+	std::ifstream ifile{path};
+	if (!ifile.is_open()) {
+		return false;
+	}
+
+	_tunnel_ports.clear();
+
+	std::string key;
+	uint32_t port {0};
+	while (ifile >> key >> port) {
+		if (key.size() != TOX_PUBLIC_KEY_SIZE*2 || port == 0 || port > 0xffff) {
+			std::cerr << "WWW invalid tunnel port entry, skipping\n";
+			continue;
+		}
+		_tunnel_ports[key] = port;
+	}
+
+	std::cout << "III loaded " << _tunnel_ports.size() << " tunnel ports from " << path << "\n";
+
+	return true;
+}
+
+bool ToxExtTunnelUDP2::tunnel_ports_save(const std::string& path) const {
+	std::ofstream ofile{path};
+	if (!ofile.is_open()) {
+		std::cerr << "!!! failed to save tunnel ports to " << path << "\n";
+		return false;
+	}
+
+	for (const auto& [key, port] : _tunnel_ports) {
+		ofile << key << " " << port << "\n";
+	}
+
+	return true;
+}
+
+float ToxExtTunnelUDP2::next_tick_in(void) {
+	float min_time = 1.f;
+
+	if (_coalesce_pending > 0) {
+		const auto now = std::chrono::steady_clock::now();
+		for (const auto& [f_id, tunnel] : _tunnels) {
+			if (tunnel.coalesce_count > 0) {
+				min_time = std::min(min_time, std::chrono::duration<float>(tunnel.coalesce_deadline - now).count());
+			}
+		}
+	}
+
+	// wake up once the next queued datagram has its tokens
+	for (size_t i = 0; i < _drr_active.size(); i++) {
+		const auto& tunnel = _tunnels.at(_drr_active[i]);
+		if (!tunnel.sendq.empty()) {
+			continue; // waits for tox, not tokens
+		}
+		const size_t size = tunnel.queue.front()->size;
+		min_time = std::min(min_time, std::max(
+			_rate_limit_global.time_until(size),
+			tunnel.bucket.time_until(size)
+		));
+	}
+
+	if (!_tunnels.empty()) {
+		min_time = std::min(min_time, probe_pass_interval - _probe_timer);
+	}
 
-		// "remove" first byte
-		data++;
-		size--;
+	// tox does not tell us when it has room again
+	if (_sendq_pending > 0) {
+		min_time = std::min(min_time, sendq_retry_interval);
+	}
 
-		tunnel.reasseble_buffer.insert(tunnel.reasseble_buffer.end(), data, data+size);
+#ifdef __linux__
+	// the io thread wakes us through wakeup_fd(), this is only the housekeeping
+	return std::max(min_time, 0.f);
+#else
+	return std::clamp(min_time, 0.f, 0.001f);
+#endif
+}
 
-		if (is_last_frag) {
-			// TODO: error check
-			zed_net_udp_socket_send(&(tunnel.s), outbound_address, tunnel.reasseble_buffer.data(), tunnel.reasseble_buffer.size());
-			std::cout << "III reassebled " << friend_number << " " << tunnel.reasseble_buffer.size() << "\n";
+void ToxExtTunnelUDP2::probe_tunnels(void) {
+	const auto now = std::chrono::steady_clock::now();
+	for (auto& [f_id, tunnel] : _tunnels) {
+		tunnel.link.probe_interval = probe_interval;
 
-			tunnel.reasseble_buffer.clear();
+		uint32_t seq {0};
+		if (tunnel.link.probe_due(now, seq)) {
+			const uint8_t probe[5] {
+				packet_id_probe,
+				uint8_t(seq & 0xff),
+				uint8_t((seq >> 8) & 0xff),
+				uint8_t((seq >> 16) & 0xff),
+				uint8_t((seq >> 24) & 0xff),
+			};
+			send_lossy(f_id, probe, sizeof(probe));
 		}
+
+		// timeouts might have changed the loss
+		update_path(f_id, tunnel);
+	}
+}
+
+void ToxExtTunnelUDP2::update_path(uint32_t friend_number, Tunnel& tunnel) {
+	if (!adaptive_path) {
+		tunnel.small_lossless = false;
+		tunnel.large_lossy = false;
+		return;
+	}
+
+	if (tunnel.link.samples() < 4) {
+		return; // not enough data yet
+	}
+
+	const float loss = tunnel.link.loss();
+
+	if (!tunnel.small_lossless && loss > lossless_loss_enter) {
+		tunnel.small_lossless = true;
+		std::cout << "III link to " << friend_number << " is lossy (" << loss << "), small datagrams go lossless\n";
+	} else if (tunnel.small_lossless && loss < lossless_loss_leave) {
+		tunnel.small_lossless = false;
+		std::cout << "III link to " << friend_number << " recovered (" << loss << "), small datagrams go lossy\n";
+	}
+
+	if (!tunnel.large_lossy && loss < lossy_fragments_loss_max) {
+		tunnel.large_lossy = true;
+		std::cout << "III link to " << friend_number << " is clean (" << loss << "), large datagrams go as lossy fragments\n";
+	} else if (tunnel.large_lossy && loss > lossy_fragments_loss_max * 2.f) {
+		tunnel.large_lossy = false;
+		std::cout << "III link to " << friend_number << " not clean anymore (" << loss << "), large datagrams go lossless\n";
+	}
+}
+
+std::vector<ToxExtTunnelUDP2::LinkStats> ToxExtTunnelUDP2::link_stats(void) const {
+	std::vector<LinkStats> stats {};
+	stats.reserve(_tunnels.size());
+	for (const auto& [f_id, tunnel] : _tunnels) {
+		auto& it = stats.emplace_back();
+		it.friend_number = f_id;
+		it.loss = tunnel.link.loss();
+		it.rtt = tunnel.link.rtt();
+		it.rtt_var = tunnel.link.rtt_var();
+		it.probes_sent = tunnel.link.probes_sent();
+		it.probes_lost = tunnel.link.probes_lost();
+		it.small_lossless = tunnel.small_lossless;
+		it.large_lossy = tunnel.large_lossy;
+		it.fec_redundancy = tunnel.fec_redundancy;
+	}
+	return stats;
+}
+
+int ToxExtTunnelUDP2::wakeup_fd(void) {
+#ifdef __linux__
+	return _tox_wakeup_fd;
+#else
+	return -1;
+#endif
+}
+
+void ToxExtTunnelUDP2::io_signal(void) {
+#ifdef __linux__
+	const uint64_t one = 1;
+	[[maybe_unused]] auto _ = write(_io_wakeup_fd, &one, sizeof(one));
+#endif
+}
+
+void ToxExtTunnelUDP2::tox_signal(void) {
+#ifdef __linux__
+	const uint64_t one = 1;
+	[[maybe_unused]] auto _ = write(_tox_wakeup_fd, &one, sizeof(one));
+#endif
+}
+
+void ToxExtTunnelUDP2::io_thread_fn(void) {
+	while (!_io_thread_stop) {
+		bool pushed = false;
+
+#ifdef __linux__
+		constexpr int events_max = 64;
+		epoll_event events[events_max];
+
+		const int ready_count = epoll_wait(_epoll_fd, events, events_max, -1);
+		if (ready_count < 0 && errno != EINTR) {
+			std::cerr << "!!! epoll_wait failed " << errno << "\n";
+		}
+
+		for (int i = 0; i < ready_count; i++) {
+			const uint32_t f_id = events[i].data.u32;
+			if (f_id == io_wakeup_event_id) {
+				uint64_t tmp;
+				[[maybe_unused]] auto _ = read(_io_wakeup_fd, &tmp, sizeof(tmp));
+				continue; // commands and the ring are always checked
+			}
+
+			if (f_id == io_shared_socket_event_id) {
+				pushed |= io_drain_shared_socket();
+				continue;
+			}
+
+			auto tun_it = _io_tunnels.find(f_id);
+			if (tun_it == _io_tunnels.end() || tun_it->second.paused) {
+				continue; // tunnel got closed or paused
+			}
+
+			pushed |= io_drain_socket(f_id, tun_it->second);
+		}
+#else
+		// no readiness, so poll every tunnel
+		for (auto& [f_id, tun] : _io_tunnels) {
+			if (tun.paused) {
+				continue;
+			}
+			pushed |= io_drain_socket(f_id, tun);
+		}
+		pushed |= io_drain_shared_socket();
+#endif
+
+		if (pushed) {
+			tox_signal();
+		}
+
+		io_handle_commands();
+		io_send_pending();
+
+#ifndef __linux__
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+	}
+
+	// shutting down, close everything
+	for (auto& [f_id, tun] : _io_tunnels) {
+		if (tun.shared_host == 0) {
+			_io_ports.release(tun.port);
+		}
+		tun.s.close();
+	}
+	_io_tunnels.clear();
+
+	_io_shared_socket.close();
+	_io_ports.release(_io_shared_port);
+	_io_shared_port = 0;
+	_io_shared_demux.clear();
+	_io_shared_hosts_free.clear();
+	_io_shared_hosts_next = 0;
+}
+
+void ToxExtTunnelUDP2::io_handle_commands(void) {
+	std::vector<IOCommand> commands {};
+	{
+		const std::lock_guard lock{_io_commands_mutex};
+		if (_io_commands.empty()) {
+			return;
+		}
+		commands.swap(_io_commands);
+	}
+
+	for (const auto& cmd : commands) {
+		const uint32_t f_id = cmd.friend_number;
+
+		if (cmd.type == IOCommand::Type::PAUSE || cmd.type == IOCommand::Type::RESUME) {
+			auto tun_it = _io_tunnels.find(f_id);
+			const bool pause = cmd.type == IOCommand::Type::PAUSE;
+			if (tun_it == _io_tunnels.end() || tun_it->second.paused == pause) {
+				continue;
+			}
+
+			auto& tun = tun_it->second;
+			tun.paused = pause;
+#ifdef __linux__
+			// out of the set entirely, so errors on the socket can not spin us either
+			if (tun.shared_host == 0) {
+				if (pause) {
+					epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, tun.s.handle(), nullptr);
+				} else {
+					epoll_event ev {};
+					ev.events = EPOLLIN;
+					ev.data.u32 = f_id;
+					if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, tun.s.handle(), &ev) != 0) {
+						std::cerr << "!!! failed to add socket to epoll " << f_id << " " << errno << "\n";
+					}
+				}
+			}
+#endif
+			continue;
+		}
+
+		if (cmd.type == IOCommand::Type::CLOSE) {
+			if (!_io_tunnels.count(f_id)) {
+				continue;
+			}
+
+			{ // first stop advertising
+				const std::lock_guard mutex_lock{ud.tc->torrent_db_mutex};
+				ud.tc->torrent_db.peers.erase(f_id);
+				ud.tc->torrent_db.peer_hosts.erase(f_id);
+				ud.tc->torrent_db.friend_peers_changed(f_id);
+			}
+
+			auto& tun = _io_tunnels.at(f_id);
+			if (tun.shared_host != 0) {
+				io_close_shared(tun);
+			} else {
+#ifdef __linux__
+				epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, tun.s.handle(), nullptr);
+#endif
+				tun.s.close();
+				_io_ports.release(tun.port);
+			}
+			std::cout << "III closed tunnel " << f_id << " " << tun.port << "\n";
+			_io_tunnels.erase(f_id);
+		} else if (cmd.type == IOCommand::Type::OPEN) {
+			if (_io_tunnels.count(f_id)) {
+				continue; // already open
+			}
+
+			auto& new_tunnel = _io_tunnels[f_id];
+			new_tunnel.traffic = cmd.traffic;
+
+			if (cmd.port_range_first != _io_ports.first() || cmd.port_range_last != _io_ports.last()) {
+				_io_ports.set_range(cmd.port_range_first, cmd.port_range_last);
+			}
+
+#ifdef TTT_UDP_BATCH
+			if (cmd.shared) {
+				if (!io_open_shared(f_id, new_tunnel, cmd.shared_host_base)) {
+					_io_tunnels.erase(f_id);
+					std::cerr << "!!! failed to open shared tunnel " << f_id << "\n";
+					io_push_result(f_id, 0);
+					continue;
+				}
+
+				std::cout << "III opened shared tunnel " << f_id << " " << host_to_string(new_tunnel.shared_host) << ":" << new_tunnel.port << "\n";
+
+				// notify torrent_db of peer
+				const std::lock_guard mutex_lock{ud.tc->torrent_db_mutex};
+				ud.tc->torrent_db.peers[f_id] = new_tunnel.port;
+				ud.tc->torrent_db.peer_hosts[f_id] = host_to_string(new_tunnel.shared_host);
+				ud.tc->torrent_db.friend_peers_changed(f_id);
+				continue;
+			}
+#else
+			if (cmd.shared) {
+				std::cerr << "WWW shared tunnel socket not supported on this platform, using one socket per friend\n";
+			}
+#endif
+
+			new_tunnel.port = io_bind(new_tunnel.s, cmd.port_preferred);
+			if (new_tunnel.port == 0) {
+				_io_tunnels.erase(f_id);
+				std::cerr << "!!! failed to open socket " << f_id << "\n";
+				io_push_result(f_id, 0);
+				continue;
+			}
+			std::cout << "III opened socket " << f_id << " " << new_tunnel.port << (new_tunnel.port == cmd.port_preferred ? " (same as last time)" : "") << "\n";
+
+			// tox thread remembers it for next time
+			io_push_result(f_id, new_tunnel.port);
+
+#ifdef __linux__
+			epoll_event ev {};
+			ev.events = EPOLLIN; // level triggered
+			ev.data.u32 = f_id;
+			if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, new_tunnel.s.handle(), &ev) != 0) {
+				std::cerr << "!!! failed to add socket to epoll " << f_id << " " << errno << "\n";
+			}
+#endif
+
+			// notify torrent_db of peer
+			const std::lock_guard mutex_lock{ud.tc->torrent_db_mutex};
+			ud.tc->torrent_db.peers[f_id] = new_tunnel.port;
+			ud.tc->torrent_db.friend_peers_changed(f_id);
+		}
+	}
+}
+
+void ToxExtTunnelUDP2::io_push_result(uint32_t friend_number, uint16_t port) {
+	{
+		const std::lock_guard lock{_io_commands_mutex};
+		_io_results.push_back({friend_number, port});
+		_io_results_pushed = true;
+	}
+	tox_signal();
+}
+
+uint16_t ToxExtTunnelUDP2::io_bind(UDPSocket& sock, uint16_t preferred) {
+	// usually the first try, only ports taken by someone else cost another bind
+	for (size_t tries = 0; tries < _io_ports.range_size(); tries++) {
+		const uint16_t port = _io_ports.acquire(tries == 0 ? preferred : 0);
+		if (port == 0) {
+			break; // exhausted
+		}
+
+		if (sock.open(port)) {
+			return port;
+		}
+
+		_io_ports.mark_busy(port);
+	}
+
+	return 0;
+}
+
+bool ToxExtTunnelUDP2::io_open_shared(uint32_t friend_number, IOTunnel& tun, uint32_t host_base) {
+	if (!_io_shared_socket.is_open()) {
+		_io_shared_port = io_bind(_io_shared_socket, 0);
+		if (_io_shared_port == 0) {
+			return false;
+		}
+
+		if (!_io_shared_socket.enable_pktinfo()) {
+			std::cerr << "!!! failed to enable pktinfo on shared socket\n";
+			_io_shared_socket.close();
+			_io_ports.release(_io_shared_port);
+			_io_shared_port = 0;
+			return false;
+		}
+
+#ifdef __linux__
+		epoll_event ev {};
+		ev.events = EPOLLIN; // level triggered
+		ev.data.u32 = io_shared_socket_event_id;
+		if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _io_shared_socket.handle(), &ev) != 0) {
+			std::cerr << "!!! failed to add shared socket to epoll " << errno << "\n";
+		}
+#endif
+
+		std::cout << "III opened shared socket " << _io_shared_port << "\n";
+	}
+
+	uint32_t offset = 0;
+	if (!_io_shared_hosts_free.empty()) {
+		offset = _io_shared_hosts_free.back();
+		_io_shared_hosts_free.pop_back();
+	} else if (_io_shared_hosts_next < shared_hosts_max) {
+		offset = _io_shared_hosts_next++;
+	} else {
+		return false;
+	}
+
+	// the base might have changed since the offset was handed out, so just skip taken ones
+	const uint32_t host = host_add(host_base, offset);
+	if (_io_shared_demux.count(host)) {
+		_io_shared_hosts_free.push_back(offset);
+		return false;
+	}
+
+	_io_shared_demux[host] = friend_number;
+	tun.shared_host = host;
+	tun.shared_offset = offset;
+	tun.port = _io_shared_port;
+
+	return true;
+}
+
+void ToxExtTunnelUDP2::io_close_shared(IOTunnel& tun) {
+	_io_shared_demux.erase(tun.shared_host);
+
+	_io_shared_hosts_free.push_back(tun.shared_offset);
+	tun.shared_host = 0;
+
+	if (_io_shared_demux.empty() && _io_shared_socket.is_open()) {
+#ifdef __linux__
+		epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, _io_shared_socket.handle(), nullptr);
+#endif
+		_io_shared_socket.close();
+		std::cout << "III closed shared socket " << _io_shared_port << "\n";
+		_io_ports.release(_io_shared_port);
+		_io_shared_port = 0;
+		_io_shared_hosts_free.clear();
+		_io_shared_hosts_next = 0;
+	}
+}
+
+bool ToxExtTunnelUDP2::io_drain_shared_socket(void) {
+	if (!_io_shared_socket.is_open()) {
+		return false;
+	}
+
+	struct DrainCtx {
+		ToxExtTunnelUDP2* self;
+		uint64_t drain;
+		size_t burst_max;
+		bool pushed;
+	} ctx {this, ++_io_shared_drains, socket_burst_max.load(std::memory_order_relaxed), false};
+
+	// every friend gets socket_burst_max, but the datagrams are already read
+	// by the time we know whose they are, so over budget means dropped.
+	// the socket is level triggered, the rest comes next wakeup
+	const int ret = _io_shared_socket.receive(
+		[](void* user_data, const zed_net_address_t&, uint32_t local_host, uint8_t* data, size_t size) {
+			auto* c = static_cast<DrainCtx*>(user_data);
+
+			auto demux_it = c->self->_io_shared_demux.find(local_host);
+			if (demux_it == c->self->_io_shared_demux.end()) {
+				std::cerr << "WWW udp on shared socket for unknown host " << host_to_string(local_host) << "\n";
+				return;
+			}
+
+			auto& tun = c->self->_io_tunnels.at(demux_it->second);
+			auto& counters = tun.traffic->to_friend;
+			counters.add(size);
+
+			if (tun.paused) {
+				c->self->paused_drops.fetch_add(1, std::memory_order_relaxed);
+				TrafficCounters::inc(counters.drops);
+				return;
+			}
+
+			if (tun.burst_drain != c->drain) {
+				tun.burst_drain = c->drain;
+				tun.burst_used = 0;
+			}
+			if (tun.burst_used >= c->burst_max) {
+				c->self->burst_drops.fetch_add(1, std::memory_order_relaxed);
+				TrafficCounters::inc(counters.drops);
+				return;
+			}
+			tun.burst_used++;
+
+#ifndef EXT_TUNNEL_UDP_NO_LOG
+			std::cout << "III got udp shared " << demux_it->second << "  " << size << "\n";
+#endif
+
+			Packet* pkg = c->self->_from_udp.alloc();
+			if (pkg == nullptr) {
+				c->self->from_udp_drops.fetch_add(1, std::memory_order_relaxed);
+				TrafficCounters::inc(counters.drops);
+				return;
+			}
+
+			pkg->friend_number = demux_it->second;
+			pkg->buff.size = size;
+			pkg->buff.timestamp_us = monotonic_us();
+			std::memcpy(pkg->buff.data(), data, size);
+			c->self->_from_udp.push();
+			c->pushed = true;
+		},
+		&ctx,
+		ctx.burst_max * std::max<size_t>(1, _io_shared_demux.size())
+	);
+
+	if (ret < 0) {
+		std::cerr << "!!! error receiving on shared socket\n";
+	}
+
+	return ctx.pushed;
+}
+
+bool ToxExtTunnelUDP2::io_drain_socket(uint32_t friend_number, IOTunnel& tun) {
+	struct DrainCtx {
+		ToxExtTunnelUDP2* self;
+		uint32_t friend_number;
+		uint16_t port;
+		TrafficCounters& counters;
+		bool pushed;
+	} ctx {this, friend_number, tun.port, tun.traffic->to_friend, false};
+
+	// level triggered, so whatever is left over gets picked up next wakeup
+	const int ret = tun.s.receive(
+		[](void* user_data, const zed_net_address_t&, uint32_t, uint8_t* data, size_t size) {
+			auto* c = static_cast<DrainCtx*>(user_data);
+#ifndef EXT_TUNNEL_UDP_NO_LOG
+			std::cout << "III got udp " << c->port << "  " << size << "\n";
+#endif
+			// TODO: check addr maches torrent client setting, otherwise ignore
+			c->counters.add(size);
+
+			Packet* pkg = c->self->_from_udp.alloc();
+			if (pkg == nullptr) {
+				c->self->from_udp_drops.fetch_add(1, std::memory_order_relaxed);
+				TrafficCounters::inc(c->counters.drops);
+				return;
+			}
+
+			pkg->friend_number = c->friend_number;
+			pkg->buff.size = size;
+			pkg->buff.timestamp_us = monotonic_us();
+			std::memcpy(pkg->buff.data(), data, size);
+			c->self->_from_udp.push();
+			c->pushed = true;
+		},
+		&ctx,
+		socket_burst_max.load(std::memory_order_relaxed)
+	);
+
+	if (ret < 0) {
+		std::cerr << "!!! error receiving on socket\n";
+	}
+
+	return ctx.pushed;
+}
+
+void ToxExtTunnelUDP2::io_send_pending(void) {
+	while (Packet* pkg = _to_udp.front()) {
+		auto tun_it = _io_tunnels.find(pkg->friend_number);
+		if (tun_it != _io_tunnels.end()) {
+			auto& tun = tun_it->second;
+			// shared tunnels have to answer from the address the torrent client knows them by
+			const bool ok = tun.shared_host != 0
+				? _io_shared_socket.send_from(tun.shared_host, pkg->addr, pkg->buff.data(), pkg->buff.size)
+				: tun.s.send(pkg->addr, pkg->buff.data(), pkg->buff.size)
+			;
+			if (!ok) {
+				std::cerr << "!!! error sending " << pkg->friend_number << "\n";
+			} else {
+				_io_latency_pending.push_back({pkg->buff.timestamp_us, pkg->lossless});
+			}
+		}
+		_to_udp.pop();
+	}
+
+	for (auto& [f_id, tun] : _io_tunnels) {
+		if (tun.s.has_pending()) {
+			tun.s.flush();
+		}
+	}
+	if (_io_shared_socket.has_pending()) {
+		_io_shared_socket.flush();
+	}
+
+	// only now it really left
+	if (!_io_latency_pending.empty()) {
+		const uint64_t now = monotonic_us();
+		for (const auto& [timestamp_us, lossless] : _io_latency_pending) {
+			_latency_from_friend[lossless].record(now - timestamp_us);
+		}
+		_io_latency_pending.clear();
+	}
+}
+
+void ToxExtTunnelUDP2::forward_datagram(uint32_t friend_number, PacketBuffer& pkg) {
+	const size_t single_pkg_size_max = TOX_MAX_CUSTOM_PACKET_SIZE-1;
+
+	auto& tunnel = _tunnels.at(friend_number);
+
+	if (coalesce && !tunnel.small_lossless && pkg.size <= coalesce_size_max && 1 + 2 + pkg.size <= TOX_MAX_CUSTOM_PACKET_SIZE) {
+		if (tunnel.coalesce_buffer.empty()) {
+			tunnel.coalesce_buffer.reserve(TOX_MAX_CUSTOM_PACKET_SIZE);
+		}
+
+		if (tunnel.coalesce_count > 0 && tunnel.coalesce_buffer.size() + 2 + pkg.size > TOX_MAX_CUSTOM_PACKET_SIZE) {
+			coalesce_flush(friend_number, tunnel);
+		}
+
+		if (tunnel.coalesce_count == 0) {
+			tunnel.coalesce_buffer.clear();
+			tunnel.coalesce_buffer.push_back(packet_id_coalesced);
+			tunnel.coalesce_deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(coalesce_delay));
+			_coalesce_pending++;
+		}
+
+		tunnel.coalesce_buffer.push_back(pkg.size & 0xff);
+		tunnel.coalesce_buffer.push_back((pkg.size >> 8) & 0xff);
+		tunnel.coalesce_buffer.insert(tunnel.coalesce_buffer.end(), pkg.data(), pkg.data() + pkg.size);
+		tunnel.coalesce_count++;
+		tunnel.coalesce_timestamps.push_back(pkg.timestamp_us);
+
+		return;
+	}
+
+	// keep the order
+	if (tunnel.coalesce_count > 0) {
+		coalesce_flush(friend_number, tunnel);
+	}
+
+	if (pkg.size <= single_pkg_size_max && !tunnel.small_lossless) {
+		uint8_t* buff = pkg.data()-1;
+		buff[0] = packet_id; // TODO: tox_lossy_pkg_id
+
+		// debug !!!
+#if 0
+		std::cout << ">>> got udp " << std::hex;
+		for (size_t i = 0; i < pkg.size; i++) {
+			std::cout << (int)pkg.data()[i] << " ";
+		}
+		std::cout << std::dec << "\n";
+#endif
+
+		tunnel_send(friend_number, tunnel, buff, pkg.size+1, false);
+		latency_done(tunnel, false, pkg.timestamp_us);
+	} else if (pkg.size > single_pkg_size_max && tunnel.fec_redundancy > 0.f) {
+		// explicitly asked for, so it wins over the measured path
+		send_fec_fragments(friend_number, tunnel, pkg);
+		latency_done(tunnel, false, pkg.timestamp_us);
+	} else if (pkg.size > single_pkg_size_max && tunnel.large_lossy) {
+		send_lossy_fragments(friend_number, tunnel, pkg);
+		latency_done(tunnel, false, pkg.timestamp_us);
+	} else {
+		send_lossless(friend_number, tunnel, pkg);
+		latency_done(tunnel, true, pkg.timestamp_us);
+	}
+}
+
+void ToxExtTunnelUDP2::latency_done(Tunnel& tunnel, bool lossless, uint64_t timestamp_us) {
+	if (tunnel.sendq.empty()) {
+		_latency_to_friend[lossless].record(monotonic_us() - timestamp_us);
+	} else if (tunnel.sendq.back().timestamp_us == 0) {
+		// recorded in sendq_flush(). if several finish with the same
+		// packet (coalesced), only the oldest one is kept
+		tunnel.sendq.back().timestamp_us = timestamp_us;
+	}
+}
+
+void ToxExtTunnelUDP2::latency_reset(void) {
+	for (auto& it : _latency_to_friend) {
+		it.reset();
+	}
+	for (auto& it : _latency_from_friend) {
+		it.reset();
+	}
+}
+
+void ToxExtTunnelUDP2::send_lossless(uint32_t friend_number, Tunnel& tunnel, PacketBuffer& pkg) {
+	const size_t frag_size_max = TOXEXT_MAX_SEGMENT_SIZE - FragmentHeader::size;
+
+	FragmentHeader hdr {};
+	hdr.datagram_id = tunnel.next_datagram_id++;
+	hdr.count = (pkg.size + frag_size_max - 1) / frag_size_max;
+	if (hdr.count > FragmentHeader::count_max) {
+		std::cerr << "!!! datagram too large to fragment " << friend_number << " " << pkg.size << "\n";
+		TrafficCounters::inc(tunnel.traffic->to_friend.drops);
+		return;
+	}
+	TrafficCounters::inc(tunnel.traffic->to_friend.fragments, hdr.count);
+
+	for (size_t offset = 0; offset < pkg.size; offset += frag_size_max, hdr.index++) {
+		const size_t frag_size = std::min(frag_size_max, pkg.size - offset);
+
+		// the header in front either lands in the headroom, or on the
+		// tail of the previous fragment, which was already sent or copied
+		uint8_t* frag_buff = pkg.data() + offset - FragmentHeader::size;
+		hdr.write(frag_buff);
+
+		// one segment at a time, so a busy tox only keeps the rest
+		tunnel_send(friend_number, tunnel, frag_buff, frag_size + FragmentHeader::size, true);
+	}
+}
+
+void ToxExtTunnelUDP2::send_lossy_fragments(uint32_t friend_number, Tunnel& tunnel, PacketBuffer& pkg) {
+	FragmentHeader hdr {};
+	hdr.datagram_id = tunnel.next_datagram_id++;
+	hdr.count = (pkg.size + lossy_frag_size_max - 1) / lossy_frag_size_max;
+	if (hdr.count > FragmentHeader::count_max) {
+		std::cerr << "!!! datagram too large to fragment " << friend_number << " " << pkg.size << "\n";
+		TrafficCounters::inc(tunnel.traffic->to_friend.drops);
+		return;
+	}
+	TrafficCounters::inc(tunnel.traffic->to_friend.fragments, hdr.count);
+
+	for (size_t offset = 0; offset < pkg.size; offset += lossy_frag_size_max, hdr.index++) {
+		const size_t frag_size = std::min(lossy_frag_size_max, pkg.size - offset);
+
+		// same trick as for lossless, tox copies on send
+		uint8_t* frag_buff = pkg.data() + offset - FragmentHeader::size - 1;
+		frag_buff[0] = packet_id_fragment;
+		hdr.write(frag_buff + 1);
+
+		tunnel_send(friend_number, tunnel, frag_buff, frag_size + FragmentHeader::size + 1, false);
+	}
+}
+
+void ToxExtTunnelUDP2::send_fec_fragments(uint32_t friend_number, Tunnel& tunnel, PacketBuffer& pkg) {
+	FecHeader hdr {};
+	hdr.datagram_id = tunnel.next_datagram_id++;
+	hdr.datagram_size = pkg.size;
+	hdr.k = (pkg.size + fec_frag_size_max - 1) / fec_frag_size_max;
+	if (hdr.k > FecHeader::k_max) {
+		std::cerr << "!!! datagram too large to fragment " << friend_number << " " << pkg.size << "\n";
+		TrafficCounters::inc(tunnel.traffic->to_friend.drops);
+		return;
+	}
+	// clamp while still a float, so the size_t conversion is always in range
+	hdr.r = std::clamp(std::ceil(hdr.k * tunnel.fec_redundancy), 1.f, float(hdr.k));
+	TrafficCounters::inc(tunnel.traffic->to_friend.fragments, hdr.k + hdr.r);
+
+	// fragments are evened out, so the parity does not carry much padding
+	const size_t frag_size = hdr.frag_size();
+
+	// parity first, the data fragment headers overwrite the datagram
+	PacketBuffer* parity = _pool.acquire();
+	for (size_t j = 0; j < hdr.r; j++) {
+		fec_encode(pkg.data(), hdr, j, parity->data() + j * frag_size);
+	}
+
+	for (size_t i = 0; i < hdr.k; i++) {
+		const size_t offset = i * frag_size;
+		const size_t size = std::min(frag_size, pkg.size - offset);
+
+		hdr.index = i;
+		uint8_t* frag_buff = pkg.data() + offset - FecHeader::size - 1;
+		frag_buff[0] = packet_id_fec;
+		hdr.write(frag_buff + 1);
+
+		tunnel_send(friend_number, tunnel, frag_buff, size + FecHeader::size + 1, false);
+	}
+
+	for (size_t j = 0; j < hdr.r; j++) {
+		hdr.index = hdr.k + j;
+		uint8_t* frag_buff = parity->data() + j * frag_size - FecHeader::size - 1;
+		frag_buff[0] = packet_id_fec;
+		hdr.write(frag_buff + 1);
+
+		tunnel_send(friend_number, tunnel, frag_buff, frag_size + FecHeader::size + 1, false);
+	}
+
+	_pool.release(parity);
+}
+
+bool ToxExtTunnelUDP2::send_lossy(uint32_t friend_number, const uint8_t* data, size_t size) {
+	// retrying only helps with a full sendq, the transport logs the rest
+	return _transport->send_lossy(friend_number, data, size) != Transport::SendResult::SENDQ;
+}
+
+bool ToxExtTunnelUDP2::send_segment(uint32_t friend_number, const uint8_t* data, size_t size) {
+	return _transport->send_segment(friend_number, data, size);
+}
+
+void ToxExtTunnelUDP2::tunnel_send(uint32_t friend_number, Tunnel& tunnel, const uint8_t* data, size_t size, bool lossless) {
+	if (tunnel.sendq.empty()) {
+		if (lossless ? send_segment(friend_number, data, size) : send_lossy(friend_number, data, size)) {
+			return;
+		}
+		sendq_full++;
+		_sendq_pending++;
+	} else if (tunnel.sendq.full()) {
+		// can not happen, see sendq_capacity
+		std::cerr << "!!! sendq full, dropping " << friend_number << "\n";
+		TrafficCounters::inc(tunnel.traffic->to_friend.drops);
+		return;
+	}
+
+	// keep a copy, data gets overwritten by the next fragment header
+	PacketBuffer* buff = _pool.acquire();
+	buff->size = size;
+	std::memcpy(buff->data(), data, size);
+	tunnel.sendq.push_back({buff, lossless});
+}
+
+bool ToxExtTunnelUDP2::sendq_flush(uint32_t friend_number, Tunnel& tunnel) {
+	while (!tunnel.sendq.empty()) {
+		const auto& it = tunnel.sendq.front();
+		const bool sent = it.lossless
+			? send_segment(friend_number, it.buff->data(), it.buff->size)
+			: send_lossy(friend_number, it.buff->data(), it.buff->size)
+		;
+		if (!sent) {
+			return false;
+		}
+
+		if (it.timestamp_us != 0) {
+			_latency_to_friend[it.lossless].record(monotonic_us() - it.timestamp_us);
+		}
+
+		sendq_retries++;
+		_pool.release(it.buff);
+		tunnel.sendq.pop_front();
+	}
+
+	_sendq_pending--;
+	return true;
+}
+
+void ToxExtTunnelUDP2::coalesce_flush(uint32_t friend_number, Tunnel& tunnel) {
+	if (tunnel.coalesce_count == 0) {
+		return;
+	}
+
+	if (tunnel.coalesce_count == 1) {
+		// not worth the size prefix, send as a normal packet
+		uint8_t* buff = tunnel.coalesce_buffer.data() + 2;
+		buff[0] = packet_id;
+		tunnel_send(friend_number, tunnel, buff, tunnel.coalesce_buffer.size() - 2, false);
+	} else {
+		tunnel_send(friend_number, tunnel, tunnel.coalesce_buffer.data(), tunnel.coalesce_buffer.size(), false);
+	}
+
+	for (const uint64_t timestamp_us : tunnel.coalesce_timestamps) {
+		latency_done(tunnel, false, timestamp_us);
+	}
+	tunnel.coalesce_timestamps.clear();
+
+	tunnel.coalesce_buffer.clear();
+	tunnel.coalesce_count = 0;
+	_coalesce_pending--;
+}
+
+void ToxExtTunnelUDP2::push_to_udp(uint32_t friend_number, const uint8_t* data, size_t size, bool lossless, uint64_t timestamp_us) {
+	// callers checked tunnel_usable()
+	auto& counters = _tunnels.at(friend_number).traffic->from_friend;
+	counters.add(size);
+
+	if (size == 0 || size >= UDPSocket::datagram_size_max) {
+		std::cerr << "!!! datagram has invalid size " << friend_number << " " << size << "\n";
+		TrafficCounters::inc(counters.drops);
+		return;
+	}
+
+	Packet* pkg = _to_udp.alloc();
+	if (pkg == nullptr) {
+		to_udp_drops.fetch_add(1, std::memory_order_relaxed);
+		TrafficCounters::inc(counters.drops);
+		return;
+	}
+
+	pkg->friend_number = friend_number;
+	pkg->addr = outbound_address;
+	pkg->lossless = lossless;
+	pkg->buff.size = size;
+	pkg->buff.timestamp_us = timestamp_us;
+	std::memcpy(pkg->buff.data(), data, size);
+	_to_udp.push();
+
+	// io thread gets woken at the end of the tick
+	_to_udp_pushed = true;
+}
+
+void ToxExtTunnelUDP2::friend_lossy_pkg_cb(uint32_t friend_number, const uint8_t* data, size_t size) {
+	if (size < 2) {
+		std::cerr << "!!! packet too small\n";
+		return;
+	}
+
+	if (data[0] == packet_id) {
+		friend_custom_pkg_cb(friend_number, data+1, size-1, false);
+	} else if (data[0] == packet_id_fragment) {
+		if (size < 1 + FragmentHeader::size + 1) {
+			std::cerr << "!!! packet too small\n";
+			return;
+		}
+		if (!tunnel_usable(friend_number)) {
+			return;
+		}
+		handle_fragment(friend_number, data+1, size-1, lossy_frag_size_max, false);
+	} else if (data[0] == packet_id_fec) {
+		if (size < 1 + FecHeader::size + 1) {
+			std::cerr << "!!! packet too small\n";
+			return;
+		}
+		if (!tunnel_usable(friend_number)) {
+			return;
+		}
+		handle_fec_fragment(friend_number, data+1, size-1);
+	} else if (data[0] == packet_id_probe || data[0] == packet_id_echo) {
+		if (size != 5 || !tunnel_usable(friend_number)) {
+			return;
+		}
+
+		if (data[0] == packet_id_probe) {
+			uint8_t echo[5];
+			std::memcpy(echo, data, sizeof(echo));
+			echo[0] = packet_id_echo;
+			send_lossy(friend_number, echo, sizeof(echo));
+		} else {
+			const uint32_t seq = data[1] | (data[2] << 8) | (data[3] << 16) | (uint32_t(data[4]) << 24);
+			auto& tunnel = _tunnels.at(friend_number);
+			tunnel.link.on_echo(seq, std::chrono::steady_clock::now());
+			update_path(friend_number, tunnel);
+		}
+	} else if (data[0] == packet_id_coalesced) {
+		// split again
+		size_t offset = 1;
+		while (offset + 2 <= size) {
+			const size_t dg_size = data[offset] | (size_t(data[offset+1]) << 8);
+			offset += 2;
+
+			if (dg_size == 0 || offset + dg_size > size) {
+				std::cerr << "!!! malformed coalesced packet " << friend_number << "\n";
+				return;
+			}
+
+			friend_custom_pkg_cb(friend_number, data + offset, dg_size, false);
+			offset += dg_size;
+		}
+	} else {
+		std::cerr << "!!! packet id mismatch\n";
+	}
+}
+
+bool ToxExtTunnelUDP2::tunnel_usable(uint32_t friend_number) const {
+	if (!friend_compatible.count(friend_number) || !friend_compatible.at(friend_number)) {
+		std::cerr << "WWW packet from incompatible friend " << friend_number << "\n";
+		return false;
+	}
+
+	if (!_tunnels.count(friend_number)) {
+		std::cerr << "!!! packet, but no tunnel yet " << friend_number << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+void ToxExtTunnelUDP2::handle_fragment(uint32_t friend_number, const uint8_t* data, size_t size, size_t frag_size_max, bool lossless) {
+	FragmentHeader hdr {};
+	if (!hdr.read(data, size)) {
+		std::cerr << "!!! invalid fragment header " << friend_number << "\n";
+		return;
+	}
+	TrafficCounters::inc(_tunnels.at(friend_number).traffic->from_friend.fragments);
+
+	PacketBuffer* datagram = _reassembler.add(
+		friend_number, hdr,
+		frag_size_max,
+		data + FragmentHeader::size, size - FragmentHeader::size
+	);
+
+	if (datagram != nullptr) {
+		push_to_udp(friend_number, datagram->data(), datagram->size, lossless, monotonic_us());
+#ifndef EXT_TUNNEL_UDP_NO_LOG
+		std::cout << "III reassebled " << friend_number << " " << datagram->size << "\n";
+#endif
+
+		_reassembler.release(datagram);
+	}
+}
+
+void ToxExtTunnelUDP2::handle_fec_fragment(uint32_t friend_number, const uint8_t* data, size_t size) {
+	FecHeader hdr {};
+	if (!hdr.read(data, size)) {
+		std::cerr << "!!! invalid fec header " << friend_number << "\n";
+		return;
+	}
+	TrafficCounters::inc(_tunnels.at(friend_number).traffic->from_friend.fragments);
+
+	PacketBuffer* datagram = _fec_decoder.add(
+		friend_number, hdr,
+		data + FecHeader::size, size - FecHeader::size
+	);
+
+	if (datagram != nullptr) {
+		push_to_udp(friend_number, datagram->data(), datagram->size, false, monotonic_us());
+		_fec_decoder.release(datagram);
+	}
+}
+
+void ToxExtTunnelUDP2::friend_custom_pkg_cb(uint32_t friend_number, const uint8_t* data, size_t size, bool lossless) {
+#ifndef EXT_TUNNEL_UDP_NO_LOG
+	std::cout << "<<< friend_custom_pkg_cb " << friend_number << " " << lossless << " " << size << "\n";
+#endif
+	if (size < 1 + (lossless ? FragmentHeader::size : 0)) {
+		std::cerr << "!!! packet too small\n";
+		return;
+	}
+
+	if (!tunnel_usable(friend_number)) {
+		return;
+	}
+
+	if (lossless) {
+		handle_fragment(friend_number, data, size, TOXEXT_MAX_SEGMENT_SIZE - FragmentHeader::size, true);
 	} else {
-		// TODO: error check
-		zed_net_udp_socket_send(&(tunnel.s), outbound_address, data, size);
+		push_to_udp(friend_number, data, size, false, monotonic_us());
 	}
 }
 
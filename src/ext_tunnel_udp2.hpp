@@ -1,11 +1,31 @@
 #pragma once
 
 #include "./ext.hpp"
+#include "./transport.hpp"
+#include "./udp_socket.hpp"
+#include "./packet_pool.hpp"
+#include "./reassembly.hpp"
+#include "./fec.hpp"
+#include "./port_allocator.hpp"
+#include "./token_bucket.hpp"
+#include "./link_monitor.hpp"
+#include "./spsc_ring.hpp"
+#include "./ring_buffer.hpp"
+#include "./traffic_stats.hpp"
+#include "./latency_histogram.hpp"
 
 #include <vector>
+#include <string>
 #include <zed_net.h>
 
 #include <map>
+#include <memory>
+#include <array>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 namespace ttt {
 	struct ToxClient;
@@ -15,18 +35,42 @@ namespace ttt::ext {
 
 // this extention does not actually use the toxext protocol, only for negotiation
 // after comp check, it just uses lossy directly
+//
+// the udp side runs on its own io thread, which exchanges packets with the
+// tox thread through 2 spsc rings. so tox work never stalls the sockets.
 class ToxExtTunnelUDP2 : public ToxClientExtension {
 	public:
-		static const uint8_t packet_id = 200u;
+		constexpr static uint8_t packet_id = 200u;
+		// multiple small datagrams in one lossy packet, [id] ([size (2, le)] [data])*
+		constexpr static uint8_t packet_id_coalesced = 201u;
+		// link measurement, [id] [seq (4, le)], echo gets sent back right away
+		constexpr static uint8_t packet_id_probe = 202u;
+		constexpr static uint8_t packet_id_echo = 203u;
+		// part of a large datagram, [id] [FragmentHeader] [data]
+		constexpr static uint8_t packet_id_fragment = 204u;
+		// data or parity of a large datagram, [id] [FecHeader] [data]
+		constexpr static uint8_t packet_id_fec = 205u;
+
+		// slots per ring direction
+		constexpr static size_t ring_size = 512;
 
 		ToxExtTunnelUDP2(void) = default;
+		~ToxExtTunnelUDP2(void);
 
 		void register_ext(ToxExt* toxext) override;
 		void deregister_ext(ToxExt* toxext) override;
+		// instead of register_ext, runs on transport instead of tox (eg. MemoryTransport).
+		// nothing gets negotiated, set friend_compatible. transport has to outlive this
+		void register_transport(ToxClient* tc, Transport* transport);
 
-		// creates and destroys tunnels
-		void tick(void) override;
+		// creates and destroys tunnels, forwards what the io thread read
+		void tick(float time_delta) override;
+		float next_tick_in(void) override;
+		int wakeup_fd(void) override;
 
+		// lossy custom packet, including the packet id
+		void friend_lossy_pkg_cb(uint32_t friend_number, const uint8_t* data, size_t size);
+		// a single datagram
 		void friend_custom_pkg_cb(uint32_t friend_number, const uint8_t* data, size_t size, bool lossless);
 
 	public: // tox_client "interface"
@@ -37,6 +81,153 @@ class ToxExtTunnelUDP2 : public ToxClientExtension {
 		// TODO: hide behind api
 		zed_net_address_t outbound_address {};
 
+		// all tunnels share one local socket instead of one socket per friend.
+		// every friend gets its own local address (shared_host_base + n, the
+		// whole 127/8 is loopback on linux), which is what the torrent client
+		// talks to and how the traffic is told apart.
+		// there is only one kernel buffer, so a busy friend can not be left in it:
+		// paused tunnels and reads over a friends socket_burst_max per wakeup get
+		// dropped (paused_drops, burst_drops), where an own socket would just
+		// stop being read and push back on the torrent client.
+		// only applies to tunnels opened after changing it. linux only
+		bool shared_socket {false};
+		uint32_t shared_host_base {0x0100017f}; // 127.1.0.1, network order
+
+		// pack small datagrams (eg. utp acks) into one lossy packet, to save on
+		// per packet overhead. trades up to coalesce_delay seconds of latency
+		bool coalesce {false};
+		size_t coalesce_size_max {256}; // datagrams larger than this go out alone
+		float coalesce_delay {0.002f};
+
+		// udp -> tox bandwidth limits, in bytes per second (0 is unlimited).
+		// tunnels with queued datagrams are served deficit round robin,
+		// so a single busy friend can not starve the others
+		void rate_limit_set(float bytes_per_second);
+		float rate_limit_get(void) const { return _rate_limit_global.rate; }
+		// default for every friend, without override
+		void friend_rate_limit_set(float bytes_per_second);
+		float friend_rate_limit_get(void) const { return _friend_rate_limit_default; }
+		// override for one friend by public key (hex), < 0 removes the override
+		void friend_rate_limit_set(const std::string& public_key_hex, float bytes_per_second);
+		float friend_rate_limit_get(const std::string& public_key_hex) const;
+
+		// datagrams waiting for tokens (or for tox), per tunnel. more get dropped
+		size_t queue_packets_max {256};
+		// bytes a tunnel may send per round
+		size_t drr_quantum {1500};
+		uint64_t queue_drops {0};
+
+		// tox not taking a packet (sendq full) keeps it for a retry instead of
+		// dropping it, the tunnel waits until it went out. a tunnel with half its
+		// queue used stops reading its udp socket, until it is down to a quarter.
+		// so the torrent client sees the kernel buffer fill up, not a loss cascade
+		float sendq_retry_interval {0.005f}; // seconds
+		uint64_t sendq_full {0}; // times tox did not take a packet
+		uint64_t sendq_retries {0}; // kept packets that went out later
+		uint64_t pauses {0};
+		// shared tunnels can not be paused, so the io thread drops for them instead
+		std::atomic<uint64_t> paused_drops {0};
+		// shared tunnels over their socket_burst_max in one wakeup
+		std::atomic<uint64_t> burst_drops {0};
+
+		struct QueueStats {
+			uint32_t friend_number {};
+			size_t queued {0}; // datagrams
+			size_t unsent {0}; // packets tox did not take yet
+			bool paused {false};
+		};
+		std::vector<QueueStats> queue_stats(void) const;
+
+		// choose lossy/lossless per friend from the measured link (LinkMonitor).
+		// small datagrams go lossless when the link gets bad and large ones
+		// go as lossy fragments when the link is clean, otherwise toxext (lossless)
+		bool adaptive_path {true};
+		float lossless_loss_enter {0.15f};
+		float lossless_loss_leave {0.05f}; // hysteresis
+		float lossy_fragments_loss_max {0.01f};
+		float probe_interval {1.f}; // seconds, per friend
+
+		// forward error correction for large datagrams. with redundancy > 0 they
+		// go as lossy fragments plus ceil(fragments * redundancy) parity fragments,
+		// so the other side can rebuild lost ones without a retransmit.
+		// redundancy is parity per data fragment, 0 is off (default), max 1
+		void fec_redundancy_set(float redundancy);
+		float fec_redundancy_get(void) const { return _fec_redundancy_default; }
+		// override for one friend by public key (hex), < 0 removes the override
+		void fec_redundancy_set(const std::string& public_key_hex, float redundancy);
+		float fec_redundancy_get(const std::string& public_key_hex) const;
+
+		struct LinkStats {
+			uint32_t friend_number {};
+			float loss {0.f}; // one way estimate
+			float rtt {0.f}; // seconds
+			float rtt_var {0.f};
+			uint64_t probes_sent {0};
+			uint64_t probes_lost {0};
+			bool small_lossless {false};
+			bool large_lossy {false};
+			float fec_redundancy {0.f};
+		};
+		std::vector<LinkStats> link_stats(void) const;
+
+		// local ports for tunnels, inclusive. applies to tunnels opened after changing it
+		uint16_t port_range_first {20000};
+		uint16_t port_range_last {60000};
+
+		// friend public key -> port, so a friend keeps its port across reconnects and restarts.
+		// one "<pubkey hex> <port>" per line
+		bool tunnel_ports_load(const std::string& path);
+		bool tunnel_ports_save(const std::string& path) const;
+
+		// max datagrams read from a single tunnel socket per wakeup,
+		// so a busy tunnel can not starve the others. the io thread reads it
+		std::atomic<size_t> socket_burst_max {64};
+
+		// packets dropped, because the ring to the other thread was full
+		std::atomic<uint64_t> from_udp_drops {0}; // udp -> tox
+		std::atomic<uint64_t> to_udp_drops {0}; // tox -> udp
+
+		// what went through the tunnels, per direction. counted with relaxed
+		// atomics on the way, rates get smoothed every traffic_interval
+		struct TrafficStats {
+			struct Direction {
+				uint64_t packets {0}; // datagrams
+				uint64_t bytes {0};
+				uint64_t fragments {0};
+				uint64_t drops {0};
+				uint64_t reassembly_failures {0};
+				float packets_rate {0.f}; // per second
+				float bytes_rate {0.f};
+			};
+			uint32_t friend_number {};
+			Direction to_friend {}; // udp -> tox
+			Direction from_friend {}; // tox -> udp
+		};
+		float traffic_interval {1.f}; // seconds
+		// at most traffic_interval old, safe to call from any thread
+		std::vector<TrafficStats> traffic_stats(void) const;
+		// all tunnels since start, including closed ones (no friend_number)
+		TrafficStats traffic_total(void) const;
+
+		// time datagrams spend in here. to friends from the socket read until tox
+		// took the (last) packet, from friends from the tox packet (completing it)
+		// until the socket send. split by the kind of tox packet that carried it
+		enum class LatencyPath : uint8_t {
+			LOSSY = 0, // single, coalesced, lossy fragments and fec
+			LOSSLESS = 1, // toxext
+		};
+		const LatencyHistogram& latency_to_friend(LatencyPath path) const { return _latency_to_friend[size_t(path)]; }
+		const LatencyHistogram& latency_from_friend(LatencyPath path) const { return _latency_from_friend[size_t(path)]; }
+		void latency_reset(void);
+
+		// heap allocations done by the reassembly pool, constant in steady state
+		uint64_t pool_allocations(void) const { return _pool.allocations(); }
+		size_t pool_in_use(void) const { return _pool.in_use(); }
+
+		// limits and stats for putting large datagrams back together
+		Reassembler& reassembler(void) { return _reassembler; }
+		FecDecoder& fec_decoder(void) { return _fec_decoder; }
+
 	// TODO: friend or static?
 	public: // internal for callbacks
 		struct UserData {
@@ -44,14 +235,233 @@ class ToxExtTunnelUDP2 : public ToxClientExtension {
 			ToxExtTunnelUDP2* tetu;
 		} ud{};
 
-	private: // tunnel data
+	private: // ring data
+		struct Packet {
+			uint32_t friend_number {};
+			zed_net_address_t addr {}; // destination, only used tox -> udp
+			bool lossless {false}; // only used tox -> udp, for latency stats
+			PacketBuffer buff;
+		};
+
+		SPSCRing<Packet> _from_udp {ring_size};
+		SPSCRing<Packet> _to_udp {ring_size};
+		bool _to_udp_pushed {false}; // io thread gets woken once per tick
+
+	private: // tox thread tunnel data
+		// shared with the io thread, which counts what it read and dropped
+		struct TunnelTraffic {
+			TrafficCounters to_friend {};
+			TrafficCounters from_friend {};
+		};
+
 		struct Tunnel {
-			zed_net_socket_t s;
-			uint16_t port {}; // in host
-			std::vector<uint8_t> reasseble_buffer {};
+			uint16_t next_datagram_id {0};
+
+			std::shared_ptr<TunnelTraffic> traffic {std::make_shared<TunnelTraffic>()};
+			RateEstimate to_friend_packets_rate {};
+			RateEstimate to_friend_bytes_rate {};
+			RateEstimate from_friend_packets_rate {};
+			RateEstimate from_friend_bytes_rate {};
+
+			// small datagrams waiting to go out together, already in wire format
+			std::vector<uint8_t> coalesce_buffer {};
+			size_t coalesce_count {0};
+			std::vector<uint64_t> coalesce_timestamps {}; // for latency stats
+			std::chrono::steady_clock::time_point coalesce_deadline {};
+
+			// rate limiting and scheduling, see schedule()
+			TokenBucket bucket {};
+			RingBuffer<PacketBuffer*> queue {}; // from _pool, queue_packets_max when opened
+			size_t deficit {0};
+			bool active {false}; // in _drr_active
+
+			// wire packets tox did not take, in order. only the rest of one datagram
+			// (plus a coalesced packet), the next one is not sent before this is empty
+			struct Unsent {
+				PacketBuffer* buff; // from _pool
+				bool lossless;
+				uint64_t timestamp_us {0}; // a datagram is done once this went out, 0 for none
+			};
+			RingBuffer<Unsent> sendq {}; // sendq_capacity
+			bool paused {false}; // socket not read, see queue_stats()
+
+			// path selection, see update_path()
+			LinkMonitor link {};
+			bool small_lossless {false};
+			bool large_lossy {false};
+			float fec_redundancy {0.f}; // cached, see fec_redundancy_for()
 		};
 
 		std::map<uint32_t, Tunnel> _tunnels {};
+
+		TokenBucket _rate_limit_global {};
+		float _friend_rate_limit_default {0.f};
+		std::map<std::string, float> _friend_rate_limits {}; // public key (hex) -> rate
+		float friend_rate_limit_for(uint32_t friend_number) const;
+
+		float _fec_redundancy_default {0.f};
+		std::map<std::string, float> _fec_redundancies {}; // public key (hex) -> redundancy
+		float fec_redundancy_for(uint32_t friend_number) const;
+
+		// tunnels with queued datagrams, in round robin order. room for every tunnel
+		RingBuffer<uint32_t> _drr_active {};
+		std::chrono::steady_clock::time_point _tick_now {};
+		// queue or send right away if nothing limits it
+		void enqueue_datagram(uint32_t friend_number, Tunnel& tunnel, PacketBuffer& pkg);
+		// sends queued datagrams as far as the buckets allow
+		void schedule(void);
+		void tunnel_queue_clear(Tunnel& tunnel);
+		// everything the tox thread knows about the tunnel, the io side is up to the caller
+		void tunnel_remove(uint32_t friend_number);
+		// tells the io thread to (not) read the socket of the tunnel
+		void tunnel_pause(uint32_t friend_number, Tunnel& tunnel, bool pause);
+
+		size_t _sendq_pending {0}; // tunnels with something in sendq
+		// sends or keeps for later, once something is kept everything after is too
+		void tunnel_send(uint32_t friend_number, Tunnel& tunnel, const uint8_t* data, size_t size, bool lossless);
+		// returns true if the sendq is empty afterwards
+		bool sendq_flush(uint32_t friend_number, Tunnel& tunnel);
+
+		// tox, or whatever was passed to register_transport
+		Transport* _transport {nullptr};
+		std::unique_ptr<Transport> _tox_transport {};
+		// everything register_ext does, besides toxext
+		void setup(void);
+
+		// public key (hex) -> last port, persisted
+		std::map<std::string, uint16_t> _tunnel_ports {};
+		std::string friend_public_key_hex(uint32_t friend_number) const;
+		void handle_io_results(void);
+
+		PacketPool _pool {};
+		Reassembler _reassembler {_pool};
+		FecDecoder _fec_decoder {_pool};
+		// for both, counts it for the friend
+		static void reassembly_fail_cb(void* user_data, uint32_t friend_number);
+
+		float _traffic_timer {0.f};
+		TrafficStats _traffic_closed {}; // sum over closed tunnels
+		// updates the rates and the snapshot
+		void update_traffic(float time_delta);
+		mutable std::mutex _traffic_mutex;
+		std::vector<TrafficStats> _traffic_snapshot {}; // _traffic_mutex
+		TrafficStats _traffic_total_snapshot {}; // _traffic_mutex
+
+		// headers get written into the headroom / over already sent fragments
+		void forward_datagram(uint32_t friend_number, PacketBuffer& pkg);
+		// returns false if tox is busy (sendq), other errors count as sent
+		bool send_lossy(uint32_t friend_number, const uint8_t* data, size_t size);
+		// a single toxext segment, false if it was not sent
+		bool send_segment(uint32_t friend_number, const uint8_t* data, size_t size);
+		// split into toxext segments, also used for single small datagrams
+		void send_lossless(uint32_t friend_number, Tunnel& tunnel, PacketBuffer& pkg);
+		void send_lossy_fragments(uint32_t friend_number, Tunnel& tunnel, PacketBuffer& pkg);
+		void send_fec_fragments(uint32_t friend_number, Tunnel& tunnel, PacketBuffer& pkg);
+
+		// compatible and has a tunnel
+		bool tunnel_usable(uint32_t friend_number) const;
+		void handle_fragment(uint32_t friend_number, const uint8_t* data, size_t size, size_t frag_size_max, bool lossless);
+		void handle_fec_fragment(uint32_t friend_number, const uint8_t* data, size_t size);
+
+		float _probe_timer {0.f};
+		void probe_tunnels(void);
+		void update_path(uint32_t friend_number, Tunnel& tunnel);
+		void coalesce_flush(uint32_t friend_number, Tunnel& tunnel);
+		size_t _coalesce_pending {0}; // tunnels with something in coalesce_buffer
+		// queue a datagram for the torrent client
+		// timestamp_us is when the tox packet arrived
+		void push_to_udp(uint32_t friend_number, const uint8_t* data, size_t size, bool lossless, uint64_t timestamp_us);
+
+		// written by the tox thread / the io thread
+		std::array<LatencyHistogram, 2> _latency_to_friend {};
+		std::array<LatencyHistogram, 2> _latency_from_friend {};
+		// records now, or once the sendq got to the last packet of the datagram
+		void latency_done(Tunnel& tunnel, bool lossless, uint64_t timestamp_us);
+		// sent but not flushed yet, io thread only
+		std::vector<std::pair<uint64_t, bool>> _io_latency_pending {};
+
+	private: // io thread tunnel data
+		struct IOTunnel {
+			UDPSocket s; // stays closed for shared tunnels
+			uint16_t port {}; // in host
+			uint32_t shared_host {0}; // local address on the shared socket, network order
+			uint32_t shared_offset {0}; // from the host base
+			bool paused {false};
+			std::shared_ptr<TunnelTraffic> traffic {};
+			// shared only, datagrams read in shared drain burst_drain
+			uint64_t burst_drain {0};
+			size_t burst_used {0};
+		};
+
+		// only ever touched by the io thread
+		std::map<uint32_t, IOTunnel> _io_tunnels {};
+
+		PortAllocator _io_ports {};
+		// binds sock to the preferred port or the next free one, 0 on failure
+		uint16_t io_bind(UDPSocket& sock, uint16_t preferred);
+
+		// the one socket for shared tunnels, opened with the first one
+		UDPSocket _io_shared_socket {};
+		uint16_t _io_shared_port {0};
+		// local address -> friend
+		std::unordered_map<uint32_t, uint32_t> _io_shared_demux {};
+		uint64_t _io_shared_drains {0}; // so the per friend budgets reset lazily
+		// offsets from shared_host_base, reused after a tunnel closes
+		std::vector<uint32_t> _io_shared_hosts_free {};
+		uint32_t _io_shared_hosts_next {0};
+
+		// tunnel open/close requests from the tox thread, rare so a mutex is fine
+		struct IOCommand {
+			enum class Type {
+				OPEN,
+				CLOSE,
+				PAUSE, // stop reading the socket
+				RESUME,
+			} type;
+			uint32_t friend_number;
+			bool shared {false}; // OPEN only
+			uint32_t shared_host_base {0}; // OPEN only
+			uint16_t port_preferred {0}; // OPEN only, 0 for none
+			uint16_t port_range_first {0}; // OPEN only
+			uint16_t port_range_last {0}; // OPEN only
+			std::shared_ptr<TunnelTraffic> traffic {}; // OPEN only
+		};
+		std::mutex _io_commands_mutex;
+		std::vector<IOCommand> _io_commands {};
+
+		// ports the io thread ended up binding, so the tox thread can remember them
+		struct IOResult {
+			uint32_t friend_number;
+			uint16_t port; // 0 if opening failed, the tox thread drops the tunnel
+		};
+		std::vector<IOResult> _io_results {}; // also _io_commands_mutex
+		std::atomic<bool> _io_results_pushed {false};
+
+		std::thread _io_thread;
+		std::atomic<bool> _io_thread_stop {false};
+
+#ifdef __linux__
+		// io thread readiness set over all tunnel sockets and _io_wakeup_fd,
+		// event data is the friend number
+		int _epoll_fd {-1};
+		int _io_wakeup_fd {-1}; // eventfd, tox thread -> io thread
+		int _tox_wakeup_fd {-1}; // eventfd, io thread -> tox thread
+#endif
+
+		void io_signal(void);
+		void tox_signal(void);
+
+		void io_thread_fn(void);
+		void io_handle_commands(void);
+		// returns false if no socket or local address is available
+		bool io_open_shared(uint32_t friend_number, IOTunnel& tun, uint32_t host_base);
+		void io_close_shared(IOTunnel& tun);
+		void io_push_result(uint32_t friend_number, uint16_t port);
+		// reads until the socket is empty or the burst budget is used up
+		// returns true if anything got pushed to the tox thread
+		bool io_drain_socket(uint32_t friend_number, IOTunnel& tun);
+		bool io_drain_shared_socket(void);
+		void io_send_pending(void);
 };
 
 } // ttt::ext
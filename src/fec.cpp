@@ -0,0 +1,370 @@
+#include "./fec.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ttt {
+
+namespace {
+
+// GF(256) with the usual 0x11d polynomial
+struct GFTables {
+	uint8_t exp[512] {};
+	uint8_t log[256] {};
+
+	constexpr GFTables(void) {
+		int x = 1;
+		for (int i = 0; i < 255; i++) {
+			exp[i] = x;
+			log[x] = i;
+			x <<= 1;
+			if (x & 0x100) {
+				x ^= 0x11d;
+			}
+		}
+		for (int i = 255; i < 512; i++) {
+			exp[i] = exp[i - 255];
+		}
+	}
+};
+
+constexpr static GFTables gf {};
+
+uint8_t gf_mul(uint8_t a, uint8_t b) {
+	if (a == 0 || b == 0) {
+		return 0;
+	}
+	return gf.exp[gf.log[a] + gf.log[b]];
+}
+
+uint8_t gf_inv(uint8_t a) {
+	return gf.exp[255 - gf.log[a]];
+}
+
+// row parity_index, column data_index of a cauchy matrix 1/(x_p ^ y_i),
+// x_p = k_max + p and y_i = i never overlap. every square submatrix of it is
+// invertible, which is what makes any k fragments enough.
+// the columns are scaled so parity 0 is all ones (plain xor), that keeps the property
+uint8_t coefficient(size_t parity_index, size_t data_index) {
+	const uint8_t x_p = FecHeader::k_max + parity_index;
+	const uint8_t x_0 = FecHeader::k_max;
+	const uint8_t y_i = data_index;
+	return gf_mul(gf_inv(x_p ^ y_i), x_0 ^ y_i);
+}
+
+// dst ^= c * src
+void mul_add(uint8_t* dst, const uint8_t* src, size_t size, uint8_t c) {
+	if (c == 0) {
+		return;
+	}
+	if (c == 1) {
+		for (size_t i = 0; i < size; i++) {
+			dst[i] ^= src[i];
+		}
+		return;
+	}
+
+	const uint8_t log_c = gf.log[c];
+	for (size_t i = 0; i < size; i++) {
+		if (src[i] != 0) {
+			dst[i] ^= gf.exp[gf.log[src[i]] + log_c];
+		}
+	}
+}
+
+} // namespace
+
+void FecHeader::write(uint8_t* buff) const {
+	buff[0] = datagram_id & 0xff;
+	buff[1] = (datagram_id >> 8) & 0xff;
+	buff[2] = index;
+	buff[3] = k;
+	buff[4] = r;
+	buff[5] = datagram_size & 0xff;
+	buff[6] = (datagram_size >> 8) & 0xff;
+}
+
+bool FecHeader::read(const uint8_t* buff, size_t buff_size) {
+	if (buff_size < size) {
+		return false;
+	}
+
+	datagram_id = buff[0] | (buff[1] << 8);
+	index = buff[2];
+	k = buff[3];
+	r = buff[4];
+	datagram_size = buff[5] | (buff[6] << 8);
+
+	return
+		k > 0 && k <= k_max &&
+		r <= k &&
+		index < k + r &&
+		datagram_size > 0 &&
+		(k - 1) * frag_size() < datagram_size &&
+		k * frag_size() <= PacketBuffer::capacity
+	;
+}
+
+void fec_encode(const uint8_t* data, const FecHeader& hdr, size_t parity_index, uint8_t* out) {
+	const size_t frag_size = hdr.frag_size();
+	std::memset(out, 0, frag_size);
+
+	for (size_t i = 0; i < hdr.k; i++) {
+		const size_t offset = i * frag_size;
+		const size_t size = std::min(frag_size, hdr.datagram_size - offset);
+		mul_add(out, data + offset, size, coefficient(parity_index, i));
+	}
+}
+
+FecDecoder::~FecDecoder(void) {
+	for (auto& [f_id, f] : _friends) {
+		for (auto& slot : f.slots) {
+			free_slot(slot);
+		}
+	}
+}
+
+PacketBuffer* FecDecoder::add(uint32_t friend_number, const FecHeader& hdr, const uint8_t* data, size_t size) {
+	const size_t frag_size = hdr.frag_size();
+	const bool is_data = hdr.index < hdr.k;
+	const size_t expected_size = is_data
+		? std::min(frag_size, hdr.datagram_size - hdr.index * frag_size)
+		: frag_size
+	;
+	if (size != expected_size) {
+		drops++;
+		return nullptr;
+	}
+
+	auto& f = _friends[friend_number];
+	if (f.slots.size() != slots_per_friend_max) {
+		f.slots.resize(slots_per_friend_max);
+	}
+
+	if (std::find(f.done.cbegin(), f.done.cend(), int32_t(hdr.datagram_id)) != f.done.cend()) {
+		return nullptr; // already got it, this is left over parity (or a duplicate)
+	}
+
+	Slot* slot = nullptr;
+	for (auto& it : f.slots) {
+		if (it.data != nullptr && it.hdr.datagram_id == hdr.datagram_id) {
+			slot = &it;
+			break;
+		}
+	}
+
+	if (slot == nullptr) { // new datagram
+		auto slot_it = std::find_if(f.slots.begin(), f.slots.end(), [](const Slot& it) { return it.data == nullptr; });
+		if (slot_it == f.slots.end()) {
+			slot_it = std::max_element(f.slots.begin(), f.slots.end(), [](const Slot& lhs, const Slot& rhs) { return lhs.age < rhs.age; });
+			free_slot(*slot_it);
+			evictions++;
+			failed(friend_number);
+		}
+
+		if (_bytes_in_use + PacketBuffer::capacity > bytes_max) {
+			drops++;
+			return nullptr;
+		}
+
+		slot = &*slot_it;
+		slot->data = _pool.acquire();
+		_bytes_in_use += PacketBuffer::capacity;
+		slot->hdr = hdr;
+		slot->data_mask = 0;
+		slot->parity_mask = 0;
+		slot->age = 0.f;
+	}
+
+	if (slot->hdr.k != hdr.k || slot->hdr.r != hdr.r || slot->hdr.datagram_size != hdr.datagram_size) {
+		drops++; // id reused with a different layout?
+		return nullptr;
+	}
+
+	if (is_data) {
+		const uint32_t bit = uint32_t(1) << hdr.index;
+		if (slot->data_mask & bit) {
+			return nullptr; // duplicate
+		}
+		std::memcpy(slot->data->data() + hdr.index * frag_size, data, size);
+		slot->data_mask |= bit;
+	} else {
+		const size_t parity_index = hdr.index - hdr.k;
+		const uint32_t bit = uint32_t(1) << parity_index;
+		if (slot->parity_mask & bit) {
+			return nullptr; // duplicate
+		}
+		if (slot->parity == nullptr) {
+			if (_bytes_in_use + PacketBuffer::capacity > bytes_max) {
+				drops++;
+				return nullptr;
+			}
+			slot->parity = _pool.acquire();
+			_bytes_in_use += PacketBuffer::capacity;
+		}
+		std::memcpy(slot->parity->data() + parity_index * frag_size, data, size);
+		slot->parity_mask |= bit;
+	}
+
+	const size_t data_count = __builtin_popcount(slot->data_mask);
+	const size_t parity_count = __builtin_popcount(slot->parity_mask);
+	if (data_count + parity_count < hdr.k) {
+		return nullptr;
+	}
+
+	if (data_count < hdr.k) {
+		if (!decode(*slot)) {
+			drops++;
+			free_slot(*slot);
+			failed(friend_number);
+			return nullptr;
+		}
+		recovered++;
+	}
+
+	// done, hand the buffer over
+	PacketBuffer* complete = slot->data;
+	complete->size = hdr.datagram_size;
+	slot->data = nullptr;
+	_bytes_in_use -= PacketBuffer::capacity;
+	free_slot(*slot);
+
+	f.done[f.done_next] = hdr.datagram_id;
+	f.done_next = (f.done_next + 1) % f.done.size();
+
+	return complete;
+}
+
+bool FecDecoder::decode(Slot& slot) {
+	const size_t k = slot.hdr.k;
+	const size_t frag_size = slot.hdr.frag_size();
+	uint8_t* data = slot.data->data();
+
+	std::array<size_t, FecHeader::k_max> missing {};
+	size_t missing_count = 0;
+	for (size_t i = 0; i < k; i++) {
+		if (!(slot.data_mask & (uint32_t(1) << i))) {
+			missing[missing_count++] = i;
+		}
+	}
+
+	std::array<size_t, FecHeader::k_max> rows {};
+	size_t row_count = 0;
+	for (size_t j = 0; j < slot.hdr.r && row_count < missing_count; j++) {
+		if (slot.parity_mask & (uint32_t(1) << j)) {
+			rows[row_count++] = j;
+		}
+	}
+
+	// strip the known data out of the parity, leaves sum(coef * missing) in place
+	uint8_t* parity = slot.parity->data();
+	for (size_t row = 0; row < row_count; row++) {
+		uint8_t* p = parity + rows[row] * frag_size;
+		for (size_t i = 0; i < k; i++) {
+			if (slot.data_mask & (uint32_t(1) << i)) {
+				// the last fragment might be short, whatever is behind it is not ours
+				const size_t size = std::min(frag_size, slot.hdr.datagram_size - i * frag_size);
+				mul_add(p, data + i * frag_size, size, coefficient(rows[row], i));
+			}
+		}
+	}
+
+	// gauss-jordan on the small coefficient matrix, applying the same row ops to the parity
+	uint8_t m[FecHeader::k_max][FecHeader::k_max] {};
+	for (size_t row = 0; row < missing_count; row++) {
+		for (size_t col = 0; col < missing_count; col++) {
+			m[row][col] = coefficient(rows[row], missing[col]);
+		}
+	}
+
+	for (size_t col = 0; col < missing_count; col++) {
+		size_t pivot = col;
+		while (pivot < missing_count && m[pivot][col] == 0) {
+			pivot++;
+		}
+		if (pivot == missing_count) {
+			return false; // singular
+		}
+
+		if (pivot != col) {
+			std::swap(m[pivot], m[col]);
+			std::swap(rows[pivot], rows[col]);
+		}
+
+		uint8_t* p_col = parity + rows[col] * frag_size;
+		const uint8_t inv = gf_inv(m[col][col]);
+		if (inv != 1) {
+			for (size_t c = 0; c < missing_count; c++) {
+				m[col][c] = gf_mul(m[col][c], inv);
+			}
+			for (size_t i = 0; i < frag_size; i++) {
+				p_col[i] = gf_mul(p_col[i], inv);
+			}
+		}
+
+		for (size_t row = 0; row < missing_count; row++) {
+			if (row == col || m[row][col] == 0) {
+				continue;
+			}
+			const uint8_t factor = m[row][col];
+			for (size_t c = 0; c < missing_count; c++) {
+				m[row][c] ^= gf_mul(factor, m[col][c]);
+			}
+			mul_add(parity + rows[row] * frag_size, p_col, frag_size, factor);
+		}
+	}
+
+	for (size_t col = 0; col < missing_count; col++) {
+		const size_t offset = missing[col] * frag_size;
+		const size_t size = std::min(frag_size, slot.hdr.datagram_size - offset);
+		std::memcpy(data + offset, parity + rows[col] * frag_size, size);
+	}
+
+	return true;
+}
+
+void FecDecoder::tick(float time_delta) {
+	for (auto& [f_id, f] : _friends) {
+		for (auto& slot : f.slots) {
+			if (slot.data == nullptr) {
+				continue;
+			}
+
+			slot.age += time_delta;
+			if (slot.age > timeout) {
+				free_slot(slot);
+				timeouts++;
+				failed(f_id);
+			}
+		}
+	}
+}
+
+void FecDecoder::remove_friend(uint32_t friend_number) {
+	auto it = _friends.find(friend_number);
+	if (it == _friends.end()) {
+		return;
+	}
+
+	for (auto& slot : it->second.slots) {
+		free_slot(slot);
+	}
+
+	_friends.erase(it);
+}
+
+void FecDecoder::free_slot(Slot& slot) {
+	if (slot.data != nullptr) {
+		_pool.release(slot.data);
+		slot.data = nullptr;
+		_bytes_in_use -= PacketBuffer::capacity;
+	}
+	if (slot.parity != nullptr) {
+		_pool.release(slot.parity);
+		slot.parity = nullptr;
+		_bytes_in_use -= PacketBuffer::capacity;
+	}
+}
+
+} // ttt
+
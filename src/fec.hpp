@@ -0,0 +1,112 @@
+#pragma once
+
+#include "./packet_pool.hpp"
+
+#include <map>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace ttt {
+
+// forward error correction for split datagrams.
+// k data fragments are followed by r parity fragments, each parity is a
+// linear combination over GF(256) of the (zero padded) data fragments.
+// the coefficients come from a cauchy matrix, so any k out of the k+r
+// fragments restore the datagram. the first parity is plain xor.
+
+// in front of every fec fragment
+// [datagram_id (2, le)] [index (1)] [k (1)] [r (1)] [datagram_size (2, le)]
+// index < k is data, everything after is parity
+struct FecHeader {
+	constexpr static size_t size = 7;
+	constexpr static size_t k_max = 16;
+
+	uint16_t datagram_id {0};
+	uint8_t index {0};
+	uint8_t k {0};
+	uint8_t r {0};
+	uint16_t datagram_size {0};
+
+	// every fragment is this big, except maybe the last data one
+	size_t frag_size(void) const { return (datagram_size + k - 1) / k; }
+
+	void write(uint8_t* buff) const;
+	// false if malformed (also rejects layouts with empty data fragments)
+	bool read(const uint8_t* buff, size_t buff_size);
+};
+
+// out gets the frag_size() bytes of parity fragment parity_index
+void fec_encode(const uint8_t* data, const FecHeader& hdr, size_t parity_index, uint8_t* out);
+
+// collects fec fragments and restores the datagram once k of them arrived.
+// bounded like the Reassembler, by slots, age and bytes
+class FecDecoder {
+	public:
+		explicit FecDecoder(PacketPool& pool) : _pool(pool) {}
+		~FecDecoder(void);
+
+		size_t slots_per_friend_max {8};
+		// seconds an incomplete datagram is kept
+		float timeout {1.f};
+		// over all friends, counted in pool buffers held (data and parity)
+		size_t bytes_max {1024*1024};
+
+		// called for every datagram given up on, eg. for per friend stats
+		using fail_fn_t = void(*)(void* user_data, uint32_t friend_number);
+		fail_fn_t fail_fn {nullptr};
+		void* fail_user_data {nullptr};
+
+		// data is the fragment payload after the header.
+		// returns the complete datagram (give it back with release()), nullptr otherwise
+		PacketBuffer* add(uint32_t friend_number, const FecHeader& hdr, const uint8_t* data, size_t size);
+		void release(PacketBuffer* buffer) { _pool.release(buffer); }
+
+		void tick(float time_delta);
+
+		void remove_friend(uint32_t friend_number);
+
+		size_t bytes_in_use(void) const { return _bytes_in_use; }
+
+	public: // stats
+		uint64_t recovered {0}; // datagrams that needed parity
+		uint64_t timeouts {0};
+		uint64_t evictions {0};
+		uint64_t drops {0}; // fragments that did not fit (layout or bytes_max) or could not be decoded
+
+	private:
+		struct Slot {
+			PacketBuffer* data {nullptr}; // nullptr -> unused
+			PacketBuffer* parity {nullptr}; // only once a parity fragment arrived
+			FecHeader hdr {}; // index is meaningless
+			uint32_t data_mask {0};
+			uint32_t parity_mask {0};
+			float age {0.f};
+		};
+
+		struct Friend {
+			std::vector<Slot> slots {};
+
+			// datagrams already handed out, so late parity does not open a new slot
+			std::array<int32_t, 32> done {};
+			size_t done_next {0};
+			Friend(void) { done.fill(-1); }
+		};
+
+		// restores missing data fragments from parity, false if not possible
+		bool decode(Slot& slot);
+		void free_slot(Slot& slot);
+		void failed(uint32_t friend_number) {
+			if (fail_fn != nullptr) {
+				fail_fn(fail_user_data, friend_number);
+			}
+		}
+
+		PacketPool& _pool;
+		std::map<uint32_t, Friend> _friends {};
+		size_t _bytes_in_use {0};
+};
+
+} // ttt
+
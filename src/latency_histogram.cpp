@@ -0,0 +1,76 @@
+#include "./latency_histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ttt {
+
+size_t LatencyHistogram::bucket_index(uint64_t us) {
+	us = std::min<uint64_t>(us, (uint64_t(1) << range_bits) - 1);
+
+	if (us < sub_bucket_count) {
+		return us; // exact
+	}
+
+	// position of the highest bit picks the power of two,
+	// the next sub_bucket_bits below it the linear step inside
+	const size_t msb = 63 - __builtin_clzll(us);
+	const size_t shift = msb - sub_bucket_bits;
+	return (shift + 1) * sub_bucket_count + ((us >> shift) - sub_bucket_count);
+}
+
+uint64_t LatencyHistogram::bucket_upper(size_t index) {
+	if (index < sub_bucket_count) {
+		return index;
+	}
+
+	const size_t shift = index / sub_bucket_count - 1;
+	const uint64_t sub = index % sub_bucket_count + sub_bucket_count;
+	return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us) {
+	_buckets[bucket_index(us)].fetch_add(1, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(us, std::memory_order_relaxed);
+
+	// single writer, so no cas loop needed
+	if (us > _max.load(std::memory_order_relaxed)) {
+		_max.store(us, std::memory_order_relaxed);
+	}
+}
+
+uint64_t LatencyHistogram::value_at_quantile(double q) const {
+	// the buckets, not count(), they might be a bit out of sync
+	uint64_t total = 0;
+	for (const auto& it : _buckets) {
+		total += it.load(std::memory_order_relaxed);
+	}
+	if (total == 0) {
+		return 0;
+	}
+
+	const uint64_t target = std::max<uint64_t>(1, std::ceil(std::clamp(q, 0., 1.) * total));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < bucket_count; i++) {
+		seen += _buckets[i].load(std::memory_order_relaxed);
+		if (seen >= target) {
+			// the max is exact, so never report more
+			return std::min(bucket_upper(i), max());
+		}
+	}
+
+	return max();
+}
+
+void LatencyHistogram::reset(void) {
+	for (auto& it : _buckets) {
+		it.store(0, std::memory_order_relaxed);
+	}
+	_count.store(0, std::memory_order_relaxed);
+	_sum.store(0, std::memory_order_relaxed);
+	_max.store(0, std::memory_order_relaxed);
+}
+
+} // ttt
+
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace ttt {
+
+// microseconds on the monotonic clock, what gets recorded below
+inline uint64_t monotonic_us(void) {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+	).count();
+}
+
+// hdr histogram style: every power of two is split into sub_bucket_count
+// linear buckets, so any recorded value is off by less than 1/sub_bucket_count
+// (12.5%) with a fixed, small amount of memory. values are microseconds,
+// everything above ~1min lands in the last bucket.
+//
+// recording is a relaxed increment, so one thread can record while others read
+class LatencyHistogram {
+	public:
+		constexpr static size_t sub_bucket_bits = 3;
+		constexpr static size_t sub_bucket_count = size_t(1) << sub_bucket_bits;
+		constexpr static size_t range_bits = 26; // 2^26us ~ 67s
+		constexpr static size_t bucket_count = (range_bits - sub_bucket_bits + 1) * sub_bucket_count;
+
+		void record(uint64_t us);
+
+		uint64_t count(void) const { return _count.load(std::memory_order_relaxed); }
+		uint64_t sum(void) const { return _sum.load(std::memory_order_relaxed); }
+		uint64_t max(void) const { return _max.load(std::memory_order_relaxed); }
+
+		// upper bound of the bucket holding quantile q (0..1), 0 if empty
+		uint64_t value_at_quantile(double q) const;
+
+		// not atomic as a whole, samples recorded meanwhile might only partly count
+		void reset(void);
+
+		static size_t bucket_index(uint64_t us);
+		// largest value that lands in bucket index
+		static uint64_t bucket_upper(size_t index);
+
+	private:
+		std::array<std::atomic<uint64_t>, bucket_count> _buckets {};
+		std::atomic<uint64_t> _count {0};
+		std::atomic<uint64_t> _sum {0};
+		std::atomic<uint64_t> _max {0};
+};
+
+} // ttt
+
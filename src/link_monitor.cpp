@@ -0,0 +1,83 @@
+#include "./link_monitor.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ttt {
+
+// ewma weights, rtt ones like tcp (rfc 6298)
+constexpr static float loss_alpha = 0.1f;
+constexpr static float rtt_alpha = 0.125f;
+constexpr static float rtt_beta = 0.25f;
+
+bool LinkMonitor::probe_due(clock::time_point now, uint32_t& seq) {
+	expire(now);
+
+	if (_sent != 0 && std::chrono::duration<float>(now - _last_probe).count() < probe_interval) {
+		return false;
+	}
+
+	// reuse the oldest slot if all are in flight, it would time out soon anyway
+	auto slot_it = std::find_if(_in_flight.begin(), _in_flight.end(), [](const InFlight& it) { return !it.used; });
+	if (slot_it == _in_flight.end()) {
+		slot_it = std::min_element(_in_flight.begin(), _in_flight.end(), [](const InFlight& lhs, const InFlight& rhs) { return lhs.sent < rhs.sent; });
+		_lost++;
+		add_outcome(true);
+	}
+
+	seq = _next_seq++;
+	*slot_it = {true, seq, now};
+
+	_last_probe = now;
+	_sent++;
+
+	return true;
+}
+
+float LinkMonitor::next_probe_in(clock::time_point now) const {
+	if (_sent == 0) {
+		return 0.f;
+	}
+	return std::max(0.f, probe_interval - std::chrono::duration<float>(now - _last_probe).count());
+}
+
+void LinkMonitor::on_echo(uint32_t seq, clock::time_point now) {
+	auto slot_it = std::find_if(_in_flight.begin(), _in_flight.end(), [seq](const InFlight& it) { return it.used && it.seq == seq; });
+	if (slot_it == _in_flight.end()) {
+		return; // too late or unknown
+	}
+
+	const float rtt_sample = std::chrono::duration<float>(now - slot_it->sent).count();
+	slot_it->used = false;
+
+	if (_echoes == 0) {
+		_srtt = rtt_sample;
+		_rttvar = rtt_sample / 2.f;
+	} else {
+		_rttvar = (1.f - rtt_beta) * _rttvar + rtt_beta * std::abs(_srtt - rtt_sample);
+		_srtt = (1.f - rtt_alpha) * _srtt + rtt_alpha * rtt_sample;
+	}
+
+	_echoes++;
+	add_outcome(false);
+}
+
+void LinkMonitor::expire(clock::time_point now) {
+	for (auto& it : _in_flight) {
+		if (it.used && std::chrono::duration<float>(now - it.sent).count() > probe_timeout) {
+			it.used = false;
+			_lost++;
+			add_outcome(true);
+		}
+	}
+}
+
+void LinkMonitor::add_outcome(bool lost) {
+	_loss_rt = (1.f - loss_alpha) * _loss_rt + loss_alpha * (lost ? 1.f : 0.f);
+
+	// probe and echo both have to make it, assume both directions are alike
+	_loss = 1.f - std::sqrt(std::max(0.f, 1.f - _loss_rt));
+}
+
+} // ttt
+
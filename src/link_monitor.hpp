@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace ttt {
+
+// estimates loss and rtt of a friend link from probe/echo round trips.
+// does not send anything itself, the tunnel asks when a probe is due
+class LinkMonitor {
+	public:
+		using clock = std::chrono::steady_clock;
+
+		constexpr static size_t in_flight_max = 16;
+
+		// seconds between probes
+		float probe_interval {1.f};
+		// no echo after this many seconds counts as lost
+		float probe_timeout {3.f};
+
+		// returns true and the seq to put into the probe if one is due
+		bool probe_due(clock::time_point now, uint32_t& seq);
+		// seconds until probe_due() would return true
+		float next_probe_in(clock::time_point now) const;
+
+		void on_echo(uint32_t seq, clock::time_point now);
+
+	public: // results
+		// one way loss estimate, 0..1
+		float loss(void) const { return _loss; }
+		// smoothed round trip time in seconds, 0 until the first echo
+		float rtt(void) const { return _srtt; }
+		float rtt_var(void) const { return _rttvar; }
+
+		// probe outcomes seen (echoed or timed out)
+		uint64_t samples(void) const { return _echoes + _lost; }
+
+		uint64_t probes_sent(void) const { return _sent; }
+		uint64_t echoes(void) const { return _echoes; }
+		uint64_t probes_lost(void) const { return _lost; }
+
+	private:
+		void expire(clock::time_point now);
+		void add_outcome(bool lost);
+
+		struct InFlight {
+			bool used {false};
+			uint32_t seq {0};
+			clock::time_point sent {};
+		};
+		std::array<InFlight, in_flight_max> _in_flight {};
+
+		uint32_t _next_seq {0};
+		clock::time_point _last_probe {};
+
+		float _loss_rt {0.f}; // round trip (probe + echo)
+		float _loss {0.f};
+		float _srtt {0.f};
+		float _rttvar {0.f};
+
+		uint64_t _sent {0};
+		uint64_t _echoes {0};
+		uint64_t _lost {0};
+};
+
+} // ttt
+
@@ -0,0 +1,117 @@
+#include "./memory_transport.hpp"
+
+#include "./latency_histogram.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace ttt::ext {
+
+MemoryTransport::MemoryTransport(uint32_t seed) : _rng(seed) {
+	// only needs to be unique, tunnels remember their port by it
+	_public_key.resize(32);
+	for (auto& it : _public_key) {
+		it = _rng() & 0xff;
+	}
+}
+
+void MemoryTransport::connect(MemoryTransport& a, MemoryTransport& b) {
+	a._peer = &b;
+	b._peer = &a;
+}
+
+bool MemoryTransport::friend_connected(uint32_t friend_number_) {
+	return _peer != nullptr && connected && friend_number_ == friend_number;
+}
+
+std::vector<uint8_t> MemoryTransport::friend_public_key(uint32_t friend_number_) {
+	if (_peer == nullptr || friend_number_ != friend_number) {
+		return {};
+	}
+	return _peer->_public_key;
+}
+
+Transport::SendResult MemoryTransport::send_lossy(uint32_t friend_number_, const uint8_t* data, size_t size) {
+	if (!friend_connected(friend_number_)) {
+		return SendResult::FAILED;
+	}
+
+	if (sendq_max > 0 && _lossy_in_flight >= sendq_max) {
+		sendq_full++;
+		return SendResult::SENDQ;
+	}
+
+	sent++;
+	if (loss > 0.f && _dist(_rng) < loss) {
+		lost++;
+		return SendResult::OK; // the sender never knows
+	}
+
+	float packet_delay = delay;
+	if (jitter > 0.f) {
+		packet_delay += _dist(_rng) * jitter;
+	}
+
+	push(false, data, size, monotonic_us() + uint64_t(packet_delay * 1'000'000.f));
+	_lossy_in_flight++;
+
+	return SendResult::OK;
+}
+
+bool MemoryTransport::send_segment(uint32_t friend_number_, const uint8_t* data, size_t size) {
+	if (!friend_connected(friend_number_)) {
+		return false;
+	}
+
+	sent++;
+
+	// never before the one sent earlier
+	_lossless_due_us = std::max(_lossless_due_us, monotonic_us() + uint64_t(delay * 1'000'000.f));
+	push(true, data, size, _lossless_due_us);
+
+	return true;
+}
+
+void MemoryTransport::push(bool lossless, const uint8_t* data, size_t size, uint64_t due_us) {
+	std::vector<uint8_t> buff {};
+	if (!_free_buffers.empty()) {
+		buff = std::move(_free_buffers.back());
+		_free_buffers.pop_back();
+	}
+	buff.assign(data, data + size);
+
+	_in_flight.push_back({due_us, _seq++, lossless, std::move(buff)});
+	std::push_heap(_in_flight.begin(), _in_flight.end(), InFlight::later);
+}
+
+size_t MemoryTransport::pump(uint64_t now_us) {
+	size_t count = 0;
+	while (!_in_flight.empty() && _in_flight.front().due_us <= now_us) {
+		std::pop_heap(_in_flight.begin(), _in_flight.end(), InFlight::later);
+		// off the heap before calling out, the receiver might send back
+		InFlight pkg = std::move(_in_flight.back());
+		_in_flight.pop_back();
+
+		if (!pkg.lossless) {
+			_lossy_in_flight--;
+		}
+
+		const auto& fn = pkg.lossless ? _peer->segment_fn : _peer->lossy_fn;
+		if (fn) {
+			fn(_peer->friend_number, pkg.data.data(), pkg.data.size());
+		}
+
+		delivered++;
+		count++;
+		_free_buffers.push_back(std::move(pkg.data));
+	}
+
+	return count;
+}
+
+uint64_t MemoryTransport::next_due_us(void) const {
+	return _in_flight.empty() ? 0 : _in_flight.front().due_us;
+}
+
+} // ttt::ext
+
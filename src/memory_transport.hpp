@@ -0,0 +1,83 @@
+#pragma once
+
+#include "./transport.hpp"
+
+#include <vector>
+#include <functional>
+#include <random>
+#include <cstdint>
+
+namespace ttt::ext {
+
+// stands in for tox between two extensions in one process.
+// packets sent on one end come out at the other end on pump(), after delay.
+// lossy ones can get lost, jitter reorders them. lossless ones keep their order.
+// not thread safe, send and pump from the same thread
+class MemoryTransport : public Transport {
+	public:
+		// what the owner of this end calls the other end
+		uint32_t friend_number {0};
+		bool connected {true};
+
+		float loss {0.f}; // chance per lossy packet
+		float delay {0.f}; // seconds
+		float jitter {0.f}; // up to this many seconds more, per lossy packet
+		size_t sendq_max {0}; // lossy packets in flight before SENDQ, 0 is unlimited
+
+		// receivers on this end, friend_number is how this end sees the sender
+		using recv_fn_t = std::function<void(uint32_t friend_number, const uint8_t* data, size_t size)>;
+		recv_fn_t lossy_fn {};
+		recv_fn_t segment_fn {};
+
+		// stats, for packets sent from this end
+		uint64_t sent {0};
+		uint64_t lost {0};
+		uint64_t delivered {0};
+		uint64_t sendq_full {0};
+
+	public:
+		explicit MemoryTransport(uint32_t seed = 1337);
+
+		static void connect(MemoryTransport& a, MemoryTransport& b);
+
+		// delivers everything sent from this end, due at now_us (monotonic_us())
+		// returns the number of packets delivered
+		size_t pump(uint64_t now_us);
+		// 0 if nothing is in flight
+		uint64_t next_due_us(void) const;
+
+		bool friend_connected(uint32_t friend_number) override;
+		std::vector<uint8_t> friend_public_key(uint32_t friend_number) override;
+
+		SendResult send_lossy(uint32_t friend_number, const uint8_t* data, size_t size) override;
+		bool send_segment(uint32_t friend_number, const uint8_t* data, size_t size) override;
+
+	private:
+		void push(bool lossless, const uint8_t* data, size_t size, uint64_t due_us);
+
+		MemoryTransport* _peer {nullptr};
+		std::vector<uint8_t> _public_key {};
+
+		struct InFlight {
+			uint64_t due_us {0};
+			uint64_t seq {0}; // keeps sends with the same due time in order
+			bool lossless {false};
+			std::vector<uint8_t> data {};
+
+			// earliest due first, the heap functions want the reverse
+			static bool later(const InFlight& lhs, const InFlight& rhs) {
+				return lhs.due_us != rhs.due_us ? lhs.due_us > rhs.due_us : lhs.seq > rhs.seq;
+			}
+		};
+		std::vector<InFlight> _in_flight {}; // min heap on (due_us, seq)
+		std::vector<std::vector<uint8_t>> _free_buffers {};
+		uint64_t _seq {0};
+		uint64_t _lossless_due_us {0};
+		size_t _lossy_in_flight {0};
+
+		std::minstd_rand _rng;
+		std::uniform_real_distribution<float> _dist {0.f, 1.f};
+};
+
+} // ttt::ext
+
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdio>
+#include <cstdint>
+
+// helpers for the prometheus text format, see /metrics on the tracker
+namespace ttt::metrics {
+
+// "# HELP" and "# TYPE", once per metric name
+inline void describe(std::string& out, std::string_view name, std::string_view type, std::string_view help) {
+	out += "# HELP ";
+	out += name;
+	out += ' ';
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += ' ';
+	out += type;
+	out += '\n';
+}
+
+// labels are preformatted, eg. `route="announce"`, empty for none
+inline void sample_str(std::string& out, std::string_view name, std::string_view labels, std::string_view value) {
+	out += name;
+	if (!labels.empty()) {
+		out += '{';
+		out += labels;
+		out += '}';
+	}
+	out += ' ';
+	out += value;
+	out += '\n';
+}
+
+inline void sample(std::string& out, std::string_view name, std::string_view labels, uint64_t value) {
+	sample_str(out, name, labels, std::to_string(value));
+}
+
+inline void sample(std::string& out, std::string_view name, std::string_view labels, double value) {
+	char buff[32];
+	std::snprintf(buff, sizeof(buff), "%.9g", value);
+	sample_str(out, name, labels, buff);
+}
+
+} // ttt::metrics
+
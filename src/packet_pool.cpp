@@ -0,0 +1,56 @@
+#include "./packet_pool.hpp"
+
+#include <cassert>
+
+namespace ttt {
+
+PacketPool::PacketPool(size_t initial_count) {
+	_blocks.reserve(32);
+	grow(initial_count);
+}
+
+PacketBuffer* PacketPool::acquire(void) {
+	if (_free_list == nullptr) {
+		// double, so this stays rare
+		grow(_total > 0 ? _total : 16);
+	}
+
+	PacketBuffer* buffer = _free_list;
+	_free_list = buffer->next_free;
+
+	buffer->next_free = nullptr;
+	buffer->size = 0;
+	_in_use++;
+
+	return buffer;
+}
+
+void PacketPool::release(PacketBuffer* buffer) {
+	if (buffer == nullptr) {
+		return;
+	}
+
+	assert(_in_use > 0);
+	_in_use--;
+
+	buffer->next_free = _free_list;
+	_free_list = buffer;
+}
+
+void PacketPool::grow(size_t count) {
+	if (count == 0) {
+		return;
+	}
+
+	auto& block = _blocks.emplace_back(std::make_unique<PacketBuffer[]>(count));
+	_allocations++;
+	_total += count;
+
+	for (size_t i = 0; i < count; i++) {
+		block[i].next_free = _free_list;
+		_free_list = &block[i];
+	}
+}
+
+} // ttt
+
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "./udp_socket.hpp"
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace ttt {
+
+// fixed size buffer for a single datagram, with room in front for headers
+struct PacketBuffer {
+	// packet id + fragment header, prepended in place
+	constexpr static size_t headroom = 8;
+	constexpr static size_t capacity = UDPSocket::datagram_size_max;
+
+	size_t size {0};
+	uint64_t timestamp_us {0}; // monotonic, when it entered the tunnel. for latency stats
+	uint8_t storage[headroom + capacity];
+
+	uint8_t* data(void) { return storage + headroom; }
+	const uint8_t* data(void) const { return storage + headroom; }
+
+	PacketBuffer* next_free {nullptr}; // only used while in the pool
+};
+
+static_assert(PacketBuffer::headroom >= UDPSocket::recv_headroom);
+
+// single threaded free list of PacketBuffers.
+// only grows (and allocates) when more buffers are in use than ever before
+class PacketPool {
+	public:
+		// preallocates initial_count buffers
+		explicit PacketPool(size_t initial_count = 64);
+		PacketPool(const PacketPool&) = delete;
+
+		// never returns nullptr, grows if empty
+		PacketBuffer* acquire(void);
+		void release(PacketBuffer* buffer);
+
+		// number of heap allocations so far, including the initial one.
+		// does not change in steady state
+		uint64_t allocations(void) const { return _allocations; }
+
+		size_t in_use(void) const { return _in_use; }
+		size_t total(void) const { return _total; }
+
+	private:
+		void grow(size_t count);
+
+		std::vector<std::unique_ptr<PacketBuffer[]>> _blocks {};
+		PacketBuffer* _free_list {nullptr};
+
+		uint64_t _allocations {0};
+		size_t _in_use {0};
+		size_t _total {0};
+};
+
+} // ttt
+
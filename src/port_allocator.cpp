@@ -0,0 +1,114 @@
+#include "./port_allocator.hpp"
+
+#include <utility>
+
+namespace ttt {
+
+PortAllocator::PortAllocator(uint16_t first, uint16_t last) {
+	set_range(first, last);
+}
+
+void PortAllocator::set_range(uint16_t first, uint16_t last) {
+	if (first > last) {
+		std::swap(first, last);
+	}
+	if (first == 0) {
+		first = 1; // 0 means none
+	}
+
+	std::vector<uint16_t> in_use {};
+	for (size_t i = 0; i < _state.size(); i++) {
+		if (_state[i] == State::IN_USE) {
+			in_use.push_back(_first + i);
+		}
+	}
+
+	_first = first;
+	_last = last;
+
+	const size_t count = size_t(_last) - _first + 1;
+	_state.assign(count, State::FREE);
+	_free_pos.assign(count, 0);
+	_busy.clear();
+
+	_free.clear();
+	_free.reserve(count);
+	for (size_t i = count; i > 0; i--) {
+		_free_pos[i-1] = _free.size();
+		_free.push_back(_first + (i-1));
+	}
+
+	for (const uint16_t port : in_use) {
+		if (in_range(port)) {
+			free_remove(port);
+			_state[port - _first] = State::IN_USE;
+		}
+	}
+}
+
+uint16_t PortAllocator::acquire(uint16_t preferred) {
+	if (preferred != 0 && in_range(preferred)) {
+		auto& state = _state[preferred - _first];
+		if (state == State::FREE) {
+			free_remove(preferred);
+			state = State::IN_USE;
+			return preferred;
+		} else if (state == State::BUSY) {
+			// might be free by now, the stale _busy entry gets skipped
+			state = State::IN_USE;
+			return preferred;
+		}
+	}
+
+	if (_free.empty()) {
+		// give the ones that failed before another chance
+		for (const uint16_t port : _busy) {
+			if (in_range(port) && _state[port - _first] == State::BUSY) {
+				_state[port - _first] = State::FREE;
+				_free_pos[port - _first] = _free.size();
+				_free.push_back(port);
+			}
+		}
+		_busy.clear();
+
+		if (_free.empty()) {
+			return 0;
+		}
+	}
+
+	const uint16_t port = _free.back();
+	_free.pop_back();
+	_state[port - _first] = State::IN_USE;
+	return port;
+}
+
+void PortAllocator::release(uint16_t port) {
+	if (!in_range(port) || _state[port - _first] != State::IN_USE) {
+		return;
+	}
+
+	_state[port - _first] = State::FREE;
+	_free_pos[port - _first] = _free.size();
+	_free.push_back(port);
+}
+
+void PortAllocator::mark_busy(uint16_t port) {
+	if (!in_range(port) || _state[port - _first] != State::IN_USE) {
+		return;
+	}
+
+	_state[port - _first] = State::BUSY;
+	_busy.push_back(port);
+}
+
+void PortAllocator::free_remove(uint16_t port) {
+	// swap with the top
+	const uint32_t pos = _free_pos[port - _first];
+	const uint16_t top = _free.back();
+	_free[pos] = top;
+	_free_pos[top - _first] = pos;
+	_free.pop_back();
+}
+
+} // ttt
+
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace ttt {
+
+// hands out local ports from a range in O(1), instead of probing every port.
+// not thread safe
+class PortAllocator {
+	public:
+		// inclusive range
+		PortAllocator(uint16_t first = 20000, uint16_t last = 60000);
+
+		// ports handed out before stay in use, even if outside the new range
+		void set_range(uint16_t first, uint16_t last);
+		uint16_t first(void) const { return _first; }
+		uint16_t last(void) const { return _last; }
+
+		// preferred port if it is not in use, otherwise any free one. 0 if none is left
+		uint16_t acquire(uint16_t preferred = 0);
+		void release(uint16_t port);
+
+		// port failed to bind (someone else has it), only handed out again
+		// once everything else is used up
+		void mark_busy(uint16_t port);
+
+		size_t free_count(void) const { return _free.size() + _busy.size(); }
+		size_t range_size(void) const { return _state.size(); }
+
+	private:
+		enum class State : uint8_t {
+			FREE,
+			IN_USE,
+			BUSY,
+		};
+
+		bool in_range(uint16_t port) const { return port >= _first && port <= _last; }
+		void free_remove(uint16_t port);
+
+		uint16_t _first {0};
+		uint16_t _last {0};
+
+		std::vector<State> _state {}; // port - _first
+		std::vector<uint16_t> _free {}; // stack, lowest port on top initially
+		std::vector<uint32_t> _free_pos {}; // port - _first -> index into _free
+		std::vector<uint16_t> _busy {}; // might contain stale entries
+};
+
+} // ttt
+
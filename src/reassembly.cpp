@@ -0,0 +1,154 @@
+#include "./reassembly.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ttt {
+
+void FragmentHeader::write(uint8_t* buff) const {
+	buff[0] = datagram_id & 0xff;
+	buff[1] = (datagram_id >> 8) & 0xff;
+	buff[2] = index;
+	buff[3] = count;
+}
+
+bool FragmentHeader::read(const uint8_t* buff, size_t buff_size) {
+	if (buff_size < size) {
+		return false;
+	}
+
+	datagram_id = buff[0] | (buff[1] << 8);
+	index = buff[2];
+	count = buff[3];
+
+	return count > 0 && count <= count_max && index < count;
+}
+
+Reassembler::~Reassembler(void) {
+	for (auto& [f_id, slots] : _friends) {
+		for (auto& slot : slots) {
+			free_slot(slot);
+		}
+	}
+}
+
+PacketBuffer* Reassembler::add(uint32_t friend_number, const FragmentHeader& hdr, size_t frag_size_max, const uint8_t* data, size_t size) {
+	const size_t offset = size_t(hdr.index) * frag_size_max;
+	const bool is_last = hdr.index + 1 == hdr.count;
+	if (
+		size > frag_size_max ||
+		(!is_last && size != frag_size_max) ||
+		offset + size > PacketBuffer::capacity
+	) {
+		drops++;
+		return nullptr;
+	}
+
+	auto& slots = _friends[friend_number];
+	if (slots.size() != slots_per_friend_max) {
+		slots.resize(slots_per_friend_max);
+	}
+
+	Slot* slot = nullptr;
+	for (auto& it : slots) {
+		if (it.buffer != nullptr && it.datagram_id == hdr.datagram_id) {
+			slot = &it;
+			break;
+		}
+	}
+
+	if (slot == nullptr) { // new datagram
+		// prefer a free slot, otherwise kick out the oldest
+		auto slot_it = std::find_if(slots.begin(), slots.end(), [](const Slot& it) { return it.buffer == nullptr; });
+		if (slot_it == slots.end()) {
+			slot_it = std::max_element(slots.begin(), slots.end(), [](const Slot& lhs, const Slot& rhs) { return lhs.age < rhs.age; });
+			free_slot(*slot_it);
+			evictions++;
+			failed(friend_number);
+		}
+
+		if (_bytes_in_use + PacketBuffer::capacity > bytes_max) {
+			drops++;
+			return nullptr;
+		}
+
+		slot = &*slot_it;
+		slot->buffer = _pool.acquire();
+		slot->datagram_id = hdr.datagram_id;
+		slot->count = hdr.count;
+		slot->received_mask = 0;
+		slot->age = 0.f;
+		_bytes_in_use += PacketBuffer::capacity;
+	}
+
+	if (slot->count != hdr.count) {
+		drops++; // id reused with a different layout?
+		return nullptr;
+	}
+
+	const uint64_t frag_bit = uint64_t(1) << hdr.index;
+	if (slot->received_mask & frag_bit) {
+		return nullptr; // duplicate
+	}
+
+	std::memcpy(slot->buffer->data() + offset, data, size);
+	slot->received_mask |= frag_bit;
+	if (is_last) {
+		slot->buffer->size = offset + size;
+	}
+
+	const uint64_t full_mask = hdr.count == 64 ? ~uint64_t(0) : (uint64_t(1) << hdr.count) - 1;
+	if (slot->received_mask != full_mask) {
+		return nullptr;
+	}
+
+	// done, hand the buffer over
+	PacketBuffer* complete = slot->buffer;
+	slot->buffer = nullptr;
+	_bytes_in_use -= PacketBuffer::capacity;
+
+	return complete;
+}
+
+void Reassembler::tick(float time_delta) {
+	for (auto& [f_id, slots] : _friends) {
+		for (auto& slot : slots) {
+			if (slot.buffer == nullptr) {
+				continue;
+			}
+
+			slot.age += time_delta;
+			if (slot.age > timeout) {
+				free_slot(slot);
+				timeouts++;
+				failed(f_id);
+			}
+		}
+	}
+}
+
+void Reassembler::remove_friend(uint32_t friend_number) {
+	auto it = _friends.find(friend_number);
+	if (it == _friends.end()) {
+		return;
+	}
+
+	for (auto& slot : it->second) {
+		free_slot(slot);
+	}
+
+	_friends.erase(it);
+}
+
+void Reassembler::free_slot(Slot& slot) {
+	if (slot.buffer == nullptr) {
+		return;
+	}
+
+	_pool.release(slot.buffer);
+	slot.buffer = nullptr;
+	_bytes_in_use -= PacketBuffer::capacity;
+}
+
+} // ttt
+
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "./packet_pool.hpp"
+
+#include <map>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace ttt {
+
+// in front of every fragment of a split datagram
+// [datagram_id (2, little endian)] [index (1)] [count (1)]
+struct FragmentHeader {
+	constexpr static size_t size = 4;
+	// bitmask per datagram
+	constexpr static size_t count_max = 64;
+
+	uint16_t datagram_id {0};
+	uint8_t index {0};
+	uint8_t count {0};
+
+	void write(uint8_t* buff) const;
+	// false if malformed
+	bool read(const uint8_t* buff, size_t buff_size);
+};
+
+// puts split datagrams back together, several at once per friend.
+// memory is bounded by slots_per_friend_max and bytes_max,
+// incomplete datagrams get evicted after timeout
+class Reassembler {
+	public:
+		explicit Reassembler(PacketPool& pool) : _pool(pool) {}
+		~Reassembler(void);
+
+		// concurrent datagrams per friend, oldest gets evicted when a new one needs a slot
+		size_t slots_per_friend_max {8};
+		// seconds an incomplete datagram is kept
+		float timeout {2.f};
+		// over all friends, counted in pool buffers held
+		size_t bytes_max {1024*1024};
+
+		// called for every datagram given up on, eg. for per friend stats
+		using fail_fn_t = void(*)(void* user_data, uint32_t friend_number);
+		fail_fn_t fail_fn {nullptr};
+		void* fail_user_data {nullptr};
+
+		// frag_size_max is the payload size of every fragment except the last.
+		// returns the complete datagram (give it back with release()), nullptr otherwise
+		PacketBuffer* add(uint32_t friend_number, const FragmentHeader& hdr, size_t frag_size_max, const uint8_t* data, size_t size);
+		void release(PacketBuffer* buffer) { _pool.release(buffer); }
+
+		// ages and evicts
+		void tick(float time_delta);
+
+		void remove_friend(uint32_t friend_number);
+
+		size_t bytes_in_use(void) const { return _bytes_in_use; }
+
+	public: // stats
+		uint64_t timeouts {0}; // evicted, because too old
+		uint64_t evictions {0}; // evicted, to make room for a newer one
+		uint64_t drops {0}; // fragments dropped (malformed or over bytes_max)
+
+	private:
+		struct Slot {
+			PacketBuffer* buffer {nullptr}; // nullptr -> unused
+			uint16_t datagram_id {0};
+			uint8_t count {0};
+			uint64_t received_mask {0};
+			float age {0.f};
+		};
+
+		void free_slot(Slot& slot);
+		void failed(uint32_t friend_number) {
+			if (fail_fn != nullptr) {
+				fail_fn(fail_user_data, friend_number);
+			}
+		}
+
+		PacketPool& _pool;
+		std::map<uint32_t, std::vector<Slot>> _friends {};
+		size_t _bytes_in_use {0};
+};
+
+} // ttt
+
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <cassert>
+
+namespace ttt {
+
+// single threaded fifo over preallocated slots, a deque that does not allocate.
+// only reserve() allocates, pushing into a full ring is a bug (check full())
+template<typename T>
+class RingBuffer {
+	public:
+		RingBuffer(void) = default;
+		explicit RingBuffer(size_t capacity) { reserve(capacity); }
+
+		RingBuffer(const RingBuffer&) = delete;
+		RingBuffer(RingBuffer&& other) :
+			_slots(std::move(other._slots)),
+			_capacity(std::exchange(other._capacity, 0)),
+			_head(std::exchange(other._head, 0)),
+			_size(std::exchange(other._size, 0))
+		{}
+
+		// grows to at least capacity, keeps the elements. never shrinks
+		void reserve(size_t capacity) {
+			if (capacity <= _capacity) {
+				return;
+			}
+
+			auto slots = std::make_unique<T[]>(capacity);
+			for (size_t i = 0; i < _size; i++) {
+				slots[i] = std::move((*this)[i]);
+			}
+			_slots = std::move(slots);
+			_capacity = capacity;
+			_head = 0;
+		}
+
+		size_t capacity(void) const { return _capacity; }
+		size_t size(void) const { return _size; }
+		bool empty(void) const { return _size == 0; }
+		bool full(void) const { return _size == _capacity; }
+
+		// i from the front
+		T& operator[](size_t i) { return _slots[wrap(_head + i)]; }
+		const T& operator[](size_t i) const { return _slots[wrap(_head + i)]; }
+
+		T& front(void) { assert(!empty()); return _slots[_head]; }
+		const T& front(void) const { assert(!empty()); return _slots[_head]; }
+		T& back(void) { assert(!empty()); return (*this)[_size - 1]; }
+		const T& back(void) const { assert(!empty()); return (*this)[_size - 1]; }
+
+		void push_back(T value) {
+			assert(!full());
+			_slots[wrap(_head + _size)] = std::move(value);
+			_size++;
+		}
+
+		void push_front(T value) {
+			assert(!full());
+			_head = _head == 0 ? _capacity - 1 : _head - 1;
+			_slots[_head] = std::move(value);
+			_size++;
+		}
+
+		void pop_front(void) {
+			assert(!empty());
+			_head = wrap(_head + 1);
+			_size--;
+		}
+
+		// first element equal to value, later ones move up. false if not found
+		bool erase(const T& value) {
+			for (size_t i = 0; i < _size; i++) {
+				if ((*this)[i] == value) {
+					for (; i + 1 < _size; i++) {
+						(*this)[i] = std::move((*this)[i + 1]);
+					}
+					_size--;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void clear(void) {
+			_head = 0;
+			_size = 0;
+		}
+
+	private:
+		size_t wrap(size_t i) const { return i >= _capacity ? i - _capacity : i; }
+
+		std::unique_ptr<T[]> _slots {};
+		size_t _capacity {0};
+		size_t _head {0};
+		size_t _size {0};
+};
+
+} // ttt
+
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cassert>
+
+namespace ttt {
+
+// bounded single producer single consumer ring of preallocated slots.
+// slots are filled/read in place, so nothing gets copied or allocated after construction
+template<typename T>
+class SPSCRing {
+	public:
+		// capacity has to be a power of 2
+		explicit SPSCRing(size_t capacity) : _slots(std::make_unique<T[]>(capacity)), _mask(capacity-1) {
+			assert(capacity > 0 && (capacity & (capacity-1)) == 0);
+		}
+
+		SPSCRing(const SPSCRing&) = delete;
+
+		size_t capacity(void) const { return _mask + 1; }
+
+		// not exact while the other side is working
+		size_t size(void) const {
+			return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+		}
+
+	public: // producer
+		// next free slot, nullptr if full. slot is only visible to the consumer after push()
+		T* alloc(void) {
+			const size_t tail = _tail.load(std::memory_order_relaxed);
+			if (tail - _head_cache == capacity()) {
+				_head_cache = _head.load(std::memory_order_acquire);
+				if (tail - _head_cache == capacity()) {
+					return nullptr;
+				}
+			}
+
+			return &_slots[tail & _mask];
+		}
+
+		void push(void) {
+			_tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+	public: // consumer
+		// oldest slot, nullptr if empty. stays valid until pop()
+		T* front(void) {
+			const size_t head = _head.load(std::memory_order_relaxed);
+			if (head == _tail_cache) {
+				_tail_cache = _tail.load(std::memory_order_acquire);
+				if (head == _tail_cache) {
+					return nullptr;
+				}
+			}
+
+			return &_slots[head & _mask];
+		}
+
+		void pop(void) {
+			_head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+	private:
+		std::unique_ptr<T[]> _slots;
+		const size_t _mask;
+
+		// consumer owned
+		alignas(64) std::atomic<size_t> _head {0};
+		size_t _tail_cache {0};
+
+		// producer owned
+		alignas(64) std::atomic<size_t> _tail {0};
+		size_t _head_cache {0};
+};
+
+} // ttt
+
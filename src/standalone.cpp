@@ -55,6 +55,7 @@ int main(int argc, char** argv) {
 	}
 
 	ttt::tracker_start(torrent_db, torrent_db_mutex);
+	ttt::tracker_set_metrics_fn(ttt::tox_client_metrics);
 
 #if 0
 	{ // hack pause main thread for 30s to wait for dht
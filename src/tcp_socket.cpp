@@ -0,0 +1,221 @@
+#include "./tcp_socket.hpp"
+
+#ifdef _WIN32
+	#include <winsock2.h>
+	using socklen_t = int;
+#else
+	#include <sys/socket.h>
+	#include <netinet/in.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <cerrno>
+#endif
+
+namespace ttt {
+
+#ifdef _WIN32
+static bool last_would_block(void) {
+	const int err = WSAGetLastError();
+	return err == WSAEWOULDBLOCK || err == WSAEINPROGRESS;
+}
+
+static void close_handle(int handle) {
+	closesocket(handle);
+}
+#else
+static bool last_would_block(void) {
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS || errno == EINTR;
+}
+
+static void close_handle(int handle) {
+	::close(handle);
+}
+#endif
+
+static bool set_non_blocking(int handle) {
+#ifdef _WIN32
+	u_long on = 1;
+	return ioctlsocket(handle, FIONBIO, &on) == 0;
+#else
+	const int flags = fcntl(handle, F_GETFL, 0);
+	return flags >= 0 && fcntl(handle, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+static int new_socket(void) {
+	const int handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (handle < 0) {
+		return -1;
+	}
+
+	if (!set_non_blocking(handle)) {
+		close_handle(handle);
+		return -1;
+	}
+
+	return handle;
+}
+
+TCPSocket::TCPSocket(TCPSocket&& other) {
+	_handle = other._handle;
+	other._handle = -1;
+}
+
+TCPSocket& TCPSocket::operator=(TCPSocket&& other) {
+	if (this != &other) {
+		close();
+		_handle = other._handle;
+		other._handle = -1;
+	}
+	return *this;
+}
+
+TCPSocket::~TCPSocket(void) {
+	close();
+}
+
+bool TCPSocket::listen(uint32_t host, uint16_t port) {
+	close();
+
+	_handle = new_socket();
+	if (_handle < 0) {
+		return false;
+	}
+
+	// so a restart can take the port right back
+	int on = 1;
+	setsockopt(_handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+
+	sockaddr_in sa {};
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = host;
+	sa.sin_port = htons(port);
+
+	if (bind(_handle, reinterpret_cast<const sockaddr*>(&sa), sizeof(sa)) != 0 || ::listen(_handle, SOMAXCONN) != 0) {
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+bool TCPSocket::accept(TCPSocket& remote) {
+	if (!is_open()) {
+		return false;
+	}
+
+	const int handle = ::accept(_handle, nullptr, nullptr);
+	if (handle < 0) {
+		return false;
+	}
+
+	if (!set_non_blocking(handle)) {
+		close_handle(handle);
+		return false;
+	}
+
+	remote = TCPSocket{};
+	remote._handle = handle;
+
+	return true;
+}
+
+bool TCPSocket::connect(const zed_net_address_t& addr) {
+	close();
+
+	_handle = new_socket();
+	if (_handle < 0) {
+		return false;
+	}
+
+	sockaddr_in sa {};
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = addr.host; // already network order
+	sa.sin_port = htons(addr.port);
+
+	if (::connect(_handle, reinterpret_cast<const sockaddr*>(&sa), sizeof(sa)) != 0 && !last_would_block()) {
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+bool TCPSocket::connect_finish(void) {
+	if (!is_open()) {
+		return false;
+	}
+
+	int err = 0;
+	socklen_t err_len = sizeof(err);
+	if (getsockopt(_handle, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&err), &err_len) != 0) {
+		return false;
+	}
+
+	return err == 0;
+}
+
+int TCPSocket::read(uint8_t* data, size_t size) {
+	const auto ret = recv(_handle, reinterpret_cast<char*>(data), int(size), 0);
+	if (ret > 0) {
+		return int(ret);
+	} else if (ret == 0) {
+		return closed;
+	} else if (last_would_block()) {
+		return would_block;
+	}
+
+	return error;
+}
+
+int TCPSocket::write(const uint8_t* data, size_t size) {
+#ifdef MSG_NOSIGNAL
+	const int flags = MSG_NOSIGNAL; // a torrent client going away is not a reason to die
+#else
+	const int flags = 0;
+#endif
+	const auto ret = send(_handle, reinterpret_cast<const char*>(data), int(size), flags);
+	if (ret >= 0) {
+		return int(ret);
+	} else if (last_would_block()) {
+		return would_block;
+	}
+
+	return error;
+}
+
+uint16_t TCPSocket::local_port(void) const {
+	if (!is_open()) {
+		return 0;
+	}
+
+	sockaddr_in sa {};
+	socklen_t sa_len = sizeof(sa);
+	if (getsockname(_handle, reinterpret_cast<sockaddr*>(&sa), &sa_len) != 0) {
+		return 0;
+	}
+
+	return ntohs(sa.sin_port);
+}
+
+void TCPSocket::shutdown_write(void) {
+	if (!is_open()) {
+		return;
+	}
+
+#ifdef _WIN32
+	shutdown(_handle, SD_SEND);
+#else
+	shutdown(_handle, SHUT_WR);
+#endif
+}
+
+void TCPSocket::close(void) {
+	if (_handle >= 0) {
+		close_handle(_handle);
+		_handle = -1;
+	}
+}
+
+} // ttt
+
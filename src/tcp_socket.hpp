@@ -0,0 +1,55 @@
+#pragma once
+
+#include <zed_net.h>
+
+#include <cstdint>
+#include <cstddef>
+
+namespace ttt {
+
+// non-blocking tcp socket used by the tcp tunnels.
+// zed_net's tcp functions can not do non-blocking connects, so this talks bsd sockets directly
+class TCPSocket {
+	public:
+		// read()/write() results besides the byte count
+		constexpr static int would_block = 0;
+		constexpr static int closed = -1; // read only, the other side is done sending
+		constexpr static int error = -2;
+
+	public:
+		TCPSocket(void) = default;
+		TCPSocket(const TCPSocket&) = delete;
+		TCPSocket(TCPSocket&& other);
+		TCPSocket& operator=(TCPSocket&& other);
+		~TCPSocket(void);
+
+		// host in network order, 0 for any
+		bool listen(uint32_t host, uint16_t port);
+		// false if there is nothing to accept
+		bool accept(TCPSocket& remote);
+
+		// starts connecting, false if it failed right away.
+		// the socket becomes writable once done, then call connect_finish()
+		bool connect(const zed_net_address_t& addr);
+		// false if the connect failed
+		bool connect_finish(void);
+
+		int read(uint8_t* data, size_t size);
+		int write(const uint8_t* data, size_t size);
+
+		// sends a fin once everything written is out
+		void shutdown_write(void);
+		void close(void);
+
+		// port actually bound, eg. after listen() on 0
+		uint16_t local_port(void) const;
+
+		bool is_open(void) const { return _handle >= 0; }
+		int handle(void) const { return _handle; }
+
+	private:
+		int _handle {-1};
+};
+
+} // ttt
+
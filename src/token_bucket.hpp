@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+namespace ttt {
+
+// classic token bucket, in bytes. a rate of 0 means unlimited
+struct TokenBucket {
+	float rate {0.f}; // bytes per second
+	float burst {0.f}; // max tokens, also the starting amount
+	float tokens {0.f};
+	std::chrono::steady_clock::time_point last_refill {};
+
+	bool unlimited(void) const { return rate <= 0.f; }
+
+	// burst defaults to a quarter second worth of data, but at least one large datagram
+	void set_rate(float new_rate, float new_burst = 0.f) {
+		const bool was_unlimited = unlimited();
+		rate = new_rate;
+		burst = new_burst > 0.f ? new_burst : std::max(new_rate * 0.25f, 4096.f);
+		tokens = was_unlimited ? burst : std::min(tokens, burst);
+	}
+
+	// a long idle time just fills it up to burst
+	void refill(std::chrono::steady_clock::time_point now) {
+		if (!unlimited()) {
+			const float time_delta = std::chrono::duration<float>(now - last_refill).count();
+			tokens = std::min(burst, tokens + rate * std::max(time_delta, 0.f));
+		}
+		last_refill = now;
+	}
+
+	bool can_consume(size_t bytes) const {
+		return unlimited() || tokens >= bytes;
+	}
+
+	void consume(size_t bytes) {
+		if (!unlimited()) {
+			tokens -= bytes;
+		}
+	}
+
+	// seconds until bytes can be consumed
+	float time_until(size_t bytes) const {
+		if (can_consume(bytes)) {
+			return 0.f;
+		}
+		return (bytes - tokens) / rate;
+	}
+};
+
+} // ttt
+
@@ -5,6 +5,7 @@
 #include <unordered_map>
 #include <set>
 #include <string>
+#include <atomic>
 
 // contains friend/group ids and timestamps
 struct TorrentToxInfo {
@@ -16,11 +17,43 @@ struct TorrentDB {
 		//Torrent torrent;
 		bool self {false};
 		TorrentToxInfo torrent_tox_info {};
+
+		// bumped whenever the peer list of this torrent might have changed, so the tracker can cache responses.
+		// readable without the mutex, entries are never removed
+		std::atomic<uint64_t> generation {0};
 	};
 	std::unordered_map<Torrent, TorrentEntry> torrents {};
 
 	// mapps friend -> port
 	// ext_tunnel_udp controlled
 	std::unordered_map<uint32_t, uint16_t> peers {};
+
+	// mapps friend -> host, only for tunnels on the shared socket,
+	// everyone else uses the trackers tunnel host
+	// ext_tunnel_udp controlled
+	std::unordered_map<uint32_t, std::string> peer_hosts {};
+
+	// mapps friend -> tcp port, usually the same as in peers
+	// ext_tunnel_tcp controlled
+	std::unordered_map<uint32_t, uint16_t> tcp_peers {};
+
+	// call after changing peers, peer_hosts or tcp_peers of friend f
+	void friend_peers_changed(const uint32_t f) {
+		for (auto& [_torrent, entry] : torrents) {
+			if (entry.torrent_tox_info.friends.count(f)) {
+				entry.generation++;
+			}
+		}
+	}
+
+	// false if f was already known for t
+	bool add_torrent_friend(const Torrent& t, const uint32_t f) {
+		auto& entry = torrents[t];
+		if (!entry.torrent_tox_info.friends.emplace(f).second) {
+			return false;
+		}
+		entry.generation++;
+		return true;
+	}
 };
 
@@ -1,10 +1,15 @@
 #include "./tox_chat_commands.hpp"
-#include "ext_tunnel_udp.hpp"
+#include "ext_tunnel_udp2.hpp"
+#include "ext_tunnel_tcp.hpp"
 #include "tracker.hpp"
 
 #include <limits>
+#include <cmath>
 #include <optional>
 #include <string>
+#include <chrono>
+#include <iterator>
+#include <cstdio>
 #include <map>
 #include <functional>
 #include <mutex>
@@ -18,7 +23,7 @@ namespace ttt {
 const static std::map<std::string, ChatCommand> chat_commands = {
 	// general
 	{{"help"},					{ToxClient::PermLevel::USER, chat_command_help, "list this help"}},
-	{{"info"},					{ToxClient::PermLevel::USER, [](auto, auto){}, "general info, including tracker url, friend count, uptime and transfer rates"}},
+	{{"info"},					{ToxClient::PermLevel::USER, chat_command_info, "general info, including tracker url, friend count, uptime and transfer rates"}},
 	{{"list"},					{ToxClient::PermLevel::USER, chat_command_list, "lists info hashes"}},
 	{{"list_magnet"},			{ToxClient::PermLevel::USER, chat_command_list_magnet, "lists info hashes as magnet links"}},
 	{{"myaddress"},				{ToxClient::PermLevel::ADMIN, chat_command_myaddress, "get the address to add"}},
@@ -38,6 +43,18 @@ const static std::map<std::string, ChatCommand> chat_commands = {
 	// tunnel
 	{{"tunnel_host_set"},		{ToxClient::PermLevel::ADMIN, chat_command_tunnel_host_set, "<string> - sets a new tunnel host, default is 127.0.0.1, but torrentclients tend to ignore loopback addr"}},
 	{{"tunnel_host_get"},		{ToxClient::PermLevel::ADMIN, chat_command_tunnel_host_get, ""}},
+	{{"tunnel_shared_socket_set"},	{ToxClient::PermLevel::ADMIN, chat_command_tunnel_shared_socket_set, "<on|off> - all tunnels share one udp socket, each friend gets its own 127.x address (torrent client needs to accept loopback peers). applies to new tunnels"}},
+	{{"tunnel_shared_socket_get"},	{ToxClient::PermLevel::ADMIN, chat_command_tunnel_shared_socket_get, ""}},
+	{{"tunnel_coalesce_set"},	{ToxClient::PermLevel::ADMIN, chat_command_tunnel_coalesce_set, "<on|off> - pack small datagrams into one tox packet, less overhead for ack heavy traffic, adds up to 2ms latency"}},
+	{{"tunnel_coalesce_get"},	{ToxClient::PermLevel::ADMIN, chat_command_tunnel_coalesce_get, ""}},
+	{{"tunnel_link_stats"},		{ToxClient::PermLevel::ADMIN, chat_command_tunnel_link_stats, "measured loss and rtt per tunnel, and which path is used"}},
+	{{"tunnel_port_range_set"},	{ToxClient::PermLevel::ADMIN, chat_command_tunnel_port_range_set, "<first> <last> - local ports used for tunnels, default is 20000 60000. applies to new tunnels"}},
+	{{"tunnel_port_range_get"},	{ToxClient::PermLevel::ADMIN, chat_command_tunnel_port_range_get, ""}},
+	{{"tunnel_socket_burst_set"},	{ToxClient::PermLevel::ADMIN, chat_command_tunnel_socket_burst_set, "<datagrams> - max read from one tunnel per wakeup, so a busy one can not starve the others. default is 64"}},
+	{{"tunnel_socket_burst_get"},	{ToxClient::PermLevel::ADMIN, chat_command_tunnel_socket_burst_get, ""}},
+	{{"tunnel_tcp_stats"},		{ToxClient::PermLevel::ADMIN, chat_command_tunnel_tcp_stats, "open tcp streams and what went through them"}},
+	{{"tunnel_latency"},		{ToxClient::PermLevel::ADMIN, chat_command_tunnel_latency, "[reset] - time datagrams spend in ttt (percentiles), per direction and tox packet kind"}},
+	{{"tunnel_queue_stats"},	{ToxClient::PermLevel::ADMIN, chat_command_tunnel_queue_stats, "queued and unsent datagrams per tunnel, which sockets are paused and what got dropped"}},
 
 	// TODO: move this comment to help
 	// this info is used for remote peers trying to connect. (todo: implement tracker defined port, since it knows)
@@ -45,6 +62,12 @@ const static std::map<std::string, ChatCommand> chat_commands = {
 	{{"torrent_client_host_get"}, {ToxClient::PermLevel::ADMIN, chat_command_torrent_client_host_get, ""}},
 	{{"torrent_client_port_set"}, {ToxClient::PermLevel::ADMIN, chat_command_torrent_client_port_set, "<string> - sets the port your torrent program is running on, defualt is 51413"}},
 	{{"torrent_client_port_get"}, {ToxClient::PermLevel::ADMIN, chat_command_torrent_client_port_get, ""}},
+	{{"tunnel_rate_limit_set"},	{ToxClient::PermLevel::ADMIN, chat_command_tunnel_rate_limit_set, "<KiB/s> - limits what all tunnels together send to friends, 0 is unlimited (default)"}},
+	{{"tunnel_rate_limit_get"},	{ToxClient::PermLevel::ADMIN, chat_command_tunnel_rate_limit_get, ""}},
+	{{"tunnel_friend_rate_limit_set"}, {ToxClient::PermLevel::ADMIN, chat_command_tunnel_friend_rate_limit_set, "<KiB/s> [pubkey] - limits what is sent to each friend, or only to pubkey. 0 is unlimited (default), -1 removes the pubkey override"}},
+	{{"tunnel_friend_rate_limit_get"}, {ToxClient::PermLevel::ADMIN, chat_command_tunnel_friend_rate_limit_get, "[pubkey]"}},
+	{{"tunnel_fec_set"},		{ToxClient::PermLevel::ADMIN, chat_command_tunnel_fec_set, "<redundancy> [pubkey] - send large datagrams lossy with parity, eg. 0.5 is 1 parity per 2 fragments. 0 is off (default), max 1, -1 removes the pubkey override"}},
+	{{"tunnel_fec_get"},		{ToxClient::PermLevel::ADMIN, chat_command_tunnel_fec_get, "[pubkey]"}},
 
 	// tracker
 	{{"tracker_restart"},		{ToxClient::PermLevel::ADMIN, [](auto, auto){}, "restarts the tracker thread"}},
@@ -145,6 +168,28 @@ static std::vector<std::string_view> cc_prepare_params(uint32_t friend_number, s
 	return params_vec;
 }
 
+// "on" or "off", tells the friend otherwise
+static std::optional<bool> cc_parse_on_off(uint32_t friend_number, std::string_view param) {
+	if (param == "on") {
+		return true;
+	} else if (param == "off") {
+		return false;
+	}
+
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "invalid value, use on or off");
+	return std::nullopt;
+}
+
+// hex public key, empty and tells the friend if it is not one
+static std::vector<uint8_t> cc_parse_pubkey(uint32_t friend_number, std::string_view param) {
+	auto pubkey = hex2bin(std::string{param});
+	if (pubkey.size() != TOX_PUBLIC_KEY_SIZE) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "pubkey has the wrong length");
+		return {};
+	}
+	return pubkey;
+}
+
 void chat_command_help(uint32_t friend_number, std::string_view) {
 	std::string reply {};
 	reply += "commands:\n";
@@ -156,6 +201,86 @@ void chat_command_help(uint32_t friend_number, std::string_view) {
 	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE::TOX_MESSAGE_TYPE_NORMAL, reply);
 }
 
+// 1536 -> "1.5 KiB"
+static std::string cc_format_bytes(double bytes) {
+	const char* units[] {"B", "KiB", "MiB", "GiB", "TiB"};
+	size_t unit = 0;
+	while (bytes >= 1024. && unit + 1 < std::size(units)) {
+		bytes /= 1024.;
+		unit++;
+	}
+
+	char buff[32];
+	std::snprintf(buff, sizeof(buff), "%.1f %s", bytes, units[unit]);
+	return buff;
+}
+
+static std::string cc_format_traffic(const ext::ToxExtTunnelUDP2::TrafficStats::Direction& dir) {
+	std::string str {cc_format_bytes(dir.bytes_rate) + "/s"};
+	str += " (" + std::to_string(int64_t(dir.packets_rate)) + " pkt/s)";
+	str += ", " + cc_format_bytes(dir.bytes) + " total";
+	str += ", " + std::to_string(dir.drops) + " dropped";
+	return str;
+}
+
+void chat_command_info(uint32_t friend_number, std::string_view) {
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+
+	std::string reply {};
+
+	const std::string tracker_url = tracker_announce_url();
+	reply += "tracker: " + (tracker_url.empty() ? std::string{"not running"} : tracker_url) + "\n";
+	if (!tracker_url.empty()) {
+		reply += "udp tracker: " + tracker_udp_announce_url() + "\n";
+	}
+
+	const uint64_t uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - _tox_client->start_time).count();
+	reply += "uptime: ";
+	if (uptime >= 24*60*60) {
+		reply += std::to_string(uptime / (24*60*60)) + "d ";
+	}
+	reply += std::to_string((uptime / (60*60)) % 24) + "h ";
+	reply += std::to_string((uptime / 60) % 60) + "m ";
+	reply += std::to_string(uptime % 60) + "s\n";
+
+	std::vector<uint32_t> friend_list;
+	friend_list.resize(tox_self_get_friend_list_size(_tox_client->tox));
+	tox_self_get_friend_list(_tox_client->tox, friend_list.data());
+	size_t online_count = 0;
+	for (const uint32_t f : friend_list) {
+		if (tox_friend_get_connection_status(_tox_client->tox, f, nullptr) != TOX_CONNECTION_NONE) {
+			online_count++;
+		}
+	}
+	reply += "friends: " + std::to_string(online_count) + " online, " + std::to_string(friend_list.size()) + " total\n";
+
+	{
+		const std::lock_guard mutex_lock(_tox_client->torrent_db_mutex);
+		reply += "torrents: " + std::to_string(_tox_client->torrent_db.torrents.size()) + "\n";
+	}
+
+	const auto stats = ext_tunnel->traffic_stats();
+	const auto total = ext_tunnel->traffic_total();
+	reply += "tunnels: " + std::to_string(stats.size()) + "\n";
+	reply += "to friends: " + cc_format_traffic(total.to_friend) + "\n";
+	reply += "from friends: " + cc_format_traffic(total.from_friend);
+	reply += ", " + std::to_string(total.from_friend.reassembly_failures) + " reassembly failed";
+
+	// who is using how much is not for everyone
+	if (_tox_client->friend_has_perm(friend_number, ToxClient::PermLevel::ADMIN)) {
+		for (const auto& it : stats) {
+			reply += "\n  " + std::to_string(it.friend_number) + ":";
+			reply += " up " + cc_format_bytes(it.to_friend.bytes_rate) + "/s";
+			reply += " down " + cc_format_bytes(it.from_friend.bytes_rate) + "/s";
+			reply += " fragments " + std::to_string(it.to_friend.fragments) + "/" + std::to_string(it.from_friend.fragments);
+			reply += " dropped " + std::to_string(it.to_friend.drops) + "/" + std::to_string(it.from_friend.drops);
+			reply += " reassembly failed " + std::to_string(it.from_friend.reassembly_failures);
+		}
+	}
+
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE::TOX_MESSAGE_TYPE_NORMAL, reply);
+}
+
 void chat_command_list(uint32_t friend_number, std::string_view) {
 	std::string reply {"currently indexed:\n"};
 	{
@@ -186,6 +311,9 @@ void chat_command_list(uint32_t friend_number, std::string_view) {
 }
 
 void chat_command_list_magnet(uint32_t friend_number, std::string_view) {
+	// before torrent_db_mutex, the tracker locks the other way around
+	const std::string tracker_url = tracker_announce_url();
+
 	std::string reply {"currently indexed:\n"};
 	{
 		const std::lock_guard mutex_lock(_tox_client->torrent_db_mutex);
@@ -196,7 +324,7 @@ void chat_command_list_magnet(uint32_t friend_number, std::string_view) {
 				if (entry.first.info_hash_v1) {
 					reply += "  magnet:?xt=urn:btih:" + std::to_string(*entry.first.info_hash_v1)
 						//+ "&dn=name" // TODO: more meta info
-						+ "&tr=http://localhost:8000/announce" // TODO: fetch tacker url
+						+ "&tr=" + tracker_url
 						//+ "&x.pe=localhost:5555" // TODO: even peers
 					;
 
@@ -288,9 +416,8 @@ void chat_command_friend_remove(uint32_t friend_number, std::string_view params)
 		return;
 	}
 
-	auto pubkey = hex2bin(std::string{params_vec.front()});
-	if (pubkey.size() != TOX_PUBLIC_KEY_SIZE) {
-		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "pubkey has the wrong length");
+	const auto pubkey = cc_parse_pubkey(friend_number, params_vec.front());
+	if (pubkey.empty()) {
 		return;
 	}
 
@@ -342,9 +469,8 @@ void chat_command_friend_permission_set(uint32_t friend_number, std::string_view
 		return;
 	}
 
-	auto pubkey = hex2bin(std::string{params_vec.front()});
-	if (pubkey.size() != TOX_PUBLIC_KEY_SIZE) {
-		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "pubkey has the wrong length");
+	const auto pubkey = cc_parse_pubkey(friend_number, params_vec.front());
+	if (pubkey.empty()) {
 		return;
 	}
 
@@ -383,9 +509,8 @@ void chat_command_friend_permission_get(uint32_t friend_number, std::string_view
 		return;
 	}
 
-	auto pubkey = hex2bin(std::string{params_vec.front()});
-	if (pubkey.size() != TOX_PUBLIC_KEY_SIZE) {
-		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "pubkey has the wrong length");
+	const auto pubkey = cc_parse_pubkey(friend_number, params_vec.front());
+	if (pubkey.empty()) {
 		return;
 	}
 
@@ -420,6 +545,238 @@ void chat_command_tunnel_host_get(uint32_t friend_number, std::string_view) {
 	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "NOT IMPLEMENTED");
 }
 
+void chat_command_tunnel_shared_socket_set(uint32_t friend_number, std::string_view params) {
+	auto params_vec = cc_prepare_params(friend_number, params, 1);
+	if (params_vec.empty()) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "missing parameters <on|off>");
+		return;
+	}
+
+	const auto new_value = cc_parse_on_off(friend_number, params_vec.front());
+	if (!new_value.has_value()) {
+		return;
+	}
+
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+	ext_tunnel->shared_socket = *new_value;
+
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, std::string{"shared socket "} + (*new_value ? "on" : "off") + ", applies to new tunnels");
+}
+
+void chat_command_tunnel_shared_socket_get(uint32_t friend_number, std::string_view) {
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+	std::string reply {"shared socket: "};
+	reply += ext_tunnel->shared_socket ? "on" : "off";
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, reply);
+}
+
+void chat_command_tunnel_coalesce_set(uint32_t friend_number, std::string_view params) {
+	auto params_vec = cc_prepare_params(friend_number, params, 1);
+	if (params_vec.empty()) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "missing parameters <on|off>");
+		return;
+	}
+
+	const auto new_value = cc_parse_on_off(friend_number, params_vec.front());
+	if (!new_value.has_value()) {
+		return;
+	}
+
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+	ext_tunnel->coalesce = *new_value;
+
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, std::string{"coalescing "} + (*new_value ? "on" : "off"));
+}
+
+void chat_command_tunnel_coalesce_get(uint32_t friend_number, std::string_view) {
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+	std::string reply {"coalescing: "};
+	reply += ext_tunnel->coalesce ? "on" : "off";
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, reply);
+}
+
+void chat_command_tunnel_link_stats(uint32_t friend_number, std::string_view) {
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+
+	const auto stats = ext_tunnel->link_stats();
+	if (stats.empty()) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "no tunnels");
+		return;
+	}
+
+	std::string reply {"tunnels:"};
+	for (const auto& it : stats) {
+		reply += "\n  " + std::to_string(it.friend_number) + ":";
+		reply += " loss " + std::to_string(int(it.loss * 1000.f) / 10.f) + "%";
+		reply += " rtt " + std::to_string(int(it.rtt * 1000.f)) + "ms";
+		reply += " (+-" + std::to_string(int(it.rtt_var * 1000.f)) + "ms)";
+		reply += " probes " + std::to_string(it.probes_lost) + "/" + std::to_string(it.probes_sent) + " lost";
+		reply += std::string{" small:"} + (it.small_lossless ? "lossless" : "lossy");
+		if (it.fec_redundancy > 0.f) {
+			reply += " large:fec(" + std::to_string(it.fec_redundancy) + ")";
+		} else {
+			reply += std::string{" large:"} + (it.large_lossy ? "lossy" : "lossless");
+		}
+	}
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, reply);
+}
+
+void chat_command_tunnel_tcp_stats(uint32_t friend_number, std::string_view) {
+	auto* ext_tcp = static_cast<ext::ToxExtTunnelTCP*>(_tox_client->extensions.at(2).get());
+
+	std::string reply {"tcp streams: "};
+	reply += std::to_string(ext_tcp->stream_count()) + " open";
+	reply += ", " + std::to_string(ext_tcp->stats.streams_opened) + " opened";
+	reply += ", " + std::to_string(ext_tcp->stats.streams_refused) + " refused";
+	reply += "\nsent " + std::to_string(ext_tcp->stats.bytes_to_friends / 1024) + " KiB";
+	reply += ", received " + std::to_string(ext_tcp->stats.bytes_from_friends / 1024) + " KiB";
+	reply += "\ntox busy " + std::to_string(ext_tcp->stats.sendq_full) + " times";
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, reply);
+}
+
+// 1500 -> "1.5ms"
+static std::string cc_format_us(uint64_t us) {
+	char buff[32];
+	if (us < 1000) {
+		std::snprintf(buff, sizeof(buff), "%luus", (unsigned long)us);
+	} else if (us < 1000*1000) {
+		std::snprintf(buff, sizeof(buff), "%.1fms", us / 1000.);
+	} else {
+		std::snprintf(buff, sizeof(buff), "%.2fs", us / (1000.*1000.));
+	}
+	return buff;
+}
+
+void chat_command_tunnel_latency(uint32_t friend_number, std::string_view params) {
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+
+	if (params == "reset") {
+		ext_tunnel->latency_reset();
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "latency stats reset");
+		return;
+	} else if (!params.empty()) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "unknown parameter, only reset");
+		return;
+	}
+
+	using Path = ext::ToxExtTunnelUDP2::LatencyPath;
+	std::string reply {"latency:"};
+	for (const bool to_friend : {true, false}) {
+		for (const Path path : {Path::LOSSY, Path::LOSSLESS}) {
+			const auto& h = to_friend ? ext_tunnel->latency_to_friend(path) : ext_tunnel->latency_from_friend(path);
+
+			reply += std::string{"\n  "} + (to_friend ? "to friends" : "from friends");
+			reply += path == Path::LOSSY ? " lossy: " : " lossless: ";
+			if (h.count() == 0) {
+				reply += "-";
+				continue;
+			}
+			reply += "p50 " + cc_format_us(h.value_at_quantile(0.5));
+			reply += " p90 " + cc_format_us(h.value_at_quantile(0.9));
+			reply += " p99 " + cc_format_us(h.value_at_quantile(0.99));
+			reply += " p99.9 " + cc_format_us(h.value_at_quantile(0.999));
+			reply += " max " + cc_format_us(h.max());
+			reply += " (" + std::to_string(h.count()) + ")";
+		}
+	}
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, reply);
+}
+
+void chat_command_tunnel_queue_stats(uint32_t friend_number, std::string_view) {
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+
+	std::string reply {"tunnels:"};
+	for (const auto& it : ext_tunnel->queue_stats()) {
+		reply += "\n  " + std::to_string(it.friend_number) + ":";
+		reply += " queued " + std::to_string(it.queued);
+		reply += " unsent " + std::to_string(it.unsent);
+		if (it.paused) {
+			reply += " (paused)";
+		}
+	}
+	reply += "\ntox busy " + std::to_string(ext_tunnel->sendq_full) + " times, " + std::to_string(ext_tunnel->sendq_retries) + " retried";
+	reply += "\npaused " + std::to_string(ext_tunnel->pauses) + " times";
+	reply += "\ndropped: queue full " + std::to_string(ext_tunnel->queue_drops);
+	reply += ", paused " + std::to_string(ext_tunnel->paused_drops.load(std::memory_order_relaxed));
+	reply += ", burst " + std::to_string(ext_tunnel->burst_drops.load(std::memory_order_relaxed));
+	reply += ", ring " + std::to_string(ext_tunnel->from_udp_drops.load(std::memory_order_relaxed));
+	reply += "/" + std::to_string(ext_tunnel->to_udp_drops.load(std::memory_order_relaxed));
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, reply);
+}
+
+void chat_command_tunnel_port_range_set(uint32_t friend_number, std::string_view params) {
+	auto params_vec = cc_prepare_params(friend_number, params, 2);
+	if (params_vec.size() != 2) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "missing parameters <first> <last>");
+		return;
+	}
+
+	uint64_t ports[2] {0, 0};
+	for (size_t i = 0; i < 2; i++) {
+		try {
+			ports[i] = std::stoul(std::string{params_vec.at(i)});
+		} catch(...) {
+			tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "invalid port");
+			return;
+		}
+
+		if (ports[i] == 0 || ports[i] > std::numeric_limits<uint16_t>::max()) {
+			tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "invalid port, out of range");
+			return;
+		}
+	}
+
+	if (ports[0] > ports[1]) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "first port has to be smaller than last");
+		return;
+	}
+
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+	ext_tunnel->port_range_first = ports[0];
+	ext_tunnel->port_range_last = ports[1];
+
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "set port range " + std::to_string(ports[0]) + "-" + std::to_string(ports[1]) + ", applies to new tunnels");
+}
+
+void chat_command_tunnel_port_range_get(uint32_t friend_number, std::string_view) {
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+	std::string reply {"tunnel port range: "};
+	reply += std::to_string(ext_tunnel->port_range_first) + "-" + std::to_string(ext_tunnel->port_range_last);
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, reply);
+}
+
+void chat_command_tunnel_socket_burst_set(uint32_t friend_number, std::string_view params) {
+	auto params_vec = cc_prepare_params(friend_number, params, 1);
+	if (params_vec.empty()) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "missing parameters <datagrams>");
+		return;
+	}
+
+	uint64_t burst {0};
+	try {
+		burst = std::stoul(std::string{params_vec.front()});
+	} catch(...) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "invalid burst");
+		return;
+	}
+
+	// more than fits into the ring does not help
+	if (burst == 0 || burst > ext::ToxExtTunnelUDP2::ring_size) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "invalid burst, has to be in [1, " + std::to_string(ext::ToxExtTunnelUDP2::ring_size) + "]");
+		return;
+	}
+
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+	ext_tunnel->socket_burst_max = burst;
+
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "set socket burst " + std::to_string(burst));
+}
+
+void chat_command_tunnel_socket_burst_get(uint32_t friend_number, std::string_view) {
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "tunnel socket burst: " + std::to_string(ext_tunnel->socket_burst_max.load()));
+}
+
 void chat_command_torrent_client_host_set(uint32_t friend_number, std::string_view params) {
 	auto params_vec = cc_prepare_params(friend_number, params, 1);
 	if (params_vec.empty()) {
@@ -427,7 +784,7 @@ void chat_command_torrent_client_host_set(uint32_t friend_number, std::string_vi
 		return;
 	}
 
-	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP*>(_tox_client->extensions.at(1).get());
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
 
 	std::string new_host {params_vec.front()};
 	zed_net_address_t new_addr {};
@@ -438,12 +795,13 @@ void chat_command_torrent_client_host_set(uint32_t friend_number, std::string_vi
 	}
 
 	ext_tunnel->outbound_address = new_addr;
+	static_cast<ext::ToxExtTunnelTCP*>(_tox_client->extensions.at(2).get())->outbound_address = new_addr;
 
 	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "set new host " + new_host);
 }
 
 void chat_command_torrent_client_host_get(uint32_t friend_number, std::string_view) {
-	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP*>(_tox_client->extensions.at(1).get());
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
 	const char* host_str = zed_net_host_to_str(ext_tunnel->outbound_address.host);
 	if (host_str == nullptr) {
 		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "error getting host");
@@ -476,18 +834,186 @@ void chat_command_torrent_client_port_set(uint32_t friend_number, std::string_vi
 		return;
 	}
 
-	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP*>(_tox_client->extensions.at(1).get());
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
 	ext_tunnel->outbound_address.port = new_port_num_tmp;
+	static_cast<ext::ToxExtTunnelTCP*>(_tox_client->extensions.at(2).get())->outbound_address.port = new_port_num_tmp;
 
 	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "set new port " + std::to_string(new_port_num_tmp));
 }
 
 void chat_command_torrent_client_port_get(uint32_t friend_number, std::string_view) {
-	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP*>(_tox_client->extensions.at(1).get());
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
 	std::string reply {"torrent_client port: "};
 	reply += std::to_string(ext_tunnel->outbound_address.port);
 	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, reply);
 }
 
+// KiB/s from a chat param, allow_negative for "remove"
+static std::optional<float> cc_parse_rate(uint32_t friend_number, std::string_view param, bool allow_negative) {
+	float rate {0.f};
+	try {
+		rate = std::stof(std::string{param});
+	} catch(...) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "invalid rate");
+		return std::nullopt;
+	}
+
+	// stof happily parses "nan" and "inf"
+	if (!std::isfinite(rate)) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "invalid rate, not finite");
+		return std::nullopt;
+	}
+
+	if (rate < 0.f && !allow_negative) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "invalid rate, negative");
+		return std::nullopt;
+	}
+
+	return rate;
+}
+
+static std::string rate_to_string(float bytes_per_second) {
+	if (bytes_per_second <= 0.f) {
+		return "unlimited";
+	}
+	return std::to_string(bytes_per_second / 1024.f) + " KiB/s";
+}
+
+void chat_command_tunnel_rate_limit_set(uint32_t friend_number, std::string_view params) {
+	auto params_vec = cc_prepare_params(friend_number, params, 1);
+	if (params_vec.empty()) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "missing parameters <KiB/s>");
+		return;
+	}
+
+	const auto rate = cc_parse_rate(friend_number, params_vec.front(), false);
+	if (!rate.has_value()) {
+		return;
+	}
+
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+	ext_tunnel->rate_limit_set(*rate * 1024.f);
+
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "set rate limit " + rate_to_string(ext_tunnel->rate_limit_get()));
+}
+
+void chat_command_tunnel_rate_limit_get(uint32_t friend_number, std::string_view) {
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "rate limit: " + rate_to_string(ext_tunnel->rate_limit_get()));
+}
+
+void chat_command_tunnel_friend_rate_limit_set(uint32_t friend_number, std::string_view params) {
+	auto params_vec = cc_split_params(params);
+	if (params_vec.empty() || params_vec.size() > 2) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "expected parameters <KiB/s> [pubkey]");
+		return;
+	}
+
+	const auto rate = cc_parse_rate(friend_number, params_vec.front(), params_vec.size() == 2);
+	if (!rate.has_value()) {
+		return;
+	}
+
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+
+	if (params_vec.size() == 1) {
+		ext_tunnel->friend_rate_limit_set(*rate * 1024.f);
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "set friend rate limit " + rate_to_string(ext_tunnel->friend_rate_limit_get()));
+		return;
+	}
+
+	const auto pubkey = cc_parse_pubkey(friend_number, params_vec.at(1));
+	if (pubkey.empty()) {
+		return;
+	}
+
+	const auto pubkey_hex = bin2hex(pubkey);
+	ext_tunnel->friend_rate_limit_set(pubkey_hex, *rate < 0.f ? -1.f : *rate * 1024.f);
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "set friend rate limit " + rate_to_string(ext_tunnel->friend_rate_limit_get(pubkey_hex)));
+}
+
+void chat_command_tunnel_friend_rate_limit_get(uint32_t friend_number, std::string_view params) {
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+
+	auto params_vec = cc_split_params(params);
+	if (params_vec.empty()) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "friend rate limit: " + rate_to_string(ext_tunnel->friend_rate_limit_get()));
+		return;
+	}
+
+	const auto pubkey = cc_parse_pubkey(friend_number, params_vec.front());
+	if (pubkey.empty()) {
+		return;
+	}
+
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "friend rate limit: " + rate_to_string(ext_tunnel->friend_rate_limit_get(bin2hex(pubkey))));
+}
+
+void chat_command_tunnel_fec_set(uint32_t friend_number, std::string_view params) {
+	auto params_vec = cc_split_params(params);
+	if (params_vec.empty() || params_vec.size() > 2) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "expected parameters <redundancy> [pubkey]");
+		return;
+	}
+
+	float redundancy {0.f};
+	try {
+		redundancy = std::stof(std::string{params_vec.front()});
+	} catch(...) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "invalid redundancy");
+		return;
+	}
+
+	if (!std::isfinite(redundancy)) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "invalid redundancy, not finite");
+		return;
+	}
+
+	// negative only removes a friend override
+	if (redundancy < 0.f && params_vec.size() != 2) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "invalid redundancy, negative");
+		return;
+	}
+
+	if (redundancy > 1.f) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "invalid redundancy, must be in [0, 1]");
+		return;
+	}
+
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+
+	if (params_vec.size() == 1) {
+		ext_tunnel->fec_redundancy_set(redundancy);
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "set fec redundancy " + std::to_string(ext_tunnel->fec_redundancy_get()));
+		return;
+	}
+
+	const auto pubkey = cc_parse_pubkey(friend_number, params_vec.at(1));
+	if (pubkey.empty()) {
+		return;
+	}
+
+	const auto pubkey_hex = bin2hex(pubkey);
+	ext_tunnel->fec_redundancy_set(pubkey_hex, redundancy < 0.f ? -1.f : redundancy);
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "set fec redundancy " + std::to_string(ext_tunnel->fec_redundancy_get(pubkey_hex)));
+}
+
+void chat_command_tunnel_fec_get(uint32_t friend_number, std::string_view params) {
+	auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+
+	auto params_vec = cc_split_params(params);
+	if (params_vec.empty()) {
+		tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "fec redundancy: " + std::to_string(ext_tunnel->fec_redundancy_get()));
+		return;
+	}
+
+	const auto pubkey = cc_parse_pubkey(friend_number, params_vec.front());
+	if (pubkey.empty()) {
+		return;
+	}
+
+	tox_friend_send_message(friend_number, TOX_MESSAGE_TYPE_NORMAL, "fec redundancy: " + std::to_string(ext_tunnel->fec_redundancy_get(bin2hex(pubkey))));
+}
+
 } // ttt
 
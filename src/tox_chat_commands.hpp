@@ -35,11 +35,29 @@ void chat_command_friend_permission_get(uint32_t friend_number, std::string_view
 
 void chat_command_tunnel_host_set(uint32_t friend_number, std::string_view params);
 void chat_command_tunnel_host_get(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_shared_socket_set(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_shared_socket_get(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_coalesce_set(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_coalesce_get(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_link_stats(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_tcp_stats(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_queue_stats(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_latency(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_port_range_set(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_port_range_get(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_socket_burst_set(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_socket_burst_get(uint32_t friend_number, std::string_view params);
 
 void chat_command_torrent_client_host_set(uint32_t friend_number, std::string_view params);
 void chat_command_torrent_client_host_get(uint32_t friend_number, std::string_view params);
 void chat_command_torrent_client_port_set(uint32_t friend_number, std::string_view params);
 void chat_command_torrent_client_port_get(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_rate_limit_set(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_rate_limit_get(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_friend_rate_limit_set(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_friend_rate_limit_get(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_fec_set(uint32_t friend_number, std::string_view params);
+void chat_command_tunnel_fec_get(uint32_t friend_number, std::string_view params);
 
 } // ttt
 
@@ -2,19 +2,33 @@
 
 #include "./tox_client_private.hpp"
 #include "./tox_chat_commands.hpp"
+#include "./metrics.hpp"
 
 #include <memory>
 #include <string>
 #include <thread>
 #include <fstream>
 #include <map>
+#include <array>
 #include <random>
 #include <functional>
+#include <chrono>
+#include <algorithm>
 #include <cstring>
+#include <cstdlib>
+#include <cstdio>
 #include <cassert>
 
 #include <iostream>
 
+#ifdef __linux__
+#include <poll.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <cerrno>
+#endif
+
 namespace ttt {
 
 static bool tox_client_setup(void);
@@ -65,6 +79,173 @@ void tox_client_stop(void) {
 
 // restart
 
+void tox_client_metrics(std::string& out) {
+	struct Snapshot {
+		uint64_t iterations {0};
+		uint64_t iteration_us_sum {0};
+		uint64_t iteration_us_max {0};
+		std::array<uint64_t, 4> iteration_quantiles_us {}; // see latency_quantiles
+		double uptime {0.};
+
+		size_t friends {0};
+		size_t friends_online {0};
+
+		std::vector<ext::ToxExtTunnelUDP2::TrafficStats> traffic {};
+		ext::ToxExtTunnelUDP2::TrafficStats traffic_total {};
+
+		size_t reassembly_bytes {0};
+		size_t reassembly_bytes_max {0};
+		uint64_t reassembly_timeouts {0};
+		uint64_t reassembly_evictions {0};
+		uint64_t reassembly_drops {0};
+		uint64_t fec_recovered {0};
+		size_t fec_bytes {0};
+		uint64_t fec_timeouts {0};
+		size_t pool_in_use {0};
+		uint64_t pool_allocations {0};
+
+		struct Latency {
+			const char* direction;
+			const char* path;
+			uint64_t count;
+			uint64_t sum_us;
+			std::array<uint64_t, 4> quantiles_us; // see latency_quantiles
+		};
+		std::vector<Latency> latency {};
+	} s {};
+	constexpr std::array<double, 4> latency_quantiles {0.5, 0.9, 0.99, 0.999};
+
+	{ // only copy while the tox thread is held up
+		const std::lock_guard lock(_tox_client_mutex);
+		if (!_tox_client) {
+			return;
+		}
+
+		const auto& il = _tox_client->iteration_latency;
+		s.iterations = il.count();
+		s.iteration_us_sum = il.sum();
+		s.iteration_us_max = il.max();
+		for (size_t i = 0; i < latency_quantiles.size(); i++) {
+			s.iteration_quantiles_us[i] = il.value_at_quantile(latency_quantiles[i]);
+		}
+		s.uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - _tox_client->start_time).count();
+
+		std::vector<uint32_t> friend_list;
+		friend_list.resize(tox_self_get_friend_list_size(_tox_client->tox));
+		tox_self_get_friend_list(_tox_client->tox, friend_list.data());
+		s.friends = friend_list.size();
+		for (const uint32_t f : friend_list) {
+			if (tox_friend_get_connection_status(_tox_client->tox, f, nullptr) != TOX_CONNECTION_NONE) {
+				s.friends_online++;
+			}
+		}
+
+		auto* ext_tunnel = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
+		s.traffic = ext_tunnel->traffic_stats();
+		s.traffic_total = ext_tunnel->traffic_total();
+		s.reassembly_bytes = ext_tunnel->reassembler().bytes_in_use();
+		s.reassembly_bytes_max = ext_tunnel->reassembler().bytes_max;
+		s.reassembly_timeouts = ext_tunnel->reassembler().timeouts;
+		s.reassembly_evictions = ext_tunnel->reassembler().evictions;
+		s.reassembly_drops = ext_tunnel->reassembler().drops;
+		s.fec_recovered = ext_tunnel->fec_decoder().recovered;
+		s.fec_bytes = ext_tunnel->fec_decoder().bytes_in_use();
+		s.fec_timeouts = ext_tunnel->fec_decoder().timeouts;
+		s.pool_in_use = ext_tunnel->pool_in_use();
+		s.pool_allocations = ext_tunnel->pool_allocations();
+
+		using Path = ext::ToxExtTunnelUDP2::LatencyPath;
+		for (const bool to_friend : {true, false}) {
+			for (const Path path : {Path::LOSSY, Path::LOSSLESS}) {
+				const auto& h = to_friend ? ext_tunnel->latency_to_friend(path) : ext_tunnel->latency_from_friend(path);
+				auto& it = s.latency.emplace_back();
+				it.direction = to_friend ? "to_friend" : "from_friend";
+				it.path = path == Path::LOSSY ? "lossy" : "lossless";
+				it.count = h.count();
+				it.sum_us = h.sum();
+				for (size_t i = 0; i < latency_quantiles.size(); i++) {
+					it.quantiles_us[i] = h.value_at_quantile(latency_quantiles[i]);
+				}
+			}
+		}
+	}
+
+	metrics::describe(out, "ttt_uptime_seconds", "gauge", "seconds since the tox client started");
+	metrics::sample(out, "ttt_uptime_seconds", "", s.uptime);
+
+	metrics::describe(out, "ttt_tox_iteration_seconds", "summary", "time spent in tox, toxext and extension ticks per loop, since start");
+	for (size_t i = 0; i < latency_quantiles.size(); i++) {
+		char q[16];
+		std::snprintf(q, sizeof(q), "%g", latency_quantiles[i]);
+		metrics::sample(out, "ttt_tox_iteration_seconds", std::string{"quantile=\""} + q + "\"", s.iteration_quantiles_us[i] / 1e6);
+	}
+	metrics::sample(out, "ttt_tox_iteration_seconds_sum", "", s.iteration_us_sum / 1e6);
+	metrics::sample(out, "ttt_tox_iteration_seconds_count", "", s.iterations);
+	metrics::describe(out, "ttt_tox_iteration_seconds_max", "gauge", "longest iteration since start");
+	metrics::sample(out, "ttt_tox_iteration_seconds_max", "", s.iteration_us_max / 1e6);
+
+	metrics::describe(out, "ttt_friends", "gauge", "friends by connection state");
+	metrics::sample(out, "ttt_friends", "state=\"online\"", uint64_t(s.friends_online));
+	metrics::sample(out, "ttt_friends", "state=\"offline\"", uint64_t(s.friends - s.friends_online));
+
+	using Direction = ext::ToxExtTunnelUDP2::TrafficStats::Direction;
+	const auto per_direction = [&out, &s](const char* name, const char* type, const char* help, auto field) {
+		metrics::describe(out, name, type, help);
+		for (const auto& it : s.traffic) {
+			const std::string f = "friend=\"" + std::to_string(it.friend_number) + "\"";
+			metrics::sample(out, name, f + ",direction=\"to_friend\"", field(it.to_friend));
+			metrics::sample(out, name, f + ",direction=\"from_friend\"", field(it.from_friend));
+		}
+	};
+	per_direction("ttt_tunnel_packets_total", "counter", "datagrams through the tunnel", [](const Direction& d) { return d.packets; });
+	per_direction("ttt_tunnel_bytes_total", "counter", "datagram bytes through the tunnel", [](const Direction& d) { return d.bytes; });
+	per_direction("ttt_tunnel_fragments_total", "counter", "tox packets carrying parts of large datagrams", [](const Direction& d) { return d.fragments; });
+	per_direction("ttt_tunnel_drops_total", "counter", "datagrams dropped on this side", [](const Direction& d) { return d.drops; });
+	per_direction("ttt_tunnel_reassembly_failures_total", "counter", "large datagrams given up on", [](const Direction& d) { return d.reassembly_failures; });
+	per_direction("ttt_tunnel_bytes_per_second", "gauge", "smoothed datagram bytes per second", [](const Direction& d) { return double(d.bytes_rate); });
+	per_direction("ttt_tunnel_packets_per_second", "gauge", "smoothed datagrams per second", [](const Direction& d) { return double(d.packets_rate); });
+
+	// closed tunnels included, so rates over these never go backwards
+	metrics::describe(out, "ttt_tunnels_bytes_total", "counter", "datagram bytes through all tunnels, including closed ones");
+	metrics::sample(out, "ttt_tunnels_bytes_total", "direction=\"to_friend\"", s.traffic_total.to_friend.bytes);
+	metrics::sample(out, "ttt_tunnels_bytes_total", "direction=\"from_friend\"", s.traffic_total.from_friend.bytes);
+	metrics::describe(out, "ttt_tunnels_packets_total", "counter", "datagrams through all tunnels, including closed ones");
+	metrics::sample(out, "ttt_tunnels_packets_total", "direction=\"to_friend\"", s.traffic_total.to_friend.packets);
+	metrics::sample(out, "ttt_tunnels_packets_total", "direction=\"from_friend\"", s.traffic_total.from_friend.packets);
+
+	metrics::describe(out, "ttt_tunnel_latency_seconds", "summary", "time datagrams spend in ttt, by tox packet kind");
+	for (const auto& it : s.latency) {
+		const std::string labels = std::string{"direction=\""} + it.direction + "\",path=\"" + it.path + "\"";
+		for (size_t i = 0; i < latency_quantiles.size(); i++) {
+			char q[16];
+			std::snprintf(q, sizeof(q), "%g", latency_quantiles[i]);
+			metrics::sample(out, "ttt_tunnel_latency_seconds", labels + ",quantile=\"" + q + "\"", it.quantiles_us[i] / 1e6);
+		}
+		metrics::sample(out, "ttt_tunnel_latency_seconds_sum", labels, it.sum_us / 1e6);
+		metrics::sample(out, "ttt_tunnel_latency_seconds_count", labels, it.count);
+	}
+
+	metrics::describe(out, "ttt_reassembly_bytes", "gauge", "pool bytes held by incomplete datagrams");
+	metrics::sample(out, "ttt_reassembly_bytes", "", uint64_t(s.reassembly_bytes));
+	metrics::describe(out, "ttt_reassembly_bytes_max", "gauge", "limit for ttt_reassembly_bytes");
+	metrics::sample(out, "ttt_reassembly_bytes_max", "", uint64_t(s.reassembly_bytes_max));
+	metrics::describe(out, "ttt_reassembly_given_up_total", "counter", "incomplete datagrams thrown away");
+	metrics::sample(out, "ttt_reassembly_given_up_total", "reason=\"timeout\"", s.reassembly_timeouts);
+	metrics::sample(out, "ttt_reassembly_given_up_total", "reason=\"eviction\"", s.reassembly_evictions);
+	metrics::describe(out, "ttt_reassembly_fragment_drops_total", "counter", "fragments that did not fit");
+	metrics::sample(out, "ttt_reassembly_fragment_drops_total", "", s.reassembly_drops);
+	metrics::describe(out, "ttt_fec_bytes", "gauge", "pool bytes held by incomplete fec datagrams");
+	metrics::sample(out, "ttt_fec_bytes", "", uint64_t(s.fec_bytes));
+	metrics::describe(out, "ttt_fec_recovered_total", "counter", "datagrams rebuilt from parity");
+	metrics::sample(out, "ttt_fec_recovered_total", "", s.fec_recovered);
+	metrics::describe(out, "ttt_fec_timeouts_total", "counter", "fec datagrams with too few fragments in time");
+	metrics::sample(out, "ttt_fec_timeouts_total", "", s.fec_timeouts);
+	metrics::describe(out, "ttt_packet_pool_in_use", "gauge", "tunnel packet buffers in use");
+	metrics::sample(out, "ttt_packet_pool_in_use", "", uint64_t(s.pool_in_use));
+	metrics::describe(out, "ttt_packet_pool_allocations_total", "counter", "heap allocations by the tunnel packet pool");
+	metrics::sample(out, "ttt_packet_pool_allocations_total", "", s.pool_allocations);
+}
+
 // api end
 
 // ============ tox callbacks ============
@@ -263,25 +444,100 @@ static bool tox_client_setup(void) {
 	return true;
 }
 
+#ifdef __linux__
+// toxcore does not expose its sockets, so we go looking for the udp one by port.
+// we only ever poll it for readability, reading stays with toxcore
+static int tox_find_udp_fd(const Tox* tox) {
+	const uint16_t tox_port = tox_self_get_udp_port(tox, nullptr);
+	if (tox_port == 0) {
+		return -1;
+	}
+
+	DIR* fd_dir = opendir("/proc/self/fd");
+	if (fd_dir == nullptr) {
+		return -1;
+	}
+
+	int found_fd = -1;
+	while (const dirent* entry = readdir(fd_dir)) {
+		const int fd = std::atoi(entry->d_name);
+		if (fd <= 0 || fd == dirfd(fd_dir)) {
+			continue;
+		}
+
+		int type = 0;
+		socklen_t type_len = sizeof(type);
+		if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_len) != 0 || type != SOCK_DGRAM) {
+			continue;
+		}
+
+		sockaddr_storage addr {};
+		socklen_t addr_len = sizeof(addr);
+		if (getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+			continue;
+		}
+
+		uint16_t fd_port = 0;
+		if (addr.ss_family == AF_INET) {
+			fd_port = ntohs(reinterpret_cast<const sockaddr_in*>(&addr)->sin_port);
+		} else if (addr.ss_family == AF_INET6) {
+			fd_port = ntohs(reinterpret_cast<const sockaddr_in6*>(&addr)->sin6_port);
+		}
+
+		if (fd_port == tox_port) {
+			found_fd = fd;
+			break;
+		}
+	}
+
+	closedir(fd_dir);
+
+	return found_fd;
+}
+#endif
+
 static void tox_client_thread_fn(void) {
 	const float save_interval = 60.f * 15.f;
 	float save_timer = save_interval/2.f; // initial save
 
-	// TODO: real time
-
 	std::default_random_engine rng{std::random_device{}()};
 	rng.discard(1337 * 42 * 13); // lul
 
+#ifdef __linux__
+	const int tox_udp_fd = tox_find_udp_fd(_tox_client->tox);
+	if (tox_udp_fd < 0) {
+		std::cerr << "WWW could not find the tox udp socket, only waking on the iteration interval\n";
+	}
+
+	std::vector<pollfd> wakeup_fds {};
+	wakeup_fds.reserve(_tox_client->extensions.size() + 1);
+#endif
+
+	auto last_time = std::chrono::steady_clock::now();
+
 	while (true) {
+		// time until something needs to happen again
+		float sleep_time = 0.f;
+
 		{ // lock sope
 			const std::lock_guard lock(_tox_client_mutex);
+
+			const auto now = std::chrono::steady_clock::now();
+			const float time_delta = std::chrono::duration<float>(now - last_time).count();
+			last_time = now;
+
 			tox_iterate(_tox_client->tox, nullptr);
 			toxext_iterate(_tox_client->tox_ext); // is this right??
 
 			for (const auto& ext : _tox_client->extensions) {
-				ext->tick();
+				ext->tick(time_delta);
 			}
 
+			_tox_client->iteration_latency.record(
+				std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - now).count()
+			);
+
+			save_timer += time_delta;
 			if (save_timer >= save_interval || _tox_client->state_dirty_save_soon) {
 				save_timer = 0.f;
 				_tox_client->state_dirty_save_soon = false;
@@ -289,11 +545,41 @@ static void tox_client_thread_fn(void) {
 
 				tox_client_save();
 			}
+
+			sleep_time = tox_iteration_interval(_tox_client->tox) / 1000.f;
+			sleep_time = std::min(sleep_time, save_interval - save_timer);
+			for (const auto& ext : _tox_client->extensions) {
+				sleep_time = std::min(sleep_time, ext->next_tick_in());
+			}
+
+#ifdef __linux__
+			wakeup_fds.clear();
+			if (tox_udp_fd >= 0) {
+				wakeup_fds.push_back({tox_udp_fd, POLLIN, 0});
+			}
+			for (const auto& ext : _tox_client->extensions) {
+				const int fd = ext->wakeup_fd();
+				if (fd >= 0) {
+					wakeup_fds.push_back({fd, POLLIN, 0});
+				}
+			}
+#endif
 		}
 
-		using namespace std::literals;
-		std::this_thread::sleep_for(1ms);
-		save_timer += 0.001f;
+		sleep_time = std::max(sleep_time, 0.f);
+
+#ifdef __linux__
+		// sleep until the deadline or until any of the sockets becomes readable
+		timespec timeout {};
+		timeout.tv_sec = static_cast<time_t>(sleep_time);
+		timeout.tv_nsec = static_cast<long>((sleep_time - timeout.tv_sec) * 1'000'000'000.f);
+		if (ppoll(wakeup_fds.data(), wakeup_fds.size(), &timeout, nullptr) < 0 && errno != EINTR) {
+			std::cerr << "!!! ppoll failed " << errno << "\n";
+		}
+#else
+		// no readiness, so never sleep longer than the old fixed interval
+		std::this_thread::sleep_for(std::chrono::duration<float>(std::min(sleep_time, 0.001f)));
+#endif
 	}
 }
 
@@ -364,17 +650,8 @@ static void friend_message_cb(Tox*, uint32_t friend_number, TOX_MESSAGE_TYPE, co
 static void friend_lossy_packet_cb(Tox*, uint32_t friend_number, const uint8_t *data, size_t length, void*) {
 	auto* tunnel_ext = static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get());
 
-	if (length < 2) {
-		std::cerr << "!!! packet too small\n";
-		return;
-	}
-
-	if (data[0] != tunnel_ext->packet_id) {
-		std::cerr << "!!! packet id mismatch\n";
-		return;
-	}
-
-	tunnel_ext->friend_custom_pkg_cb(friend_number, data+1, length-1, false);
+	// checks the packet id
+	tunnel_ext->friend_lossy_pkg_cb(friend_number, data, length);
 
 	//static_cast<ext::ToxExtTunnelUDP*>(_tox_client->extensions.at(1).get())->friend_custom_pkg_cb(friend_number, data, length);
 }
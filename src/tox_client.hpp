@@ -11,6 +11,9 @@ namespace ttt {
 
 	bool tox_client_start(TorrentDB& torrent_db, std::mutex& torrent_db_mutex);
 	void tox_client_stop(void);
+
+	// appends tox and tunnel stats in prometheus text format, see tracker_set_metrics_fn()
+	void tox_client_metrics(std::string& out);
 	// restart
 } // ttt
 
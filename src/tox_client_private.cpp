@@ -16,6 +16,8 @@ void tox_client_save(void) {
 	}
 	//ofile.flush();
 	ofile.close(); // TODO: do i need this
+
+	static_cast<ext::ToxExtTunnelUDP2*>(_tox_client->extensions.at(1).get())->tunnel_ports_save(_tox_client->tunnel_ports_filename);
 }
 
 std::vector<uint8_t> hex2bin(const std::string& str) {
@@ -5,6 +5,8 @@
 #include "./ext_announce.hpp"
 #include "./ext_tunnel_udp.hpp"
 #include "./ext_tunnel_udp2.hpp"
+#include "./ext_tunnel_tcp.hpp"
+#include "./latency_histogram.hpp"
 
 extern "C" {
 #include <tox/tox.h>
@@ -14,6 +16,7 @@ extern "C" {
 
 #include <memory>
 #include <thread>
+#include <chrono>
 #include <fstream>
 #include <map>
 #include <cstring>
@@ -47,19 +50,27 @@ struct ToxClient {
 	Tox* tox = nullptr;
 	ToxExt* tox_ext = nullptr;
 
+	const std::chrono::steady_clock::time_point start_time {std::chrono::steady_clock::now()};
+
+	// time spent per loop in tox, toxext and the extensions, for metrics
+	// since start, never reset, so scrapes do not interfere with each other
+	LatencyHistogram iteration_latency {};
+
 	// list of tox_ext extentions
-	std::array<std::unique_ptr<ext::ToxClientExtension>, 2> extensions {
+	std::array<std::unique_ptr<ext::ToxClientExtension>, 3> extensions {
 		std::make_unique<ext::ToxExtAnnounce>(),
 		//std::make_unique<ext::ToxExtTunnelUDP>(),
 		std::make_unique<ext::ToxExtTunnelUDP2>(),
+		std::make_unique<ext::ToxExtTunnelTCP>(),
 	};
 
 	bool announce_send(uint32_t friend_number, const ext::AnnounceInfoHashPackage& aihp) {
 		// lel
-		return static_cast<ext::ToxExtAnnounce*>(extensions.at(0).get())->announce_send(tox_ext, friend_number, aihp);
+		return static_cast<ext::ToxExtAnnounce*>(extensions.at(0).get())->announce_send(friend_number, aihp);
 	}
 
 	std::string savedata_filename {"ttt.tox"};
+	std::string tunnel_ports_filename {"ttt_tunnel_ports.txt"}; // friend -> port, see ToxExtTunnelUDP2
 	bool state_dirty_save_soon {false}; // set in callbacks
 
 	enum PermLevel {
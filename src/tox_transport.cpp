@@ -0,0 +1,52 @@
+#include "./tox_transport.hpp"
+
+extern "C" {
+#include <tox/tox.h>
+#include <toxext.h>
+}
+
+#include <iostream>
+
+namespace ttt::ext {
+
+bool ToxTransport::friend_connected(uint32_t friend_number) {
+	return tox_friend_get_connection_status(_tox, friend_number, nullptr) != TOX_CONNECTION_NONE;
+}
+
+std::vector<uint8_t> ToxTransport::friend_public_key(uint32_t friend_number) {
+	std::vector<uint8_t> public_key(TOX_PUBLIC_KEY_SIZE);
+	Tox_Err_Friend_Get_Public_Key err {TOX_ERR_FRIEND_GET_PUBLIC_KEY_OK};
+	if (!tox_friend_get_public_key(_tox, friend_number, public_key.data(), &err)) {
+		return {};
+	}
+
+	return public_key;
+}
+
+Transport::SendResult ToxTransport::send_lossy(uint32_t friend_number, const uint8_t* data, size_t size) {
+	Tox_Err_Friend_Custom_Packet err {TOX_ERR_FRIEND_CUSTOM_PACKET_OK};
+	if (tox_friend_send_lossy_packet(_tox, friend_number, data, size, &err)) {
+		return SendResult::OK;
+	}
+
+	if (err == TOX_ERR_FRIEND_CUSTOM_PACKET_SENDQ) {
+		return SendResult::SENDQ;
+	}
+
+	std::cerr << "!!! error sending lossy " << friend_number << "  " << size << " " << err << "\n";
+	return SendResult::FAILED;
+}
+
+bool ToxTransport::send_segment(uint32_t friend_number, const uint8_t* data, size_t size) {
+	// one segment per list, so a failed send did not send anything
+	auto* pkg_list = toxext_packet_list_create(_tox_ext, friend_number);
+	if (pkg_list == nullptr) {
+		return false;
+	}
+	toxext_segment_append(pkg_list, _tee, data, size);
+
+	return toxext_send(pkg_list) == TOXEXT_SUCCESS;
+}
+
+} // ttt::ext
+
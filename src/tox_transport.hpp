@@ -0,0 +1,31 @@
+#pragma once
+
+#include "./transport.hpp"
+
+extern "C" {
+	struct Tox;
+	struct ToxExt;
+	struct ToxExtExtension;
+}
+
+namespace ttt::ext {
+
+// toxcore and toxext, segments go out as the extension tee
+class ToxTransport : public Transport {
+	public:
+		ToxTransport(::Tox* tox, ::ToxExt* tox_ext, ::ToxExtExtension* tee) : _tox(tox), _tox_ext(tox_ext), _tee(tee) {}
+
+		bool friend_connected(uint32_t friend_number) override;
+		std::vector<uint8_t> friend_public_key(uint32_t friend_number) override;
+
+		SendResult send_lossy(uint32_t friend_number, const uint8_t* data, size_t size) override;
+		bool send_segment(uint32_t friend_number, const uint8_t* data, size_t size) override;
+
+	private:
+		::Tox* _tox {nullptr};
+		::ToxExt* _tox_ext {nullptr};
+		::ToxExtExtension* _tee {nullptr};
+};
+
+} // ttt::ext
+
@@ -1,54 +1,26 @@
 #include "./tracker.hpp"
+#include "./tracker_util.hpp"
+#include "./metrics.hpp"
 
 extern "C" {
 #include <mongoose.h>
 }
 
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include <thread>
-#include <queue>
+#include <array>
+#include <chrono>
 #include <iostream>
 #include <string>
+#include <map>
 #include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <string_view>
 #include <vector>
 
-// src : https://marcoarena.wordpress.com/2017/01/03/string_view-odi-et-amo/
-static std::vector<std::string_view> split(std::string_view str, const char* delims) {
-	std::vector<std::string_view> ret;
-
-	std::string_view::size_type start = 0;
-	auto pos = str.find_first_of(delims, start);
-	while (pos != std::string_view::npos) {
-		if (pos != start) {
-			ret.push_back(str.substr(start, pos - start));
-		}
-		start = pos + 1;
-		pos = str.find_first_of(delims, start);
-	}
-	if (start < str.length())
-		ret.push_back(str.substr(start, str.length() - start));
-
-	return ret;
-}
-
-static std::string to_bencode(const std::string& value) {
-	return std::to_string(value.size()) + ":" + value;
-}
-
-static std::string to_bencode(const int64_t& value) {
-	return "i" + std::to_string(value) + "e";
-}
-
-static std::vector<uint8_t> url_decode(const std::string_view v) {
-	std::vector<uint8_t> buf;
-	buf.resize(v.size()+1);
-	auto new_len = mg_url_decode(v.data(), v.size(), (char*)buf.data(), buf.size(), 0);
-	buf.resize(new_len);
-	return buf;
-}
-
-
 namespace ttt {
 
 struct Tracker {
@@ -59,26 +31,82 @@ struct Tracker {
 	uint16_t http_port {8000};
 
 	std::string peer_host {"localhost"};
+	// bumped with peer_host, outdates every cached response
+	std::atomic<uint64_t> peer_host_generation {0};
 
+	// _tracker_mutex, the thread sees it after a wakeup
 	bool stop {false};
+	// mg_mkpipe of the running thread, nullptr if there is none. _tracker_mutex
+	mg_connection* wakeup {nullptr};
 
 	std::thread thread;
 
+	// BEP 15 connection ids are a hash of the client address, the current minute
+	// and this, so there is nothing to remember per client. only the tracker thread
+	std::array<uint8_t, 16> udp_secret {};
+	// mongoose closed the udp listener, open it again. tracker thread only
+	bool udp_reopen {false};
+
 	Tracker(TorrentDB& torrent_db_, std::mutex& torrent_db_mutex_) : torrent_db(torrent_db_), torrent_db_mutex(torrent_db_mutex_) {
+		mg_random(udp_secret.data(), udp_secret.size());
 	}
 
-	// is this useles
-	enum class TrackerCommand {
-		STOP
+	// for /metrics, only touched by the tracker thread
+	enum class Route {
+		ANNOUNCE,
+		LIST,
+		METRICS,
+		UDP_CONNECT,
+		UDP_ANNOUNCE,
+		UDP_SCRAPE,
+		OTHER,
+	};
+	constexpr static std::array<const char*, 7> route_names {"announce", "list", "metrics", "udp_connect", "udp_announce", "udp_scrape", "other"};
+	// upper bounds in seconds, +Inf is implicit
+	constexpr static std::array<double, 8> latency_buckets {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.1};
+	struct RouteMetrics {
+		uint64_t requests {0};
+		double seconds_sum {0.};
+		std::array<uint64_t, latency_buckets.size()> buckets {}; // not cumulative
+	};
+	std::array<RouteMetrics, route_names.size()> route_metrics {};
+
+	struct Peer {
+		std::string ip;
+		uint16_t port {0};
 	};
-	std::queue<TrackerCommand> command_queue;
+
+	// announce responses per torrent, only touched by the tracker thread.
+	// valid as long as the generations match, so most announces dont lock anything
+	struct CachedResponse {
+		const TorrentDB::TorrentEntry* entry {nullptr}; // never removed from the db
+		uint64_t generation {0};
+		uint64_t peer_host_generation {0};
+
+		std::vector<Peer> peers;
+		bool compact_possible {false};
+		std::string compact_peers; // 6 bytes per peer, for udp and numwant
+		std::string compact; // whole bencoded response
+		std::string full;
+	};
+	std::unordered_map<Torrent, CachedResponse> response_cache;
 };
 
 static std::unique_ptr<Tracker> _tracker;
 static std::mutex _tracker_mutex;
+static tracker_metrics_fn_t _metrics_fn {}; // _tracker_mutex, survives restarts
 
 static void http_tracker_thread_fn(void);
 
+// call with _tracker_mutex held
+static void tracker_signal_stop(void) {
+	_tracker->stop = true;
+	if (_tracker->wakeup != nullptr) {
+		// a thread not polling yet sees stop before it does
+		mg_mgr_wakeup(_tracker->wakeup, nullptr, 0);
+	}
+}
+
 // all functions are thread save
 
 // start the tracker, torrentdb is the communication between tracker and tunnel
@@ -106,7 +134,7 @@ void tracker_stop(void) {
 			return;
 		}
 
-		_tracker->command_queue.push(Tracker::TrackerCommand::STOP);
+		tracker_signal_stop();
 	}
 
 	// join thread
@@ -126,11 +154,12 @@ void tracker_restart(void) {
 			return;
 		}
 
-		_tracker->command_queue.push(Tracker::TrackerCommand::STOP);
+		tracker_signal_stop();
 	}
 	_tracker->thread.join();
 
 	const std::lock_guard lock(_tracker_mutex);
+	_tracker->stop = false;
 	// start thread
 	_tracker->thread = std::thread(http_tracker_thread_fn);
 }
@@ -143,168 +172,320 @@ void tracker_set_http_port(const uint16_t port_in_host_order) {
 	std::cerr << __FILE__ << ":" << __LINE__ << " " << __FUNCTION__ << " NOT IMPLEMENTED!\n";
 }
 
+std::string tracker_announce_url(void) {
+	const std::lock_guard lock(_tracker_mutex);
+	if (!_tracker) {
+		return {};
+	}
+
+	return "http://" + _tracker->http_host + ":" + std::to_string(_tracker->http_port) + "/announce";
+}
+
+std::string tracker_udp_announce_url(void) {
+	const std::lock_guard lock(_tracker_mutex);
+	if (!_tracker) {
+		return {};
+	}
+
+	return "udp://" + _tracker->http_host + ":" + std::to_string(_tracker->http_port) + "/announce";
+}
+
+void tracker_set_metrics_fn(tracker_metrics_fn_t fn) {
+	const std::lock_guard lock(_tracker_mutex);
+	_metrics_fn = std::move(fn);
+}
+
 //{"127.0.0.1"}; // torrent clients discard loopback addresses
 //{"192.168.1.179"}; // so as a workaround you can use your lan address, in this case most torrent programms dont discard it and it should not leave your pc
 void tracker_set_tunnel_host(const std::string& host) {
 	const std::lock_guard lock(_tracker_mutex);
 	_tracker->peer_host = host;
+	_tracker->peer_host_generation++;
 }
 
 // api end
 
+// mg_http_reply is printf based, it would cut binary bodies (compact peers) at the first \0
+static void http_reply_bencode(mg_connection* c, const std::string& body) {
+	mg_printf(c, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n\r\n", static_cast<int>(body.size()));
+	mg_send(c, body.data(), body.size());
+}
+
+// BEP 23, only possible if every host is an ipv4 address
+static bool pack_peers_compact(const std::vector<Tracker::Peer>& peers, std::string& packed) {
+	packed.clear();
+	packed.reserve(peers.size() * 6);
+	for (const auto& peer : peers) {
+		std::array<uint8_t, 4> ip;
+		if (!parse_ipv4(peer.ip, ip)) {
+			return false;
+		}
+		append_compact_peer(packed, ip, peer.port);
+	}
+	return true;
+}
+
+static std::string bencode_peers_list(const std::vector<Tracker::Peer>& peers, const size_t count) {
+	std::string response_peer_list{};
+	for (size_t i = 0; i < count; i++) {
+		response_peer_list +=
+			"d" +
+				to_bencode("ip") + to_bencode(peers[i].ip) +
+				to_bencode("port") + to_bencode(peers[i].port) +
+			"e"
+		;
+	}
+	return "l" + response_peer_list + "e";
+}
+
+static std::string bencode_announce_response(const std::string& response_peers) {
+	// response dict key is plain, value is bencoded.
+	// ordered, bencode wants sorted keys
+	std::map<std::string, std::string> response_dict{
+		{"interval", to_bencode(60)}, // 60s
+		{"peers", response_peers},
+	};
+
+	// eg: (compact: 5:peers 6:<ip><port>)
+	// 	d
+	// 		8:interval
+	// 			i1800e
+	// 		5:peers
+	// 			l
+	// 				d
+	// 					2:ip
+	// 						13:192.168.189.1
+	// 					4:port
+	// 						i20111e
+	// 				e
+	// 			e
+	// 	e
+	std::string bencode_response {};
+	bencode_response += "d";
+	for (const auto& [key, value] : response_dict) {
+		bencode_response += to_bencode(key) + value;
+	}
+
+	bencode_response += "e";
+	return bencode_response;
+}
+
+// fill peer list with tunnels, call with _tracker_mutex and torrent_db_mutex held
+static void collect_peers(const TorrentDB::TorrentEntry& entry, std::vector<Tracker::Peer>& peers) {
+	peers.clear();
+	for (const uint32_t f_id : entry.torrent_tox_info.friends) {
+		std::string ip {_tracker->peer_host};
+		if (auto host_it = _tracker->torrent_db.peer_hosts.find(f_id); host_it != _tracker->torrent_db.peer_hosts.end()) {
+			ip = host_it->second;
+		}
+
+		uint16_t udp_port = 0;
+		if (auto port_it = _tracker->torrent_db.peers.find(f_id); port_it != _tracker->torrent_db.peers.end()) {
+			udp_port = port_it->second;
+			peers.push_back({ip, udp_port});
+		}
+
+		// tcp usually shares the port, then the entry above covers both
+		if (auto port_it = _tracker->torrent_db.tcp_peers.find(f_id); port_it != _tracker->torrent_db.tcp_peers.end() && port_it->second != udp_port) {
+			peers.push_back({ip, port_it->second});
+		}
+	}
+}
+
+// the slow path, takes both locks
+static void announce_response_rebuild(const Torrent& t, Tracker::CachedResponse& cached) {
+	// meh
+	const std::lock_guard tracker_lock{_tracker_mutex};
+	cached.peer_host_generation = _tracker->peer_host_generation;
+
+	// TODO: replace with messaging ?
+	const std::lock_guard mutex_lock{_tracker->torrent_db_mutex};
+
+	{ // optinally add to db and set self
+		if (!_tracker->torrent_db.torrents.count(t)) {
+			std::cout << "III new info_hash" << t << "\n";
+		} else {
+			std::cout << "III NOT new info_hash" << t << "\n";
+		}
+		auto& entry = _tracker->torrent_db.torrents[t];
+		entry.self = true;
+
+		// only changes under torrent_db_mutex, so it matches what we read below
+		cached.entry = &entry;
+		cached.generation = entry.generation;
+	}
+
+	// TODO: timestamp
+
+	collect_peers(*cached.entry, cached.peers);
+
+	cached.compact_possible = pack_peers_compact(cached.peers, cached.compact_peers);
+	cached.compact = cached.compact_possible ? bencode_announce_response(to_bencode(cached.compact_peers)) : std::string{};
+	cached.full = bencode_announce_response(bencode_peers_list(cached.peers, cached.peers.size()));
+}
+
+// cached response for the torrent of query, rebuilt if outdated.
+// used by the http and udp announce
+static const Tracker::CachedResponse& announce_response(const AnnounceQuery& query) {
+	// create torrent
+	Torrent t;
+	if (query.info_hash_size == 20) { // v1
+		t.info_hash_v1.emplace();
+		std::copy_n(query.info_hash.cbegin(), 20, t.info_hash_v1->data.begin());
+	} else { // v2
+		t.info_hash_v2.emplace();
+		std::copy_n(query.info_hash.cbegin(), 32, t.info_hash_v2->data.begin());
+	}
+
+	auto& cached = _tracker->response_cache[t];
+	if (
+		cached.entry == nullptr ||
+		cached.entry->generation != cached.generation ||
+		_tracker->peer_host_generation != cached.peer_host_generation
+	) {
+		announce_response_rebuild(t, cached);
+	}
+
+	return cached;
+}
+
 // https://wiki.theory.org/index.php/BitTorrentSpecification#Tracker_HTTP.2FHTTPS_Protocol
 static void http_handle_announce(mg_connection* c, mg_http_message* hm) {
 	if (hm->query.ptr == nullptr) {
 		mg_http_reply(c, 101, "Content-Type: text/plain\r\n", "missing info_hash");
 		std::cerr << "!!! announce without info_hash (missing query)\n";
 	} else {
-		//std::string query_str(hm->query.ptr, 0, hm->query.len);
-		//mg_http_reply(c, 200, "Content-Type: text/plain\r\n", "query: %s\n", query_str.c_str());
-
-		// HACK: copy string first
-		std::string query_str(hm->query.ptr, 0, hm->query.len);
-		auto query_split = split(query_str, "&");
-		std::unordered_map<std::string, std::string> query_map;
-		for (const auto& e_v : query_split) {
-			auto kv = split(e_v, "=");
-			if (kv.size() != 2) {
-				std::cerr << "kv not 2\n";
-				continue;
-			}
-
-			// special case
-			// can contain \0
-			if (kv.at(0) == "info_hash") {
-				// easier for internal handling
-				query_map[std::string(kv.at(0))] = std::to_string(url_decode(kv.at(1)));
-			} else {
-				//query_map[url_decode(kv.at(0))] = url_decode(kv.at(1));
-				query_map[std::string(kv.at(0))] = kv.at(1);
-			}
-		}
-
-		if (false) { // debug
-			std::string list_str {"query:\n"};
-			for (const auto& [k,v] : query_map) {
-				list_str += "  " + k + ":" + v + "\n";
-			}
-			mg_http_reply(c, 200, "Content-Type: text/plain\r\n", list_str.c_str());
+		// no copies, straight from the request buffer
+		AnnounceQuery query {};
+		if (!parse_announce_query({hm->query.ptr, hm->query.len}, query)) {
+			mg_http_reply(c, 500, "Content-Type: text/plain\r\n", "bruh what, info_hash bonkers");
+			std::cerr << "!!! announce with invalid info_hash\n";
 			return;
 		}
 
-		if (!query_map.count("info_hash")) {
+		if (query.info_hash_size == 0) {
 			// 101
 			mg_http_reply(c, 101, "Content-Type: text/plain\r\n", "missing info_hash");
-			std::cerr << "!!! announce without info_hash " << query_split.size() << "\n";
+			std::cerr << "!!! announce without info_hash\n";
+			return;
 		}
 
-		// create torrent
-		Torrent t;
-		std::string info_hash = query_map["info_hash"];
-		// sadnes
-		if (info_hash.size() == 20*2) { // v1
-			t.info_hash_v1 = InfoHashV1{info_hash};
-		} else if (info_hash.size() == 32*2) { // v2
-			t.info_hash_v2 = InfoHashV2{info_hash};
+		// BEP 23, most clients ask for it
+		const bool compact = query.compact;
+
+		// we never know peer ids, so no_peer_id=1 is what we do anyway
+
+		const size_t numwant = query.numwant;
+
+		const auto& cached = announce_response(query);
+		if (cached.peers.size() <= numwant) {
+			http_reply_bencode(c, compact && cached.compact_possible ? cached.compact : cached.full);
 		} else {
-			mg_http_reply(c, 500, "Content-Type: text/plain\r\n", "bruh what, info_hash bonkers");
-			std::cerr << "!!! announce with invalid info_hash\n";
+			// first ones win, they are all tunnels anyway.
+			// rare, usually there are fewer tunnels than numwant
+			if (compact && cached.compact_possible) {
+				http_reply_bencode(c, bencode_announce_response(to_bencode(cached.compact_peers.substr(0, numwant * 6))));
+			} else {
+				http_reply_bencode(c, bencode_announce_response(bencode_peers_list(cached.peers, numwant)));
+			}
 		}
+	}
+}
 
+// formats everything from a copy, so torrent_db_mutex is only held for counting
+static void http_handle_metrics(mg_connection* c) {
+	struct DBSnapshot {
+		size_t torrents {0};
+		size_t torrents_self {0};
+		size_t torrents_friends {0}; // known from at least one friend
+		size_t peers {0};
+		size_t tcp_peers {0};
+	} db {};
 
-		{
-			// meh
-			const std::lock_guard tracker_lock{_tracker_mutex};
+	tracker_metrics_fn_t metrics_fn {};
 
-			// TODO: replace with messaging ?
-			const std::lock_guard mutex_lock{_tracker->torrent_db_mutex};
+	{
+		const std::lock_guard tracker_lock(_tracker_mutex);
+		metrics_fn = _metrics_fn;
+
+		const std::lock_guard mutex_lock(_tracker->torrent_db_mutex);
+		db.torrents = _tracker->torrent_db.torrents.size();
+		for (const auto& [t, entry] : _tracker->torrent_db.torrents) {
+			db.torrents_self += entry.self;
+			db.torrents_friends += !entry.torrent_tox_info.friends.empty();
+		}
+		db.peers = _tracker->torrent_db.peers.size();
+		db.tcp_peers = _tracker->torrent_db.tcp_peers.size();
+	}
 
-			{ // optinally add to db and set self
-				if (!_tracker->torrent_db.torrents.count(t)) {
-					std::cout << "III new info_hash" << t << "\n";
-				} else {
-					std::cout << "III NOT new info_hash" << t << "\n";
-				}
-				auto& entry = _tracker->torrent_db.torrents[t];
-				entry.self = true;
-			}
+	std::string out {};
 
-			// TODO: timestamp
-
-			struct Peer {
-				//std::string ip {"127.0.0.1"};
-				//std::string ip {"192.168.1.188"};
-				//std::string ip {"127.255.1.1"};
-				std::string ip {_tracker->peer_host};
-				//uint16_t port {20111};
-				uint16_t port {0};
-			};
-
-			std::vector<Peer> peer_list{};
-			//peer_list.emplace_back(); // default
-			// fill peer list with tunnels
-			for (const uint32_t f_id : _tracker->torrent_db.torrents[t].torrent_tox_info.friends) {
-				if (!_tracker->torrent_db.peers.count(f_id)) {
-					continue;
-				}
+	metrics::describe(out, "ttt_tracker_requests_total", "counter", "http requests handled by the tracker");
+	for (size_t i = 0; i < Tracker::route_names.size(); i++) {
+		const std::string labels = std::string{"route=\""} + Tracker::route_names[i] + "\"";
+		metrics::sample(out, "ttt_tracker_requests_total", labels, _tracker->route_metrics[i].requests);
+	}
 
-				auto& new_peer = peer_list.emplace_back();
-				//new_peer.ip;
-				new_peer.port = _tracker->torrent_db.peers.at(f_id);
-			}
+	metrics::describe(out, "ttt_tracker_request_seconds", "histogram", "time spent handling a request");
+	for (size_t i = 0; i < Tracker::route_names.size(); i++) {
+		const auto& rm = _tracker->route_metrics[i];
+		const std::string labels = std::string{"route=\""} + Tracker::route_names[i] + "\"";
+
+		uint64_t cumulative = 0;
+		for (size_t b = 0; b < Tracker::latency_buckets.size(); b++) {
+			cumulative += rm.buckets[b];
+			char le[32];
+			std::snprintf(le, sizeof(le), "%g", Tracker::latency_buckets[b]);
+			metrics::sample(out, "ttt_tracker_request_seconds_bucket", labels + ",le=\"" + le + "\"", cumulative);
+		}
+		metrics::sample(out, "ttt_tracker_request_seconds_bucket", labels + ",le=\"+Inf\"", rm.requests);
+		metrics::sample(out, "ttt_tracker_request_seconds_sum", labels, rm.seconds_sum);
+		metrics::sample(out, "ttt_tracker_request_seconds_count", labels, rm.requests);
+	}
 
-			std::string response_peer_list{};
-			for (const auto& peer : peer_list) {
-				response_peer_list +=
-					"d" +
-						to_bencode("ip") + to_bencode(peer.ip) +
-						to_bencode("port") + to_bencode(peer.port) +
-					"e"
-				;
-			}
+	metrics::describe(out, "ttt_torrents", "gauge", "torrents in the db");
+	metrics::sample(out, "ttt_torrents", "", uint64_t(db.torrents));
+	metrics::describe(out, "ttt_torrents_self", "gauge", "torrents announced by the local torrent client");
+	metrics::sample(out, "ttt_torrents_self", "", uint64_t(db.torrents_self));
+	metrics::describe(out, "ttt_torrents_friends", "gauge", "torrents announced by at least one friend");
+	metrics::sample(out, "ttt_torrents_friends", "", uint64_t(db.torrents_friends));
+	metrics::describe(out, "ttt_tunnel_peers", "gauge", "friends with an open udp tunnel");
+	metrics::sample(out, "ttt_tunnel_peers", "", uint64_t(db.peers));
+	metrics::describe(out, "ttt_tunnel_tcp_peers", "gauge", "friends with an open tcp listener");
+	metrics::sample(out, "ttt_tunnel_tcp_peers", "", uint64_t(db.tcp_peers));
+
+	if (metrics_fn) {
+		metrics_fn(out);
+	}
 
-			// response dict key is plain, value is bencoded
-			std::unordered_map<std::string, std::string> response_dict{
-				{"interval", to_bencode(60)}, // 60s
-				{"peers", "l" + response_peer_list + "e"}, // TODO: more peers
-			};
-
-			// eg:
-			// 	d
-			// 		8:interval
-			// 			i1800e
-			// 		5:peers
-			// 			l
-			// 				d
-			// 					2:ip
-			// 						13:192.168.189.1
-			// 					4:port
-			// 						i20111e
-			// 				e
-			// 			e
-			// 	e
-			std::string bencode_response {};
-			bencode_response += "d";
-			for (const auto& [key, value] : response_dict) {
-				bencode_response += to_bencode(key) + value;
-			}
+	mg_http_reply(c, 200, "Content-Type: text/plain; version=0.0.4\r\n", "%s", out.c_str());
+}
 
-			bencode_response += "e";
-			mg_http_reply(c, 200, "Content-Type: text/plain\r\n", bencode_response.c_str());
+static void record_request(const Tracker::Route route, const std::chrono::steady_clock::time_point start) {
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	auto& rm = _tracker->route_metrics[size_t(route)];
+	rm.requests++;
+	rm.seconds_sum += seconds;
+	for (size_t b = 0; b < Tracker::latency_buckets.size(); b++) {
+		if (seconds <= Tracker::latency_buckets[b]) {
+			rm.buckets[b]++;
+			break;
 		}
-
 	}
 }
 
 static void http_fn(mg_connection *c, int ev, void *ev_data, void *fn_data) {
 	if (ev == MG_EV_HTTP_MSG) {
+		const auto start = std::chrono::steady_clock::now();
+		Tracker::Route route = Tracker::Route::OTHER;
+
 		mg_http_message* hm = (mg_http_message *) ev_data;
 		//std::cerr << "got request:" << std::string(hm->message.ptr, 0, hm->message.len) << "\n";
 		if (mg_http_match_uri(hm, "/announce")) {
+			route = Tracker::Route::ANNOUNCE;
 			http_handle_announce(c, hm);
-
-			mg_http_reply(c, 404, "Content-Type: text/plain\r\n", "huh?");
 		} else if (mg_http_match_uri(hm, "/list")) {
+			route = Tracker::Route::LIST;
 			std::string list_str {"currently indexed:\n"};
 
 			{
@@ -327,14 +508,199 @@ static void http_fn(mg_connection *c, int ev, void *ev_data, void *fn_data) {
 			}
 
 			mg_http_reply(c, 200, "Content-Type: text/plain\r\n", list_str.c_str());
+		} else if (mg_http_match_uri(hm, "/metrics")) {
+			route = Tracker::Route::METRICS;
+			http_handle_metrics(c);
 		} else {
 			mg_http_reply(c, 404, "Content-Type: text/plain\r\n", "TTT\n");
 		}
+
+		record_request(route, start);
+	}
+}
+
+static void udp_append_u32(std::string& out, const uint32_t value) {
+	for (size_t i = 0; i < 4; i++) {
+		out += char(value >> (24 - i*8));
+	}
+}
+
+static void udp_append_u64(std::string& out, const uint64_t value) {
+	udp_append_u32(out, value >> 32);
+	udp_append_u32(out, value);
+}
+
+#ifdef _WIN32
+using udp_socket_t = SOCKET;
+#else
+using udp_socket_t = int;
+#endif
+
+// sender of a datagram, the reply goes back there
+struct UDPPeer {
+	sockaddr_storage addr {};
+	socklen_t addr_len {sizeof(sockaddr_storage)};
+};
+
+// valid for the minute it was handed out and the one after (BEP 15 asks for 2)
+static uint64_t udp_connection_id(const UDPPeer& peer, const uint64_t minute) {
+	mg_sha1_ctx ctx;
+	mg_sha1_init(&ctx);
+	mg_sha1_update(&ctx, _tracker->udp_secret.data(), _tracker->udp_secret.size());
+	if (peer.addr.ss_family == AF_INET6) {
+		const auto& addr = reinterpret_cast<const sockaddr_in6&>(peer.addr);
+		mg_sha1_update(&ctx, reinterpret_cast<const unsigned char*>(&addr.sin6_addr), sizeof(addr.sin6_addr));
+		mg_sha1_update(&ctx, reinterpret_cast<const unsigned char*>(&addr.sin6_port), sizeof(addr.sin6_port));
+	} else {
+		const auto& addr = reinterpret_cast<const sockaddr_in&>(peer.addr);
+		mg_sha1_update(&ctx, reinterpret_cast<const unsigned char*>(&addr.sin_addr), sizeof(addr.sin_addr));
+		mg_sha1_update(&ctx, reinterpret_cast<const unsigned char*>(&addr.sin_port), sizeof(addr.sin_port));
+	}
+	mg_sha1_update(&ctx, reinterpret_cast<const unsigned char*>(&minute), sizeof(minute));
+
+	unsigned char digest[20];
+	mg_sha1_final(digest, &ctx);
+
+	uint64_t id {0};
+	std::memcpy(&id, digest, sizeof(id));
+	return id;
+}
+
+static uint64_t udp_current_minute(void) {
+	return std::chrono::duration_cast<std::chrono::minutes>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool udp_connection_id_valid(const UDPPeer& peer, const uint64_t id) {
+	const uint64_t minute = udp_current_minute();
+	return id == udp_connection_id(peer, minute) || id == udp_connection_id(peer, minute - 1);
+}
+
+// errors are ignored, the client asks again
+static void udp_send(const udp_socket_t fd, const UDPPeer& to, const std::string& data) {
+	sendto(fd, data.data(), data.size(), 0, reinterpret_cast<const sockaddr*>(&to.addr), to.addr_len);
+}
+
+static void udp_reply_error(const udp_socket_t fd, const UDPPeer& to, const uint32_t transaction_id, const std::string_view message) {
+	std::string reply;
+	udp_append_u32(reply, uint32_t(UDPTrackerRequest::Action::ERROR));
+	udp_append_u32(reply, transaction_id);
+	reply += message;
+	udp_send(fd, to, reply);
+}
+
+// https://www.bittorrent.org/beps/bep_0015.html
+static Tracker::Route udp_handle_packet(const udp_socket_t fd, const UDPPeer& from, const std::string_view packet) {
+	UDPTrackerRequest request {};
+	if (!parse_udp_tracker_request(packet, request)) {
+		return Tracker::Route::OTHER;
+	}
+
+	std::string reply;
+	udp_append_u32(reply, uint32_t(request.action));
+	udp_append_u32(reply, request.transaction_id);
+
+	if (request.action == UDPTrackerRequest::Action::CONNECT) {
+		if (request.connection_id != udp_tracker_protocol_id) {
+			return Tracker::Route::OTHER; // not bittorrent
+		}
+
+		udp_append_u64(reply, udp_connection_id(from, udp_current_minute()));
+		udp_send(fd, from, reply);
+		return Tracker::Route::UDP_CONNECT;
 	}
+
+	// no answer, so spoofed sources cant use us to send stuff elsewhere
+	if (!udp_connection_id_valid(from, request.connection_id)) {
+		return Tracker::Route::OTHER;
+	}
+
+	if (request.action == UDPTrackerRequest::Action::ANNOUNCE) {
+		AnnounceQuery query {};
+		if (!parse_udp_tracker_announce(packet, query)) {
+			udp_reply_error(fd, from, request.transaction_id, "announce too short");
+			return Tracker::Route::UDP_ANNOUNCE;
+		}
+
+		const auto& cached = announce_response(query);
+		if (!cached.compact_possible) {
+			udp_reply_error(fd, from, request.transaction_id, "tunnel host is not an ipv4 address, use the http tracker");
+			return Tracker::Route::UDP_ANNOUNCE;
+		}
+
+		// we dont know who is done, so everyone is a leecher
+		udp_append_u32(reply, 60); // interval 60s
+		udp_append_u32(reply, cached.peers.size()); // leechers
+		udp_append_u32(reply, 0); // seeders
+		reply += std::string_view{cached.compact_peers}.substr(0, size_t(query.numwant) * 6);
+		udp_send(fd, from, reply);
+		return Tracker::Route::UDP_ANNOUNCE;
+	} else if (request.action == UDPTrackerRequest::Action::SCRAPE) {
+		// only looks, unlike announce it does not add the torrent
+		std::vector<Tracker::Peer> peers;
+		const std::lock_guard tracker_lock{_tracker_mutex};
+		const std::lock_guard mutex_lock{_tracker->torrent_db_mutex};
+		for (size_t pos = udp_tracker_request_header_size; pos + 20 <= packet.size(); pos += 20) {
+			Torrent t;
+			t.info_hash_v1.emplace();
+			std::copy_n(packet.data() + pos, 20, t.info_hash_v1->data.begin());
+
+			peers.clear();
+			if (auto it = _tracker->torrent_db.torrents.find(t); it != _tracker->torrent_db.torrents.end()) {
+				collect_peers(it->second, peers);
+			}
+
+			udp_append_u32(reply, 0); // seeders
+			udp_append_u32(reply, 0); // completed
+			udp_append_u32(reply, peers.size()); // leechers
+		}
+		udp_send(fd, from, reply);
+		return Tracker::Route::UDP_SCRAPE;
+	}
+
+	udp_reply_error(fd, from, request.transaction_id, "unknown action");
+	return Tracker::Route::OTHER;
+}
+
+// datagrams per poll, so a flood does not starve the http side
+constexpr static size_t udp_burst_max = 64;
+
+// mongoose only polls the udp socket, reading and sending happens here.
+// it would close the listener on an empty datagram (recvfrom() returning 0)
+// or a failed send, and then the udp tracker is gone
+static void udp_fn(mg_connection* c, int ev, void*, void*) {
+	if (ev == MG_EV_POLL && c->is_readable) {
+		c->is_readable = 0; // keeps mongoose from reading
+
+		const udp_socket_t fd = static_cast<udp_socket_t>(reinterpret_cast<size_t>(c->fd));
+		std::array<char, 2048> buff; // requests are small, scrapes are the largest
+		for (size_t i = 0; i < udp_burst_max; i++) {
+			UDPPeer from {};
+			const auto got = recvfrom(fd, buff.data(), buff.size(), 0, reinterpret_cast<sockaddr*>(&from.addr), &from.addr_len);
+			if (got < 0) {
+				break; // would block, or an icmp error of an earlier send
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+			const Tracker::Route route = udp_handle_packet(fd, from, {buff.data(), size_t(got)});
+			record_request(route, start);
+		}
+	} else if (ev == MG_EV_CLOSE) {
+		// should not happen anymore, but never stay deaf
+		_tracker->udp_reopen = true;
+	}
+}
+
+static bool udp_listen(mg_mgr& mgr, const std::string& url) {
+	if (mg_listen(&mgr, url.c_str(), udp_fn, nullptr) == nullptr) {
+		std::cerr << "!!! tracker failed to listen on " << url << "\n";
+		return false;
+	}
+	return true;
 }
 
 static void http_tracker_thread_fn(void) {
 	mg_mgr mgr;
+	std::string udp_listen_url;
 
 	{ // setup mongoose
 		mg_mgr_init(&mgr);
@@ -346,30 +712,36 @@ static void http_tracker_thread_fn(void) {
 		};
 
 		mg_http_listen(&mgr, listen_url.c_str(), http_fn, &mgr);
+
+		// BEP 15, same host and port. clients pick it with a udp:// announce url
+		udp_listen_url = "udp://" + _tracker->http_host + ":" + std::to_string(_tracker->http_port);
+		_tracker->udp_reopen = false;
+		udp_listen(mgr, udp_listen_url);
+
+		// only there to interrupt mg_mgr_poll(), reading it is all there is to do
+		_tracker->wakeup = mg_mkpipe(&mgr, [](mg_connection*, int, void*, void*) {}, nullptr);
+		if (_tracker->wakeup == nullptr) {
+			std::cerr << "!!! tracker failed to create wakeup pipe, stopping might take a second\n";
+		}
 	}
 
 	while (true) {
-		{ // do commands
+		{
 			const std::lock_guard lock(_tracker_mutex);
-			auto& queue = _tracker->command_queue;
-			bool big_break = false;
-			while (queue.size()) {
-				if (queue.front() == Tracker::TrackerCommand::STOP) {
-					_tracker->stop = true; // useles?
-					big_break = true;
-					break;
-				}
-			}
-
-			if (big_break) {
+			if (_tracker->stop) {
+				_tracker->wakeup = nullptr; // freed with the mgr
 				break;
 			}
 		}
 
+		// requests and wakeups end the poll early, the timeout is only the fallback
 		mg_mgr_poll(&mgr, 1000);
 
-		using namespace std::literals;
-		std::this_thread::sleep_for(20ms);
+		if (_tracker->udp_reopen) {
+			_tracker->udp_reopen = false; // once, a port taken meanwhile would spam
+			std::cerr << "WWW udp tracker socket got closed, reopening\n";
+			udp_listen(mgr, udp_listen_url);
+		}
 	}
 
 	mg_mgr_free(&mgr);
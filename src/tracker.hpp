@@ -4,6 +4,7 @@
 
 #include <mutex>
 #include <string>
+#include <functional>
 #include <cstdint>
 
 namespace ttt {
@@ -22,6 +23,16 @@ namespace ttt {
 	// default is 8000
 	void tracker_set_http_port(const uint16_t port_in_host_order);
 
+	// what torrent clients should announce to, empty if not running
+	std::string tracker_announce_url(void);
+	// same host and port, BEP 15
+	std::string tracker_udp_announce_url(void);
+
+	// appends more to /metrics (prometheus text format), eg. the tox client.
+	// called on the tracker thread, with no tracker lock held
+	using tracker_metrics_fn_t = std::function<void(std::string& out)>;
+	void tracker_set_metrics_fn(tracker_metrics_fn_t fn);
+
 	//{"127.0.0.1"}; // torrent clients discard loopback addresses
 	//{"192.168.1.179"}; // so as a workaround you can use your lan address, in this case most torrent programms dont discard it and it should not leave your pc
 	void tracker_set_tunnel_host(const std::string& host);
@@ -0,0 +1,229 @@
+#include "./tracker_util.hpp"
+
+extern "C" {
+#include <mongoose.h>
+}
+
+#include <charconv>
+#include <algorithm>
+
+namespace ttt {
+
+// src : https://marcoarena.wordpress.com/2017/01/03/string_view-odi-et-amo/
+std::vector<std::string_view> split(std::string_view str, const char* delims) {
+	std::vector<std::string_view> ret;
+
+	std::string_view::size_type start = 0;
+	auto pos = str.find_first_of(delims, start);
+	while (pos != std::string_view::npos) {
+		if (pos != start) {
+			ret.push_back(str.substr(start, pos - start));
+		}
+		start = pos + 1;
+		pos = str.find_first_of(delims, start);
+	}
+	if (start < str.length())
+		ret.push_back(str.substr(start, str.length() - start));
+
+	return ret;
+}
+
+std::string to_bencode(const std::string& value) {
+	return std::to_string(value.size()) + ":" + value;
+}
+
+std::string to_bencode(const int64_t& value) {
+	return "i" + std::to_string(value) + "e";
+}
+
+std::vector<uint8_t> url_decode(const std::string_view v) {
+	std::vector<uint8_t> buf;
+	buf.resize(v.size()+1);
+	auto new_len = mg_url_decode(v.data(), v.size(), (char*)buf.data(), buf.size(), 0);
+	buf.resize(new_len);
+	return buf;
+}
+
+// -1 if not a hex digit
+static int hex_value(const char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+// percent decoding straight into out, false if it does not fit or is malformed
+static bool url_decode_into(std::string_view v, uint8_t* out, size_t out_size, size_t& out_len) {
+	out_len = 0;
+	for (size_t i = 0; i < v.size(); i++) {
+		if (out_len >= out_size) {
+			return false;
+		}
+
+		if (v[i] == '%') {
+			if (i + 2 >= v.size()) {
+				return false;
+			}
+			const int hi = hex_value(v[i+1]);
+			const int lo = hex_value(v[i+2]);
+			if (hi < 0 || lo < 0) {
+				return false;
+			}
+			out[out_len++] = (hi << 4) | lo;
+			i += 2;
+		} else {
+			out[out_len++] = v[i];
+		}
+	}
+
+	return true;
+}
+
+// leaves out untouched if v is not a number
+template<typename T>
+static void parse_uint(std::string_view v, T& out) {
+	T value {};
+	const auto [ptr, ec] = std::from_chars(v.data(), v.data() + v.size(), value);
+	if (ec == std::errc{} && ptr == v.data() + v.size()) {
+		out = value;
+	}
+}
+
+bool parse_announce_query(std::string_view query, AnnounceQuery& out) {
+	while (!query.empty()) {
+		const size_t amp = query.find('&');
+		const std::string_view pair = query.substr(0, amp);
+		query = amp == std::string_view::npos ? std::string_view{} : query.substr(amp + 1);
+
+		const size_t eq = pair.find('=');
+		if (eq == std::string_view::npos) {
+			continue; // empty or flag without value
+		}
+		const std::string_view key = pair.substr(0, eq);
+		const std::string_view value = pair.substr(eq + 1);
+
+		if (key == "info_hash") {
+			// can contain \0
+			if (!url_decode_into(value, out.info_hash.data(), out.info_hash.size(), out.info_hash_size)) {
+				return false;
+			}
+		} else if (key == "port") {
+			parse_uint(value, out.port);
+		} else if (key == "event") {
+			if (value == "started") {
+				out.event = AnnounceQuery::Event::STARTED;
+			} else if (value == "stopped") {
+				out.event = AnnounceQuery::Event::STOPPED;
+			} else if (value == "completed") {
+				out.event = AnnounceQuery::Event::COMPLETED;
+			} else {
+				out.event = AnnounceQuery::Event::NONE; // "empty" or anything else
+			}
+		} else if (key == "compact") {
+			out.compact = value == "1";
+		} else if (key == "no_peer_id") {
+			out.no_peer_id = value == "1";
+		} else if (key == "numwant") {
+			parse_uint(value, out.numwant);
+		}
+	}
+
+	return out.info_hash_size == 0 || out.info_hash_size == 20 || out.info_hash_size == 32;
+}
+
+template<typename T>
+static T read_be(const char* data) {
+	T value {0};
+	for (size_t i = 0; i < sizeof(T); i++) {
+		value = (value << 8) | uint8_t(data[i]);
+	}
+	return value;
+}
+
+bool parse_udp_tracker_request(std::string_view packet, UDPTrackerRequest& out) {
+	if (packet.size() < udp_tracker_request_header_size) {
+		return false;
+	}
+
+	out.connection_id = read_be<uint64_t>(packet.data());
+	out.action = UDPTrackerRequest::Action(read_be<uint32_t>(packet.data() + 8));
+	out.transaction_id = read_be<uint32_t>(packet.data() + 12);
+	return true;
+}
+
+bool parse_udp_tracker_announce(std::string_view packet, AnnounceQuery& out) {
+	if (packet.size() < udp_tracker_announce_size) {
+		return false;
+	}
+
+	// 16 header, 20 info_hash, 20 peer_id, 8 downloaded, 8 left, 8 uploaded,
+	// 4 event, 4 ip, 4 key, 4 num_want, 2 port. extensions (BEP 41) can follow
+	const char* data = packet.data();
+	std::copy_n(data + 16, 20, out.info_hash.begin());
+	out.info_hash_size = 20;
+
+	switch (read_be<uint32_t>(data + 80)) {
+		case 1: out.event = AnnounceQuery::Event::COMPLETED; break;
+		case 2: out.event = AnnounceQuery::Event::STARTED; break;
+		case 3: out.event = AnnounceQuery::Event::STOPPED; break;
+		default: out.event = AnnounceQuery::Event::NONE; break;
+	}
+
+	// -1 is the default
+	const int32_t numwant = read_be<uint32_t>(data + 92);
+	if (numwant >= 0) {
+		out.numwant = numwant;
+	}
+
+	out.port = read_be<uint16_t>(data + 96);
+
+	// there is only the binary peer list
+	out.compact = true;
+	out.no_peer_id = true;
+
+	return true;
+}
+
+bool parse_ipv4(std::string_view str, std::array<uint8_t, 4>& out) {
+	if (str == "localhost") {
+		out = {127, 0, 0, 1};
+		return true;
+	}
+
+	size_t pos = 0;
+	for (size_t i = 0; i < out.size(); i++) {
+		if (i > 0) {
+			if (pos >= str.size() || str[pos] != '.') {
+				return false;
+			}
+			pos++;
+		}
+
+		uint32_t value = 0;
+		size_t digits = 0;
+		while (pos < str.size() && str[pos] >= '0' && str[pos] <= '9' && digits < 3) {
+			value = value * 10 + (str[pos] - '0');
+			pos++;
+			digits++;
+		}
+		if (digits == 0 || value > 255) {
+			return false;
+		}
+		out[i] = value;
+	}
+
+	return pos == str.size();
+}
+
+void append_compact_peer(std::string& out, const std::array<uint8_t, 4>& ip, uint16_t port) {
+	out.append(reinterpret_cast<const char*>(ip.data()), ip.size());
+	out += static_cast<char>(port >> 8);
+	out += static_cast<char>(port & 0xff);
+}
+
+} // ttt
+
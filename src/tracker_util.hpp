@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+// string helpers of the http tracker, out here for the microbenchmarks
+namespace ttt {
+
+// skips empty parts
+std::vector<std::string_view> split(std::string_view str, const char* delims);
+
+std::string to_bencode(const std::string& value);
+std::string to_bencode(const int64_t& value);
+
+// percent decoding, eg. the binary info_hash of an announce
+std::vector<uint8_t> url_decode(const std::string_view v);
+
+// the parts of an announce query the tracker uses, filled without allocating
+struct AnnounceQuery {
+	enum class Event : uint8_t {
+		NONE, // regular interval announce
+		STARTED,
+		STOPPED,
+		COMPLETED,
+	};
+
+	// raw bytes, 20 for v1 and 32 for v2. 0 if missing
+	std::array<uint8_t, 32> info_hash {};
+	size_t info_hash_size {0};
+
+	uint16_t port {0};
+	Event event {Event::NONE};
+	bool compact {false};
+	bool no_peer_id {false};
+	uint32_t numwant {50}; // peers, spec default
+};
+
+// one pass over the raw query (eg. mg_str of the request), unknown keys are skipped,
+// numbers that dont parse keep their default. false if the info_hash is bonkers
+bool parse_announce_query(std::string_view query, AnnounceQuery& out);
+
+// BEP 15, the header every udp tracker request starts with
+struct UDPTrackerRequest {
+	enum class Action : uint32_t {
+		CONNECT = 0,
+		ANNOUNCE = 1,
+		SCRAPE = 2,
+		ERROR = 3, // responses only
+	};
+
+	uint64_t connection_id {0}; // the protocol id for connect
+	Action action {Action::CONNECT};
+	uint32_t transaction_id {0};
+};
+
+constexpr static uint64_t udp_tracker_protocol_id {0x41727101980};
+constexpr static size_t udp_tracker_request_header_size {16};
+constexpr static size_t udp_tracker_announce_size {98};
+
+// false if too short, everything on the wire is big endian
+bool parse_udp_tracker_request(std::string_view packet, UDPTrackerRequest& out);
+
+// the whole announce packet into the same struct the http tracker uses, false if too short
+bool parse_udp_tracker_announce(std::string_view packet, AnnounceQuery& out);
+
+// dotted quad or "localhost", false for anything else (names, ipv6)
+bool parse_ipv4(std::string_view str, std::array<uint8_t, 4>& out);
+
+// BEP 23, 4 bytes address and 2 bytes port, both network order
+void append_compact_peer(std::string& out, const std::array<uint8_t, 4>& ip, uint16_t port);
+
+} // ttt
+
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+namespace ttt {
+
+// counters for one direction of a tunnel. bumped from the tox and io thread,
+// read from anywhere. relaxed is enough, nothing else is ordered by them
+struct TrafficCounters {
+	std::atomic<uint64_t> packets {0}; // datagrams
+	std::atomic<uint64_t> bytes {0}; // datagram payload
+	std::atomic<uint64_t> fragments {0}; // tox packets carrying parts of large datagrams
+	std::atomic<uint64_t> drops {0}; // datagrams lost on our side (queues, rings)
+	std::atomic<uint64_t> reassembly_failures {0}; // large datagrams given up on, receiving only
+
+	void add(uint64_t size) {
+		packets.fetch_add(1, std::memory_order_relaxed);
+		bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+
+	static void inc(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+		counter.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	static uint64_t get(const std::atomic<uint64_t>& counter) {
+		return counter.load(std::memory_order_relaxed);
+	}
+};
+
+// exponentially weighted moving average of a counters rate, per second.
+// fed with totals at whatever interval, so it can live off the hot path
+struct RateEstimate {
+	float time_constant {5.f}; // seconds until an old rate has mostly faded
+
+	float rate {0.f};
+	uint64_t last_total {0};
+	bool primed {false};
+
+	void update(uint64_t total, float time_delta) {
+		if (!primed || time_delta <= 0.f) {
+			primed = true;
+			last_total = total;
+			return;
+		}
+
+		const float sample = (total - last_total) / time_delta;
+		last_total = total;
+
+		// independent of the interval, two half steps equal one full one
+		const float alpha = 1.f - std::exp(-time_delta / time_constant);
+		rate += alpha * (sample - rate);
+	}
+};
+
+} // ttt
+
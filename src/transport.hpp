@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace ttt::ext {
+
+// what the extensions need from tox and toxext. ToxTransport is the real thing,
+// MemoryTransport connects two extensions in process (benchmarks, stress tests)
+class Transport {
+	public:
+		enum class SendResult : uint8_t {
+			OK,
+			SENDQ, // not taken right now, retry later
+			FAILED, // retrying does not help
+		};
+
+		virtual ~Transport(void) {}
+
+		virtual bool friend_connected(uint32_t friend_number) = 0;
+		// empty if unknown
+		virtual std::vector<uint8_t> friend_public_key(uint32_t friend_number) = 0;
+
+		// lossy custom packet, including the packet id
+		virtual SendResult send_lossy(uint32_t friend_number, const uint8_t* data, size_t size) = 0;
+		// lossless, as a single toxext segment of the extension. false if nothing was sent
+		virtual bool send_segment(uint32_t friend_number, const uint8_t* data, size_t size) = 0;
+};
+
+} // ttt::ext
+
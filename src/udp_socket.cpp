@@ -0,0 +1,386 @@
+#include "./udp_socket.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+#ifdef TTT_UDP_BATCH
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <cerrno>
+
+#ifndef UDP_SEGMENT
+	#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+	#define UDP_GRO 104
+#endif
+#endif
+
+namespace ttt {
+
+#ifdef TTT_UDP_BATCH
+// gro can hand us up to 64k at once, so the batch gets smaller
+constexpr static size_t gro_size_max = 0xffff;
+constexpr static size_t gro_batch_size_max = 8;
+
+// kernel limit for segments per gso send (UDP_MAX_SEGMENTS)
+constexpr static size_t gso_segments_max = 64;
+constexpr static size_t gso_size_max = 0xffff - 8 - 20; // - udp and ip header
+
+static sockaddr_in to_sockaddr(const zed_net_address_t& addr) {
+	sockaddr_in sa {};
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = addr.host; // already network order
+	sa.sin_port = htons(addr.port);
+	return sa;
+}
+
+static zed_net_address_t from_sockaddr(const sockaddr_in& sa) {
+	zed_net_address_t addr {};
+	addr.host = sa.sin_addr.s_addr;
+	addr.port = ntohs(sa.sin_port);
+	return addr;
+}
+#endif
+
+UDPSocket::UDPSocket(UDPSocket&& other) {
+	_s = other._s;
+	other._s = {};
+
+#ifdef TTT_UDP_BATCH
+	_gso = other._gso;
+	_gro = other._gro;
+	_pktinfo = other._pktinfo;
+#endif
+
+	_send_queue = std::move(other._send_queue);
+	_send_buffer = std::move(other._send_buffer);
+}
+
+UDPSocket::~UDPSocket(void) {
+	close();
+}
+
+bool UDPSocket::open(uint16_t port, [[maybe_unused]] bool gso, [[maybe_unused]] bool gro) {
+	if (is_open()) {
+		close();
+	}
+
+	if (zed_net_udp_socket_open(&_s, port, 1) != 0) {
+		_s = {};
+		return false;
+	}
+
+#ifdef TTT_UDP_BATCH
+	// needs kernel 4.18 (gso) / 5.0 (gro), just stays off if not supported
+	_gso = gso;
+
+	_gro = false;
+	if (gro) {
+		int on = 1;
+		_gro = setsockopt(_s.handle, IPPROTO_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+	}
+
+	_pktinfo = false;
+#endif
+
+	return true;
+}
+
+bool UDPSocket::enable_pktinfo(void) {
+	if (!is_open()) {
+		return false;
+	}
+
+#ifdef TTT_UDP_BATCH
+	int on = 1;
+	_pktinfo = setsockopt(_s.handle, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) == 0;
+	return _pktinfo;
+#else
+	return false;
+#endif
+}
+
+void UDPSocket::close(void) {
+	if (!is_open()) {
+		return;
+	}
+
+	flush();
+
+	zed_net_socket_close(&_s);
+	_s = {};
+
+	_send_queue.clear();
+}
+
+int UDPSocket::receive(recv_fn_t fn, void* user_data, size_t count_max) {
+	if (!is_open()) {
+		return -1;
+	}
+
+#ifdef TTT_UDP_BATCH
+	const size_t slot_size = recv_headroom + (_gro ? gro_size_max : datagram_size_max);
+	const size_t batch_size = std::min(count_max, _gro ? gro_batch_size_max : batch_size_max);
+
+	// shared by all sockets on this thread, only used for the duration of the call
+	thread_local std::vector<uint8_t> storage {};
+	if (storage.size() < batch_size * slot_size) {
+		storage.resize(batch_size * slot_size);
+	}
+
+	mmsghdr msgs[batch_size_max];
+	iovec iovecs[batch_size_max];
+	sockaddr_in addrs[batch_size_max];
+	alignas(cmsghdr) uint8_t controls[batch_size_max][CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(in_pktinfo))];
+
+	size_t count = 0;
+	while (count < count_max) {
+		const size_t batch_count = std::min(batch_size, count_max - count);
+
+		for (size_t i = 0; i < batch_count; i++) {
+			iovecs[i].iov_base = storage.data() + i * slot_size + recv_headroom;
+			iovecs[i].iov_len = slot_size - recv_headroom;
+
+			msgs[i] = {};
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iovecs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			if (_gro || _pktinfo) {
+				msgs[i].msg_hdr.msg_control = controls[i];
+				msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+			}
+		}
+
+		const int ret = recvmmsg(_s.handle, msgs, batch_count, MSG_DONTWAIT, nullptr);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break; // empty
+			}
+			return count == 0 ? -1 : int(count);
+		}
+
+		for (int i = 0; i < ret; i++) {
+			const auto& hdr = msgs[i].msg_hdr;
+			if (hdr.msg_flags & MSG_TRUNC) {
+				std::cerr << "WWW got over max sized udp packet, dropping\n";
+				continue;
+			}
+
+			size_t segment_size = msgs[i].msg_len;
+			uint32_t local_host = 0;
+			if (_gro || _pktinfo) {
+				for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(const_cast<msghdr*>(&hdr), cmsg)) {
+					if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+						int gso_size = 0;
+						std::memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+						if (gso_size > 0) {
+							segment_size = gso_size;
+						}
+					} else if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+						in_pktinfo info {};
+						std::memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+						local_host = info.ipi_addr.s_addr;
+					}
+				}
+			}
+
+			const auto addr = from_sockaddr(addrs[i]);
+			uint8_t* data = static_cast<uint8_t*>(iovecs[i].iov_base);
+
+			// segments are processed in order, so writing into the headroom of a later
+			// segment only ever clobbers the tail of one that was already handled
+			for (size_t offset = 0; offset < msgs[i].msg_len; offset += segment_size) {
+				const size_t size = std::min<size_t>(segment_size, msgs[i].msg_len - offset);
+				if (size >= datagram_size_max) {
+					std::cerr << "WWW got over max sized udp packet, dropping\n";
+					continue;
+				}
+
+				fn(user_data, addr, local_host, data + offset, size);
+				count++;
+			}
+		}
+
+		if (size_t(ret) < batch_count) {
+			break; // socket drained
+		}
+	}
+
+	return count;
+#else
+	thread_local uint8_t storage[recv_headroom + datagram_size_max];
+
+	size_t count = 0;
+	for (; count < count_max; count++) {
+		zed_net_address_t addr {};
+		int bytes_read = zed_net_udp_socket_receive(&_s, &addr, storage + recv_headroom, datagram_size_max);
+		if (bytes_read < 0) {
+			return count == 0 ? -1 : int(count);
+		} else if (bytes_read == 0) {
+			break; // no more data
+		}
+
+		if (size_t(bytes_read) == datagram_size_max) {
+			std::cerr << "WWW got over max sized udp packet, dropping\n";
+			continue;
+		}
+
+		fn(user_data, addr, 0, storage + recv_headroom, bytes_read);
+	}
+
+	return count;
+#endif
+}
+
+bool UDPSocket::send(const zed_net_address_t& addr, const uint8_t* data, size_t size) {
+	return send_from(0, addr, data, size);
+}
+
+bool UDPSocket::send_from([[maybe_unused]] uint32_t local_host, const zed_net_address_t& addr, const uint8_t* data, size_t size) {
+	if (!is_open() || size == 0 || size >= datagram_size_max) {
+		return false;
+	}
+
+#ifdef TTT_UDP_BATCH
+	if (_send_buffer.empty()) {
+		// allocate once, so queueing does not touch the heap
+		_send_buffer.resize(batch_size_max * datagram_size_max);
+		_send_queue.reserve(batch_size_max);
+	}
+
+	const size_t offset = _send_queue.empty() ? 0 : _send_queue.back().offset + _send_queue.back().size;
+	if (_send_queue.size() >= batch_size_max || offset + size > _send_buffer.size()) {
+		flush();
+		return send_from(local_host, addr, data, size);
+	}
+
+	std::memcpy(_send_buffer.data() + offset, data, size);
+	_send_queue.push_back({addr, _pktinfo ? local_host : 0, offset, size});
+
+	return true;
+#else
+	return zed_net_udp_socket_send(&_s, addr, data, size) == 0;
+#endif
+}
+
+void UDPSocket::flush(void) {
+	if (_send_queue.empty()) {
+		return;
+	}
+
+#ifdef TTT_UDP_BATCH
+	mmsghdr msgs[batch_size_max];
+	iovec iovecs[batch_size_max];
+	sockaddr_in addrs[batch_size_max];
+	alignas(cmsghdr) uint8_t controls[batch_size_max][CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(in_pktinfo))];
+	size_t msg_first_entry[batch_size_max]; // index into _send_queue
+
+	// build messages, with gso consecutive datagrams to the same destination
+	// with the same size (last one may be shorter) get merged into one
+	size_t msg_count = 0;
+	for (size_t i = 0; i < _send_queue.size();) {
+		const auto& first = _send_queue[i];
+
+		size_t run_end = i + 1;
+		size_t run_bytes = first.size;
+		if (_gso) {
+			while (
+				run_end < _send_queue.size() &&
+				run_end - i < gso_segments_max &&
+				_send_queue[run_end].addr.host == first.addr.host &&
+				_send_queue[run_end].addr.port == first.addr.port &&
+				_send_queue[run_end].local_host == first.local_host &&
+				_send_queue[run_end].size <= first.size &&
+				run_bytes + _send_queue[run_end].size <= gso_size_max
+			) {
+				run_bytes += _send_queue[run_end].size;
+				if (_send_queue[run_end++].size < first.size) {
+					break; // shorter one has to be last
+				}
+			}
+		}
+
+		// entries are contiguous in the send buffer
+		msg_first_entry[msg_count] = i;
+		addrs[msg_count] = to_sockaddr(first.addr);
+		iovecs[msg_count].iov_base = _send_buffer.data() + first.offset;
+		iovecs[msg_count].iov_len = run_bytes;
+
+		msgs[msg_count] = {};
+		auto& hdr = msgs[msg_count].msg_hdr;
+		hdr.msg_name = &addrs[msg_count];
+		hdr.msg_namelen = sizeof(addrs[msg_count]);
+		hdr.msg_iov = &iovecs[msg_count];
+		hdr.msg_iovlen = 1;
+
+		const bool with_segment = run_end - i > 1;
+		const bool with_pktinfo = first.local_host != 0;
+		if (with_segment || with_pktinfo) {
+			hdr.msg_control = controls[msg_count];
+			hdr.msg_controllen =
+				(with_segment ? CMSG_SPACE(sizeof(uint16_t)) : 0) +
+				(with_pktinfo ? CMSG_SPACE(sizeof(in_pktinfo)) : 0)
+			;
+			std::memset(controls[msg_count], 0, hdr.msg_controllen);
+
+			cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+			if (with_segment) {
+				cmsg->cmsg_level = SOL_UDP;
+				cmsg->cmsg_type = UDP_SEGMENT;
+				cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+				const uint16_t segment_size = first.size;
+				std::memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+				cmsg = CMSG_NXTHDR(&hdr, cmsg);
+			}
+			if (with_pktinfo) {
+				cmsg->cmsg_level = IPPROTO_IP;
+				cmsg->cmsg_type = IP_PKTINFO;
+				cmsg->cmsg_len = CMSG_LEN(sizeof(in_pktinfo));
+				in_pktinfo info {};
+				info.ipi_spec_dst.s_addr = first.local_host;
+				std::memcpy(CMSG_DATA(cmsg), &info, sizeof(info));
+			}
+		}
+
+		msg_count++;
+		i = run_end;
+	}
+
+	size_t sent = 0;
+	while (sent < msg_count) {
+		const int ret = sendmmsg(_s.handle, msgs + sent, msg_count - sent, MSG_DONTWAIT);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (_gso && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+				// kernel or nic can not do it, resend the rest without gso
+				std::cerr << "WWW disabling udp gso " << errno << "\n";
+				_gso = false;
+
+				_send_queue.erase(_send_queue.begin(), _send_queue.begin() + msg_first_entry[sent]);
+				flush();
+				return;
+			}
+
+			// EAGAIN and friends, udp is allowed to drop
+			break;
+		}
+
+		sent += ret;
+	}
+
+	_send_queue.clear();
+#endif
+}
+
+} // ttt
+
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <zed_net.h>
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// linux gets batched io (recvmmsg/sendmmsg + optional gso/gro),
+// everything else falls back to plain zed_net
+#if defined(__linux__) && !defined(TTT_UDP_NO_BATCH)
+	#define TTT_UDP_BATCH 1
+#endif
+
+namespace ttt {
+
+// non-blocking udp socket used by the tunnels
+class UDPSocket {
+	public:
+		// largest datagram we care about
+		constexpr static size_t datagram_size_max = 2048;
+
+		// every received datagram has at least this many writable bytes in front of it,
+		// so headers can be prepended in place (valid until the callback returns)
+		constexpr static size_t recv_headroom = 8;
+
+		// max datagrams per recvmmsg/sendmmsg call
+		constexpr static size_t batch_size_max = 64;
+
+		// addr is the sender, data is only valid during the call
+		// local_host is the address the datagram was sent to (network order),
+		// only known with pktinfo enabled, otherwise 0
+		using recv_fn_t = void(*)(void* user_data, const zed_net_address_t& addr, uint32_t local_host, uint8_t* data, size_t size);
+
+	public:
+		UDPSocket(void) = default;
+		UDPSocket(const UDPSocket&) = delete;
+		UDPSocket(UDPSocket&& other);
+		~UDPSocket(void);
+
+		// binds to port, false if that failed (eg. port in use)
+		bool open(uint16_t port, bool gso = true, bool gro = true);
+		void close(void);
+
+		bool is_open(void) const { return _s.handle > 0; }
+		int handle(void) const { return _s.handle; }
+
+		// report/choose the local address per datagram (IP_PKTINFO), needed when
+		// one socket (bound to any) stands in for many addresses. linux only
+		bool enable_pktinfo(void);
+
+		// reads at most count_max datagrams (gro segments count individually)
+		// returns the number of datagrams passed to fn, or -1 on error
+		int receive(recv_fn_t fn, void* user_data, size_t count_max);
+
+		// queues a datagram, sent on flush() or when the batch is full
+		// returns false if the datagram got dropped
+		bool send(const zed_net_address_t& addr, const uint8_t* data, size_t size);
+		// same, but sent from local_host (network order, 0 lets the kernel pick). needs pktinfo
+		bool send_from(uint32_t local_host, const zed_net_address_t& addr, const uint8_t* data, size_t size);
+
+		// sends everything queued
+		void flush(void);
+		bool has_pending(void) const { return !_send_queue.empty(); }
+
+	private:
+		zed_net_socket_t _s {};
+
+#ifdef TTT_UDP_BATCH
+		bool _gso {false};
+		bool _gro {false};
+		bool _pktinfo {false};
+#endif
+
+		struct SendEntry {
+			zed_net_address_t addr {};
+			uint32_t local_host {0};
+			size_t offset {0}; // into _send_buffer
+			size_t size {0};
+		};
+		std::vector<SendEntry> _send_queue {};
+		std::vector<uint8_t> _send_buffer {};
+};
+
+} // ttt
+